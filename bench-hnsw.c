@@ -0,0 +1,102 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+#include "vectors.h"
+
+const long long max_size = 2000;         // max length of strings
+const long long max_exact = 100;         // queries to time the exact search with
+
+struct vectors v;
+
+// Seconds since some fixed time
+double Now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Find the n nearest rows to each of the nq query rows in rows (other
+// than itself) into best and bestd, one query at a time; return the
+// queries per second
+double Search(long long *rows, long long nq, long long n, long long *best, float *bestd) {
+  double start = Now();
+  long long q;
+  for (q = 0; q < nq; q++) NearestRows(&v, v.M + rows[q] * v.size, -1, rows + q, 1, n, best + q * n, bestd + q * n);
+  return nq / (Now() - start);
+}
+
+int main(int argc, char **argv) {
+  char file_name[max_size];
+  unsigned long long next_random = 1;
+  long long a, q, nq = 1000, n = 40, ef, found, total, *rows, *exact, *best, **skip, *nskip;
+  float *Q, *exactd, *bestd;
+  double qps;
+  struct hnsw *h;
+  if (argc < 2) {
+    printf("Usage: ./bench-hnsw <FILE> [<QUERIES> [<N>]]\nwhere FILE contains word projections in the BINARY or MAPPED FORMAT (word2vec -binary 1, 2 or 3) and FILE.hnsw\n");
+    printf("their graph index (from build-hnsw).  For QUERIES (default 1000) random words, the N (default 40) nearest other words\n");
+    printf("are found by comparing with all the words and through the index with increasing EF, printing the fraction of the\n");
+    printf("exact N found through the index (recall@N; words as near as the N-th exact one count, so that ties do not count\n");
+    printf("as misses) and the queries per second (one at a time) of each\n");
+    return 0;
+  }
+  strcpy(file_name, argv[1]);
+  if (argc > 2) nq = atoll(argv[2]);
+  if (argc > 3) n = atoll(argv[3]);
+  if (ReadVectors(file_name, 0, 0, &v)) return -1;
+  if (OpenHnsw(&v, file_name, 1)) return -1;
+  if (v.words < 2 || nq < 1 || n < 1) return 0;
+  rows = (long long *)malloc(nq * sizeof(long long));
+  exact = (long long *)malloc(nq * n * sizeof(long long));
+  best = (long long *)malloc(nq * n * sizeof(long long));
+  exactd = (float *)malloc(nq * n * sizeof(float));
+  bestd = (float *)malloc(nq * n * sizeof(float));
+  skip = (long long **)malloc(nq * sizeof(long long *));
+  nskip = (long long *)malloc(nq * sizeof(long long));
+  Q = (float *)calloc((nq + 3) * v.size, sizeof(float));
+  for (q = 0; q < nq; q++) {
+    next_random = next_random * (unsigned long long)25214903917 + 11;
+    rows[q] = (next_random >> 16) % v.words;
+    memcpy(Q + q * v.size, v.M + rows[q] * v.size, v.size * sizeof(float));
+    skip[q] = rows + q;
+    nskip[q] = 1;
+  }
+  // the exact answers, all at once, then the speed of the exact search
+  // one query at a time (for a few of them)
+  h = v.hnsw;
+  v.hnsw = NULL;
+  NearestRowsBatch(&v, Q, nq, -1, skip, nskip, n, exact, exactd);
+  qps = Search(rows, nq < max_exact ? nq : max_exact, n, best, bestd);
+  printf("Words: %lld  Queries: %lld  N: %lld  Threads: %d\n", v.words, nq, n, v.threads);
+  printf("EF\trecall@%lld\tqueries/sec\n", n);
+  printf("exact\t%.4f\t%.1f\n", 1.0, qps);
+  v.hnsw = h;
+  for (ef = n; ef <= 32 * n; ef *= 2) {
+    v.ef = ef;
+    qps = Search(rows, nq, n, best, bestd);
+    found = 0;
+    total = 0;
+    for (q = 0; q < nq; q++) for (a = 0; a < n && exact[q * n + a] != -1; a++) {
+      total++;
+      if (best[q * n + a] != -1 && bestd[q * n + a] >= exactd[q * n + n - 1]) found++;
+    }
+    printf("%lld\t%.4f\t%.1f\n", ef, found / (double)total, qps);
+  }
+  return 0;
+}
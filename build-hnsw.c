@@ -0,0 +1,201 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdlib.h>
+#include "vectors.h"
+
+const long long max_size = 2000;         // max length of strings
+
+struct vectors v;
+struct hnsw h;
+long long M = 16, ef_construction = 200, threads;
+long long next_row = 1;                  // next row to insert
+pthread_mutex_t entry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Draw the number of layers above 0 of each row (-log(u) / log(M) for a
+// uniform u in (0, 1], from the random numbers of word2vec seeded by
+// the row) and lay out their lists in h.upper
+void LayOutLayers() {
+  unsigned long long next_random;
+  long long a, b, level;
+  h.upper_offsets = (uint64_t *)malloc((v.words + 1) * sizeof(uint64_t));
+  h.upper_offsets[0] = 0;
+  for (b = 0; b < v.words; b++) {
+    next_random = b;
+    for (a = 0; a < 4; a++) next_random = next_random * (unsigned long long)25214903917 + 11;
+    level = -log(((next_random >> 11) + 1) / 9007199254740992.0) / log(M);
+    if (level > HNSW_MAX_LEVEL) level = HNSW_MAX_LEVEL;
+    h.upper_offsets[b + 1] = h.upper_offsets[b] + level * (M + 1);
+  }
+  h.upper = (uint32_t *)calloc(h.upper_offsets[v.words] + 1, sizeof(uint32_t));
+  h.links = (uint32_t *)calloc(v.words * (2 * M + 1), sizeof(uint32_t));
+}
+
+// Choose up to m of the count rows in cand (with their dot products
+// with row r) as the neighbors of r, into links: the best first, each
+// only if it is nearer to r than to those chosen before it (so that
+// the neighbors point in different directions).  Return how many.
+long long SelectNeighbors(struct ranked_row *cand, long long count, long long m, uint32_t *links) {
+  long long a, b, n = 0;
+  qsort(cand, count, sizeof(struct ranked_row), CompareRanks);
+  for (a = 0; a < count && n < m; a++) {
+    for (b = 0; b < n; b++) if (Dot(v.M + cand[a].r * v.size, v.M + links[b] * v.size, v.size) > cand[a].d) break;
+    if (b == n) links[n++] = cand[a].r;
+  }
+  return n;
+}
+
+// Add row q as a neighbor of row r in layer level, choosing again among
+// the neighbors of r (using cand) if it has as many as it can
+void Connect(long long r, long long q, long long level, struct ranked_row *cand) {
+  uint32_t *l = Links(&h, r, level);
+  long long a, m = level ? M : 2 * M;
+  pthread_mutex_lock(&h.locks[r % HNSW_LOCKS]);
+  if (l[0] < m) l[++l[0]] = q;
+  else {
+    for (a = 0; a < m; a++) {
+      cand[a].r = l[a + 1];
+      cand[a].d = Dot(v.M + r * v.size, v.M + l[a + 1] * v.size, v.size);
+    }
+    cand[m].r = q;
+    cand[m].d = Dot(v.M + r * v.size, v.M + q * v.size, v.size);
+    l[0] = SelectNeighbors(cand, m + 1, m, l + 1);
+  }
+  pthread_mutex_unlock(&h.locks[r % HNSW_LOCKS]);
+}
+
+// Insert row q into the graph: go down from the entry row to the layers
+// q is in, and in each of them search for its ef_construction nearest
+// rows, choose its neighbors among them and link them back to q.  If q
+// goes higher than the graph so far, it becomes the entry row (and the
+// entry lock is held meanwhile).
+void InsertRow(long long q, struct hnsw_search *s, struct ranked_row *cand) {
+  float *vec = v.M + q * v.size;
+  long long a, b, n, ep, top, level = Level(&h, q);
+  uint32_t links[2 * M];
+  pthread_mutex_lock(&entry_lock);
+  ep = h.entry;
+  top = h.max_level;
+  if (level <= top) pthread_mutex_unlock(&entry_lock);
+  for (a = top; a > level; a--) {
+    SearchLayer(&v, s, vec, ep, 1, a);
+    ep = s->results.rows[0].r;
+  }
+  for (a = level < top ? level : top; a >= 0; a--) {
+    SearchLayer(&v, s, vec, ep, ef_construction, a);
+    for (b = 0; b < s->results.count; b++) cand[b] = s->results.rows[b];
+    n = SelectNeighbors(cand, s->results.count, a ? M : 2 * M, links);
+    // (cand is now sorted, the nearest first)
+    ep = cand[0].r;
+    pthread_mutex_lock(&h.locks[q % HNSW_LOCKS]);
+    memcpy(Links(&h, q, a) + 1, links, n * sizeof(uint32_t));
+    Links(&h, q, a)[0] = n;
+    pthread_mutex_unlock(&h.locks[q % HNSW_LOCKS]);
+    for (b = 0; b < n; b++) Connect(links[b], q, a, cand);
+  }
+  if (level > top) {
+    h.entry = q;
+    h.max_level = level;
+    pthread_mutex_unlock(&entry_lock);
+  }
+}
+
+// Insert rows until there are none left
+void *BuildThread(void *id) {
+  struct hnsw_search *s = h.searches + (long long)id;
+  struct ranked_row *cand = (struct ranked_row *)malloc((ef_construction + 2 * M + 1) * sizeof(struct ranked_row));
+  long long q;
+  while ((q = __sync_fetch_and_add(&next_row, 1)) < v.words) {
+    InsertRow(q, s, cand);
+    if (q % 10000 == 0) {
+      printf("%cRows: %lld  Progress: %.2f%%  ", 13, q, q * 100.0 / v.words);
+      fflush(stdout);
+    }
+  }
+  free(cand);
+  return NULL;
+}
+
+// Write the graph to file_name
+void WriteHnsw(char *file_name) {
+  FILE *fo = fopen(file_name, "wb");
+  struct hnsw_header hd;
+  char zero[64] = {0};
+  if (fo == NULL) {
+    printf("Cannot open %s for writing\n", file_name);
+    exit(1);
+  }
+  memset(&hd, 0, sizeof(hd));
+  memcpy(hd.magic, HNSW_MAGIC, sizeof(hd.magic));
+  hd.version = HNSW_VERSION;
+  hd.header_size = sizeof(hd);
+  hd.words = v.words;
+  hd.size = v.size;
+  hd.M = M;
+  hd.max_level = h.max_level;
+  hd.entry = h.entry;
+  hd.links_offset = (sizeof(hd) + VECTORS_ALIGN - 1) / VECTORS_ALIGN * VECTORS_ALIGN;
+  hd.upper_offsets_offset = (hd.links_offset + v.words * (2 * M + 1) * sizeof(uint32_t) + 7) / 8 * 8;
+  hd.upper_offset = hd.upper_offsets_offset + (v.words + 1) * sizeof(uint64_t);
+  hd.upper_count = h.upper_offsets[v.words];
+  hd.file_size = hd.upper_offset + hd.upper_count * sizeof(uint32_t);
+  fwrite(&hd, sizeof(hd), 1, fo);
+  fwrite(zero, 1, hd.links_offset - sizeof(hd), fo);
+  fwrite(h.links, sizeof(uint32_t), v.words * (2 * M + 1), fo);
+  fwrite(zero, 1, hd.upper_offsets_offset - (hd.links_offset + v.words * (2 * M + 1) * sizeof(uint32_t)), fo);
+  fwrite(h.upper_offsets, sizeof(uint64_t), v.words + 1, fo);
+  fwrite(h.upper, sizeof(uint32_t), hd.upper_count, fo);
+  fclose(fo);
+}
+
+int main(int argc, char **argv) {
+  char file_name[max_size], index_name[max_size + 10];
+  long long a;
+  pthread_t *pt;
+  if (argc < 2) {
+    printf("Usage: ./build-hnsw <FILE> [<M> [<EF> [<THREADS>]]]\nwhere FILE contains word projections in the BINARY or MAPPED FORMAT (word2vec -binary 1, 2 or 3)\n");
+    printf("Builds a graph index of them for approximate nearest-neighbor queries (distance and word-analogy with -ef), FILE.hnsw,\n");
+    printf("linking each word to up to M (default 16) others per layer, chosen among the EF (default 200) nearest found,\n");
+    printf("using THREADS threads (default: the number of CPUs)\n");
+    return 0;
+  }
+  strcpy(file_name, argv[1]);
+  if (argc > 2) M = atoll(argv[2]);
+  if (argc > 3) ef_construction = atoll(argv[3]);
+  if (M < 2) M = 2;
+  if (ef_construction < 1) ef_construction = 1;
+  if (ReadVectors(file_name, 0, 0, &v)) return -1;
+  threads = argc > 4 ? atoll(argv[4]) : v.threads;
+  if (threads < 1) threads = 1;
+  h.words = v.words;
+  h.M = M;
+  LayOutLayers();
+  h.locks = (pthread_mutex_t *)malloc(HNSW_LOCKS * sizeof(pthread_mutex_t));
+  for (a = 0; a < HNSW_LOCKS; a++) pthread_mutex_init(&h.locks[a], NULL);
+  NewHnswSearches(&h, threads);
+  v.hnsw = &h;
+  // the first row is the graph to begin with
+  h.entry = 0;
+  h.max_level = v.words > 0 ? Level(&h, 0) : 0;
+  pt = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  for (a = 0; a < threads; a++) pthread_create(&pt[a], NULL, BuildThread, (void *)a);
+  for (a = 0; a < threads; a++) pthread_join(pt[a], NULL);
+  printf("%cRows: %lld  Progress: 100.00%%  Layers: %lld\n", 13, v.words, h.max_level + 1);
+  snprintf(index_name, sizeof(index_name), "%s.hnsw", file_name);
+  WriteHnsw(index_name);
+  return 0;
+}
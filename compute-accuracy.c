@@ -15,129 +15,308 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <math.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include "vectors.h"
 
 const long long max_size = 2000;         // max length of strings
-const long long N = 1;                   // number of closest words
-const long long max_w = 50;              // max length of vocabulary entries
+const long long question_block = 512;    // queries compared with a block of rows at a time
+const long long row_block = 64;          // rows in a block
 
-int main(int argc, char **argv)
-{
-  FILE *f;
-  char st1[max_size], st2[max_size], st3[max_size], st4[max_size], bestw[N][max_size], file_name[max_size];
-  float dist, len, bestd[N], vec[max_size];
-  long long words, size, a, b, c, d, b1, b2, b3, threshold = 0;
-  float *M;
-  char *vocab;
-  int TCN, CCN = 0, TACN = 0, CACN = 0, SECN = 0, SYCN = 0, SEAC = 0, SYAC = 0, QID = 0, TQ = 0, TQS = 0;
-  if (argc < 2) {
-    printf("Usage: ./compute-accuracy <FILE> <threshold>\nwhere FILE contains word projections, and threshold is used to reduce vocabulary of the model for fast approximate evaluation (0 = off, otherwise typical value is 30000)\n");
-    return 0;
+struct vectors v;
+int cosmul = 0;                          // 1 to also answer with 3CosMul
+char *input, **tokens;                   // the questions (stdin), split at whitespace
+long long ntokens, next_token;
+int input_eof;                           // 1 if stdin ends right after the last token
+int eof;                                 // (feof(stdin) as it was when reading with scanf)
+long long nq = 0;                        // number of questions with all words known
+long long *rows;                         // rows of the first three words of each question
+long long per;                           // queries per question (the analogy vector, and the
+                                         // three words for 3CosMul)
+long long nqueries;                      // nq * per, rounded up to a multiple of 32
+float *QT;                               // queries, in groups of 8 interleaved by element
+long long *add_best, *mul_best;          // answers (rows, -1 if none) by 3CosAdd and 3CosMul
+
+// A range of rows to compare with all the queries, and the best answers
+// among them
+struct accuracy_job {
+  long long begin, end;
+  long long *add_best, *mul_best;
+  float *add_d, *mul_d;
+};
+
+// Read the next token of the questions into st, as scanf("%s", st) did
+// (at the end, st is left as it is and eof is set)
+void NextToken(char *st) {
+  if (next_token == ntokens) {
+    eof = 1;
+    return;
   }
-  strcpy(file_name, argv[1]);
-  if (argc > 2) threshold = atoi(argv[2]);
-  f = fopen(file_name, "rb");
-  if (f == NULL) {
-    printf("Input file not found\n");
-    return -1;
+  strncpy(st, tokens[next_token], max_size - 1);
+  st[max_size - 1] = 0;
+  next_token++;
+  if (next_token == ntokens && input_eof) eof = 1;
+}
+
+// Read stdin and split it into tokens
+void ReadTokens() {
+  long long a, size = 0, capacity = 1 << 20;
+  input = (char *)malloc(capacity);
+  while ((a = fread(input + size, 1, capacity - size, stdin)) > 0) {
+    size += a;
+    if (size == capacity) input = (char *)realloc(input, capacity *= 2);
+  }
+  input_eof = size > 0 && !isspace((unsigned char)input[size - 1]);
+  tokens = (char **)malloc((size / 2 + 1) * sizeof(char *));
+  for (a = 0, ntokens = 0; a < size; ) {
+    while (a < size && isspace((unsigned char)input[a])) a++;
+    if (a == size) break;
+    tokens[ntokens++] = input + a;
+    while (a < size && !isspace((unsigned char)input[a])) a++;
+    if (a < size) input[a++] = 0;
+  }
+}
+
+// Dot products of the 32 queries of four groups at qt with the four
+// rows at m (size apart): each lane sums its products in order, as a
+// scalar loop would, so the results are the same
+static inline void Dot32x4(const float *qt, const float *m, long long size, v8sf d[4][4]) {
+  v8sf x[4], r;
+  long long a, b, c;
+  memset(d, 0, 16 * sizeof(v8sf));
+  for (a = 0; a < size; a++) {
+    for (b = 0; b < 4; b++) memcpy(&x[b], qt + (b * size + a) * 8, sizeof(r));
+    for (c = 0; c < 4; c++) {
+      r = (v8sf){0} + m[c * size + a];
+      for (b = 0; b < 4; b++) d[b][c] += x[b] * r;
+    }
   }
-  fscanf(f, "%lld", &words);
-  if (threshold) if (words > threshold) words = threshold;
-  fscanf(f, "%lld", &size);
-  vocab = (char *)malloc(words * max_w * sizeof(char));
-  M = (float *)malloc(words * size * sizeof(float));
-  if (M == NULL) {
-    printf("Cannot allocate memory: %lld MB\n", words * size * sizeof(float) / 1048576);
-    return -1;
+}
+
+// Dot products of the 32 queries of four groups at qt with the row at m
+static inline void Dot32x1(const float *qt, const float *m, long long size, v8sf d[4]) {
+  v8sf x, r;
+  long long a, b;
+  memset(d, 0, 4 * sizeof(v8sf));
+  for (a = 0; a < size; a++) {
+    r = (v8sf){0} + m[a];
+    for (b = 0; b < 4; b++) {
+      memcpy(&x, qt + (b * size + a) * 8, sizeof(x));
+      d[b] += x * r;
+    }
   }
-  for (b = 0; b < words; b++) {
-    a = 0;
-    while (1) {
-      vocab[b * max_w + a] = fgetc(f);
-      if (feof(f) || (vocab[b * max_w + a] == ' ')) break;
-      if ((a < max_w) && (vocab[b * max_w + a] != '\n')) a++;
+}
+
+// Take the dot products d of the 32 queries from k on with row r as
+// answers of their questions (if better than those of job so far)
+static inline void Answer(struct accuracy_job *job, long long k, long long r, v8sf d[4]) {
+  long long b, q;
+  float *s, score;
+  for (b = 0; b < 32 && k + b < nq * per; b += per) {
+    q = (k + b) / per;
+    if (r == rows[q * 3] || r == rows[q * 3 + 1] || r == rows[q * 3 + 2]) continue;
+    s = (float *)&d[b / 8] + b % 8;
+    if (s[0] > job->add_d[q]) {
+      job->add_d[q] = s[0];
+      job->add_best[q] = r;
+    }
+    if (per == 1) continue;
+    // (the cosines with the three words, shifted to [0, 1])
+    score = (s[2] + 1) / 2 * ((s[3] + 1) / 2) / ((s[1] + 1) / 2 + 0.001f);
+    if (score > job->mul_d[q]) {
+      job->mul_d[q] = score;
+      job->mul_best[q] = r;
     }
-    vocab[b * max_w + a] = 0;
-    for (a = 0; a < max_w; a++) vocab[b * max_w + a] = toupper(vocab[b * max_w + a]);
-    for (a = 0; a < size; a++) fread(&M[a + b * size], sizeof(float), 1, f);
-    len = 0;
-    for (a = 0; a < size; a++) len += M[a + b * size] * M[a + b * size];
-    len = sqrt(len);
-    for (a = 0; a < size; a++) M[a + b * size] /= len;
   }
-  fclose(f);
+}
+
+// Compare the rows of a job with all the queries: a block of queries
+// (kept in the cache) with a block of rows at a time, in turn 32
+// queries with four rows at a time
+void *AccuracyThread(void *arg) {
+  struct accuracy_job *job = (struct accuracy_job *)arg;
+  long long size = v.size, k0, r0, r1, k, r, c;
+  v8sf d[4][4], e[4];
+  for (k0 = 0; k0 < nqueries; k0 += question_block)
+    for (r0 = job->begin; r0 < job->end; r0 = r1) {
+      r1 = r0 + row_block < job->end ? r0 + row_block : job->end;
+      for (k = k0; k < k0 + question_block && k < nqueries; k += 32) {
+        for (r = r0; r + 4 <= r1; r += 4) {
+          Dot32x4(QT + k * size, v.M + r * size, size, d);
+          for (c = 0; c < 4; c++) {
+            e[0] = d[0][c];
+            e[1] = d[1][c];
+            e[2] = d[2][c];
+            e[3] = d[3][c];
+            Answer(job, k, r + c, e);
+          }
+        }
+        for (; r < r1; r++) {
+          Dot32x1(QT + k * size, v.M + r * size, size, e);
+          Answer(job, k, r, e);
+        }
+      }
+    }
+  return NULL;
+}
+
+// Answer all the questions: the analogy vectors (and the vectors of the
+// three words, for 3CosMul) are the queries, compared with the rows of
+// M by v.threads threads, each taking a range of rows
+void AnswerQuestions() {
+  long long a, b, q, k, threads = v.threads;
+  float *vec;
+  pthread_t *pt;
+  struct accuracy_job *jobs;
+  per = cosmul ? 4 : 1;
+  nqueries = (nq * per + 31) / 32 * 32;
+  QT = (float *)calloc(nqueries * v.size, sizeof(float));
+  vec = (float *)malloc(v.size * sizeof(float));
+  for (k = 0; k < nq * per; k++) {
+    q = k / per;
+    if (k % per == 0) for (a = 0; a < v.size; a++) vec[a] = (v.M[a + rows[q * 3 + 1] * v.size] - v.M[a + rows[q * 3] * v.size]) + v.M[a + rows[q * 3 + 2] * v.size];
+    else for (a = 0; a < v.size; a++) vec[a] = v.M[a + rows[q * 3 + k % per - 1] * v.size];
+    for (a = 0; a < v.size; a++) QT[(k / 8 * v.size + a) * 8 + k % 8] = vec[a];
+  }
+  if (threads > v.words / 1024 + 1) threads = v.words / 1024 + 1;
+  pt = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  jobs = (struct accuracy_job *)calloc(threads, sizeof(struct accuracy_job));
+  for (a = 0; a < threads; a++) {
+    jobs[a].begin = v.words * a / threads;
+    jobs[a].end = v.words * (a + 1) / threads;
+    jobs[a].add_best = (long long *)malloc(nq * sizeof(long long));
+    jobs[a].mul_best = (long long *)malloc(nq * sizeof(long long));
+    jobs[a].add_d = (float *)malloc(nq * sizeof(float));
+    jobs[a].mul_d = (float *)malloc(nq * sizeof(float));
+    for (q = 0; q < nq; q++) {
+      jobs[a].add_best[q] = jobs[a].mul_best[q] = -1;
+      jobs[a].add_d[q] = 0;
+      jobs[a].mul_d[q] = -1;
+    }
+  }
+  if (threads == 1) AccuracyThread(jobs);
+  else {
+    for (a = 0; a < threads; a++) pthread_create(&pt[a], NULL, AccuracyThread, (void *)&jobs[a]);
+    for (a = 0; a < threads; a++) pthread_join(pt[a], NULL);
+  }
+  // (the first thread with the best answer has the first row)
+  add_best = (long long *)malloc(nq * sizeof(long long));
+  mul_best = (long long *)malloc(nq * sizeof(long long));
+  for (q = 0; q < nq; q++) {
+    for (a = 0, b = 0; a < threads; a++) if (jobs[a].add_d[q] > jobs[b].add_d[q]) b = a;
+    add_best[q] = jobs[b].add_best[q];
+    for (a = 0, b = 0; a < threads; a++) if (jobs[a].mul_d[q] > jobs[b].mul_d[q]) b = a;
+    mul_best[q] = jobs[b].mul_best[q];
+  }
+  for (a = 0; a < threads; a++) {
+    free(jobs[a].add_best);
+    free(jobs[a].mul_best);
+    free(jobs[a].add_d);
+    free(jobs[a].mul_d);
+  }
+  free(jobs);
+  free(pt);
+  free(vec);
+  free(QT);
+}
+
+// Go through the questions, section by section; first (if report is 0)
+// just to collect those with all words known into rows, then to count
+// and print how many were answered right
+void Evaluate(int report) {
+  char st1[max_size], st2[max_size], st3[max_size], st4[max_size];
+  long long a, b1, b2, b3, q = 0;
+  int TCN, CCN = 0, TACN = 0, CACN = 0, SECN = 0, SYCN = 0, SEAC = 0, SYAC = 0, QID = 0, TQ = 0, TQS = 0;
+  int CCM = 0, CACM = 0, SEAM = 0, SYAM = 0; // (the same, for 3CosMul)
+  next_token = 0;
+  eof = 0;
+  st1[0] = st2[0] = st3[0] = st4[0] = 0;
   TCN = 0;
   while (1) {
-    for (a = 0; a < N; a++) bestd[a] = 0;
-    for (a = 0; a < N; a++) bestw[a][0] = 0;
-    scanf("%s", st1);
+    NextToken(st1);
     for (a = 0; a < strlen(st1); a++) st1[a] = toupper(st1[a]);
-    if ((!strcmp(st1, ":")) || (!strcmp(st1, "EXIT")) || feof(stdin)) {
+    if ((!strcmp(st1, ":")) || (!strcmp(st1, "EXIT")) || eof) {
       if (TCN == 0) TCN = 1;
-      if (QID != 0) {
+      if (QID != 0 && report) {
         printf("ACCURACY TOP1: %.2f %%  (%d / %d)\n", CCN / (float)TCN * 100, CCN, TCN);
         printf("Total accuracy: %.2f %%   Semantic accuracy: %.2f %%   Syntactic accuracy: %.2f %% \n", CACN / (float)TACN * 100, SEAC / (float)SECN * 100, SYAC / (float)SYCN * 100);
+        if (cosmul) {
+          printf("3CosMul ACCURACY TOP1: %.2f %%  (%d / %d)\n", CCM / (float)TCN * 100, CCM, TCN);
+          printf("3CosMul total accuracy: %.2f %%   Semantic accuracy: %.2f %%   Syntactic accuracy: %.2f %% \n", CACM / (float)TACN * 100, SEAM / (float)SECN * 100, SYAM / (float)SYCN * 100);
+        }
       }
       QID++;
-      scanf("%s", st1);
-      if (feof(stdin)) break;
-      printf("%s:\n", st1);
+      NextToken(st1);
+      if (eof) break;
+      if (report) printf("%s:\n", st1);
       TCN = 0;
       CCN = 0;
+      CCM = 0;
       continue;
     }
     if (!strcmp(st1, "EXIT")) break;
-    scanf("%s", st2);
+    NextToken(st2);
     for (a = 0; a < strlen(st2); a++) st2[a] = toupper(st2[a]);
-    scanf("%s", st3);
+    NextToken(st3);
     for (a = 0; a<strlen(st3); a++) st3[a] = toupper(st3[a]);
-    scanf("%s", st4);
+    NextToken(st4);
     for (a = 0; a < strlen(st4); a++) st4[a] = toupper(st4[a]);
-    for (b = 0; b < words; b++) if (!strcmp(&vocab[b * max_w], st1)) break;
-    b1 = b;
-    for (b = 0; b < words; b++) if (!strcmp(&vocab[b * max_w], st2)) break;
-    b2 = b;
-    for (b = 0; b < words; b++) if (!strcmp(&vocab[b * max_w], st3)) break;
-    b3 = b;
-    for (a = 0; a < N; a++) bestd[a] = 0;
-    for (a = 0; a < N; a++) bestw[a][0] = 0;
+    b1 = FindWord(&v, st1);
+    b2 = FindWord(&v, st2);
+    b3 = FindWord(&v, st3);
     TQ++;
-    if (b1 == words) continue;
-    if (b2 == words) continue;
-    if (b3 == words) continue;
-    for (b = 0; b < words; b++) if (!strcmp(&vocab[b * max_w], st4)) break;
-    if (b == words) continue;
-    for (a = 0; a < size; a++) vec[a] = (M[a + b2 * size] - M[a + b1 * size]) + M[a + b3 * size];
+    if (b1 == -1) continue;
+    if (b2 == -1) continue;
+    if (b3 == -1) continue;
+    if (FindWord(&v, st4) == -1) continue;
     TQS++;
-    for (c = 0; c < words; c++) {
-      if (c == b1) continue;
-      if (c == b2) continue;
-      if (c == b3) continue;
-      dist = 0;
-      for (a = 0; a < size; a++) dist += vec[a] * M[a + c * size];
-      for (a = 0; a < N; a++) {
-        if (dist > bestd[a]) {
-          for (d = N - 1; d > a; d--) {
-            bestd[d] = bestd[d - 1];
-            strcpy(bestw[d], bestw[d - 1]);
-          }
-          bestd[a] = dist;
-          strcpy(bestw[a], &vocab[c * max_w]);
-          break;
-        }
-      }
+    if (!report) {
+      rows[q * 3] = b1;
+      rows[q * 3 + 1] = b2;
+      rows[q * 3 + 2] = b3;
+      q++;
+      continue;
     }
-    if (!strcmp(st4, bestw[0])) {
+    if (!strcasecmp(st4, add_best[q] == -1 ? "" : Word(&v, add_best[q]))) {
       CCN++;
       CACN++;
       if (QID <= 5) SEAC++; else SYAC++;
     }
+    if (cosmul && !strcasecmp(st4, mul_best[q] == -1 ? "" : Word(&v, mul_best[q]))) {
+      CCM++;
+      CACM++;
+      if (QID <= 5) SEAM++; else SYAM++;
+    }
+    q++;
     if (QID <= 5) SECN++; else SYCN++;
     TCN++;
     TACN++;
   }
-  printf("Questions seen / total: %d %d   %.2f %% \n", TQS, TQ, TQS/(float)TQ*100);
+  nq = q;
+  if (report) printf("Questions seen / total: %d %d   %.2f %% \n", TQS, TQ, TQS/(float)TQ*100);
+}
+
+int main(int argc, char **argv)
+{
+  char file_name[max_size];
+  long long threshold = 0;
+  if (argc < 2) {
+    printf("Usage: ./compute-accuracy <FILE> <threshold> [3cosmul]\nwhere FILE contains word projections, and threshold is used to reduce vocabulary of the model for fast approximate evaluation (0 = off, otherwise typical value is 30000)\n");
+    printf("With 3cosmul, the questions are also answered by 3CosMul (multiplying shifted cosines) and its accuracy printed\n");
+    return 0;
+  }
+  strcpy(file_name, argv[1]);
+  if (argc > 2) threshold = atoi(argv[2]);
+  if (argc > 3 && !strcmp(argv[3], "3cosmul")) cosmul = 1;
+  if (ReadVectors(file_name, threshold, 1, &v)) return -1;
+  // read all the questions, answer those with all words known at once,
+  // then go through them again to report
+  ReadTokens();
+  rows = (long long *)malloc((ntokens / 4 + 1) * 3 * sizeof(long long));
+  Evaluate(0);
+  AnswerQuestions();
+  Evaluate(1);
   return 0;
 }
@@ -0,0 +1,14 @@
+make
+if [ ! -e text8 ]; then
+  wget http://mattmahoney.net/dc/text8.zip -O text8.gz
+  gzip -d text8.gz -f
+fi
+# Distributed training on one host: a coordinator (which learns the vocabulary and merges the weights) and 4 worker
+# processes of 5 threads, each training on its quarter of text8 and syncing with the coordinator every 10 seconds.
+# On several hosts, copy text8 to each host and start its workers with -worker <coordinator host>:7777
+./word2vec -train text8 -output vectors-distributed.bin -cbow 1 -size 200 -window 8 -negative 25 -hs 0 -sample 1e-4 -binary 1 -iter 15 -coordinator :7777 -workers 4 &
+for RANK in 0 1 2 3; do
+  ./word2vec -train text8 -worker localhost:7777 -threads 5 -dist-sync 10 -debug 0 &
+done
+wait
+./compute-accuracy vectors-distributed.bin 30000 < questions-words.txt | tail -3
@@ -0,0 +1,11 @@
+make
+if [ ! -e text8 ]; then
+  wget http://mattmahoney.net/dc/text8.zip -O text8.gz
+  gzip -d text8.gz -f
+fi
+time ./word2vec -train text8 -output vectors.bin -cbow 1 -size 200 -window 8 -negative 25 -hs 0 -sample 1e-4 -threads 20 -binary 3 -iter 15
+# build the graph index (vectors.bin.hnsw), then compare the approximate nearest words found through it with the
+# exact ones (recall@40 and queries per second by EF)
+time ./build-hnsw vectors.bin
+./bench-hnsw vectors.bin 1000 40
+./distance vectors.bin -ef 100
@@ -0,0 +1,16 @@
+make
+if [ ! -e text8 ]; then
+  wget http://mattmahoney.net/dc/text8.zip -O text8.gz
+  gzip -d text8.gz -f
+fi
+# Training throughput (words/sec) with the weights in memory and out of core (-weights-dir), with the weights of
+# the N most frequent words locked in memory (-pin-words); major page faults are reported for the latter.  To see
+# the cost of paging, run it in a memory-limited cgroup (or on a vocabulary whose weights exceed memory)
+mkdir -p weights-scratch
+echo -e "weights\tpinned\twords/sec\tmajor faults"
+for RUN in "memory 0" "disk 0" "disk 10000" "disk 100000"; do
+  set -- $RUN
+  if [ $1 = memory ]; then OPTS=""; else OPTS="-weights-dir weights-scratch -pin-words $2"; fi
+  ./word2vec -train text8 -output vectors-ooc.bin -cbow 1 -size 200 -window 8 -negative 25 -hs 0 -sample 1e-4 -min-count 1 -binary 1 -iter 1 -debug 0 -stats-file stats-ooc.json $OPTS > /dev/null
+  echo -e "$1\t$2\t"`tail -1 stats-ooc.json | sed 's/.*"words_per_sec": \([0-9.]*\), "eta".*/\1/'`"\t"`tail -1 stats-ooc.json | sed -n 's/.*"major_faults": \([0-9]*\),.*/\1/p'`
+done
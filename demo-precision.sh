@@ -0,0 +1,20 @@
+make
+if [ ! -e text8 ]; then
+  wget http://mattmahoney.net/dc/text8.zip -O text8.gz
+  gzip -d text8.gz -f
+fi
+# Accuracy of the word vectors with the weights stored as float, bf16, and fp16 (see PRECISION in the makefile), with
+# updated weights rounded to nearest or stochastically (-stochastic-round); the vectors are saved in half precision
+# (-binary 2) for the 16-bit weights
+for PRECISION in fp32 bf16 fp16; do
+  make clean > /dev/null
+  make word2vec PRECISION=$PRECISION > /dev/null
+  mv word2vec word2vec-$PRECISION
+done
+make
+for RUN in "fp32 0 1" "bf16 0 2" "bf16 1 2" "fp16 0 2" "fp16 1 2"; do
+  set -- $RUN
+  echo "-- weights $1, -stochastic-round $2"
+  time ./word2vec-$1 -train text8 -output vectors-precision.bin -cbow 1 -size 200 -window 8 -negative 25 -hs 0 -sample 1e-4 -threads 20 -binary $3 -iter 15 -debug 0 -stochastic-round $2
+  ./compute-accuracy vectors-precision.bin 30000 < questions-words.txt | tail -3
+done
@@ -0,0 +1,18 @@
+make
+if [ ! -e text8 ]; then
+  wget http://mattmahoney.net/dc/text8.zip -O text8.gz
+  gzip -d text8.gz -f
+fi
+# Training throughput (words/sec) by number of threads, with all rows shared by all threads (Hogwild) and with
+# the rows of the 500 most frequent words trained in per-thread copies (-hot-words)
+MAX_THREADS=`nproc`
+echo -e "threads\thogwild\thot-words"
+for THREADS in 1 2 4 8 16 32 64 128; do
+  if [ $THREADS -gt $MAX_THREADS ]; then break; fi
+  echo -ne "$THREADS"
+  for HOT in 0 500; do
+    ./word2vec -train text8 -output vectors-scaling.bin -cbow 1 -size 200 -window 8 -negative 25 -hs 0 -sample 1e-4 -threads $THREADS -binary 1 -iter 1 -debug 0 -hot-words $HOT -stats-file stats-scaling.json > /dev/null
+    echo -ne "\t"`tail -1 stats-scaling.json | sed 's/.*"words_per_sec": \([0-9.]*\), "eta".*/\1/'`
+  done
+  echo
+done
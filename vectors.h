@@ -0,0 +1,1024 @@
+//  Copyright 2013 Google Inc. All Rights Reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// The mapped word vector format (written by word2vec with -binary 3),
+// and reading word vectors in it or in the binary formats for distance,
+// word-analogy and compute-accuracy.
+//
+// A mapped vector file is laid out for use in place with mmap: the
+// header below, then (at `matrix_offset`, a multiple of 64) the
+// `words` x `size` matrix of floats, the `words` + 1 offsets of the
+// words in the string table (the last one is its length), the hash
+// index and the string table of null-terminated words.  Numbers are in
+// the byte order of the machine that wrote the file.  The index has
+// `index_slots` (a power of two) slots holding row numbers, or
+// VECTORS_EMPTY; a word is in the first slot from VectorsHash(word)
+// (modulo `index_slots`) on that is empty or holds it.
+//
+// A graph index (written by build-hnsw next to the vector file, with
+// ".hnsw" appended to its name) lets distance and word-analogy find the
+// nearest rows approximately, without comparing the query with all of
+// them: it is a hierarchical navigable small world graph (Malkov and
+// Yashunin, 2016) of the rows, laid out for use in place like a mapped
+// vector file.  After its header come (at `links_offset`, a multiple of
+// 64) the neighbors of every row in layer 0 (a count, then room for
+// 2 `M` rows), the `words` + 1 offsets (in uint32_t, from
+// `upper_offset`) of the neighbor lists of each row in the layers
+// above, and those lists (a count, then room for `M` rows, for each of
+// layers 1, 2, ... that the row is in).
+
+#ifndef VECTORS_H
+#define VECTORS_H
+
+#include <stdint.h>
+
+#define VECTORS_MAGIC "W2VVECS\0"
+#define VECTORS_VERSION 1
+#define VECTORS_FLOAT32 0            // (the only `dtype` so far)
+#define VECTORS_NORMALIZED 1         // flag: rows have unit length
+#define VECTORS_EMPTY 0xFFFFFFFF     // empty index slot
+#define VECTORS_ALIGN 64             // alignment of the matrix
+
+struct vectors_header {
+  char magic[8];                     // VECTORS_MAGIC
+  uint32_t version;                  // VECTORS_VERSION
+  uint32_t dtype;                    // type of the matrix elements
+  uint32_t flags;                    // VECTORS_NORMALIZED or 0
+  uint32_t header_size;              // sizeof(struct vectors_header)
+  uint64_t words, size;              // matrix dimensions
+  uint64_t matrix_offset;            // offsets (in bytes, from the
+  uint64_t word_offsets_offset;      //   start of the file) of the
+  uint64_t index_offset;             //   parts of the file
+  uint64_t strings_offset;
+  uint64_t index_slots;              // number of index slots
+  uint64_t strings_bytes;            // size of the string table
+  uint64_t file_size;
+};
+
+// FNV-1a hash of a word, for the index
+static inline uint64_t VectorsHash(const char *word) {
+  uint64_t hash = 14695981039346656037ULL;
+  while (*word) hash = (hash ^ (unsigned char)*word++) * 1099511628211ULL;
+  return hash;
+}
+
+#ifndef VECTORS_FORMAT_ONLY
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Word vectors read by ReadVectors
+struct vectors {
+  long long words, size;
+  float *M;                          // words x size, rows of unit length
+  char *strings;                     // words, null-terminated
+  uint64_t *word_offsets;            // offsets of the words in strings
+  uint32_t *index;                   // hash index (as in the mapped
+  uint64_t index_slots;              //   format)
+  int fold;                          // 1 if the index (and FindWord)
+                                     //   ignores case
+  void *map;                         // mapped file (or NULL)
+  size_t map_size;
+  int threads;                       // threads for NearestRows (the
+                                     //   number of CPUs)
+  struct hnsw *hnsw;                 // graph index to search instead of
+                                     //   all the rows (or NULL)
+  long long ef;                      // rows to keep while searching it
+};
+
+// Header of a graph index file
+struct hnsw_header {
+  char magic[8];                     // HNSW_MAGIC
+  uint32_t version;                  // HNSW_VERSION
+  uint32_t header_size;              // sizeof(struct hnsw_header)
+  uint64_t words, size;              // dimensions of the indexed matrix
+  uint64_t M;                        // neighbors per row and layer (2 M
+                                     //   in layer 0)
+  uint64_t max_level, entry;         // top layer, and the row to start
+                                     //   searching from (in it)
+  uint64_t links_offset;             // offsets (in bytes, from the
+  uint64_t upper_offsets_offset;     //   start of the file) of the
+  uint64_t upper_offset;             //   parts of the file
+  uint64_t upper_count;              // length of the upper layer lists
+                                     //   (in uint32_t)
+  uint64_t file_size;
+};
+
+// A graph index of the rows of word vectors (mapped from its file, or
+// being built by build-hnsw)
+struct hnsw {
+  long long words, M, max_level, entry;
+  uint32_t *links;                   // layer 0 lists, 2 M + 1 per row
+  uint64_t *upper_offsets;           // the upper layer lists of row r
+  uint32_t *upper;                   //   are at upper + upper_offsets[r]
+  pthread_mutex_t *locks;            // HNSW_LOCKS locks of the lists (by
+                                     //   row) while building, else NULL
+  struct hnsw_search *searches;      // one for each of v->threads
+  void *map;                         // mapped file (or NULL)
+  size_t map_size;
+};
+
+// A range of rows of a NearestRows scan, and the best of them so far
+// (a min-heap of `count` rows, the worst first)
+struct scan_job {
+  struct vectors *v;
+  float *vec, min;
+  long long *skip, nskip, begin, end, n, count;
+  long long *rows;
+  float *dists;
+};
+
+// A range of rows of a NearestRowsBatch scan, with a scan_job (holding
+// just the best rows so far and what to look for) for each query
+struct batch_job {
+  struct vectors *v;
+  float *Q;
+  long long nq, begin, end;
+  struct scan_job *heaps;
+  struct hnsw_search *search;        // (searching a graph index, the
+                                     //   job is a range of queries)
+};
+
+// A row and its dot product, for merging the results of scan jobs
+struct ranked_row {
+  float d;
+  long long r;
+};
+
+// A binary heap of rows, the one with the largest dot product on top
+// (or the smallest, if low_first is set)
+struct row_heap {
+  struct ranked_row *rows;
+  long long count, capacity;
+  int low_first;
+};
+
+// What a thread needs to search a graph index: rows seen by the
+// current search (visited[r] == mark), a copy of the neighbors being
+// followed, and the rows to follow and the best found (as in
+// SearchLayer)
+struct hnsw_search {
+  uint16_t *visited, mark;
+  uint32_t *links;
+  struct row_heap candidates, results;
+};
+
+typedef float v8sf __attribute__((vector_size(32)));
+
+#define HNSW_MAGIC "W2VHNSW\0"
+#define HNSW_VERSION 1
+#define HNSW_LOCKS 65536
+#define HNSW_MAX_LEVEL 30                 // top layer a row can be in
+
+// Convert an element of a vector file in half precision ("fp16" or
+// "bf16" after the dimensions in the header) to float
+float HalfToFloat(unsigned short h, int bf16) {
+  unsigned int u, sign = (unsigned int)(h & 0x8000) << 16;
+  float x;
+  if (bf16) u = (unsigned int)h << 16;
+  else if ((h & 0x7C00) == 0) {
+    x = (h & 0x3FF) / 16777216.0f;
+    return sign ? -x : x;
+  } else if ((h & 0x7C00) == 0x7C00) u = sign | 0x7F800000 | ((h & 0x3FF) << 13);
+  else u = sign | ((((h >> 10) & 0x1F) + 112) << 23) | ((h & 0x3FF) << 13);
+  memcpy(&x, &u, sizeof(x));
+  return x;
+}
+
+// Word number b of v
+static inline char *Word(struct vectors *v, long long b) {
+  return v->strings + v->word_offsets[b];
+}
+
+// VectorsHash of word in upper case
+uint64_t FoldedHash(const char *word) {
+  uint64_t hash = 14695981039346656037ULL;
+  while (*word) hash = (hash ^ (unsigned char)toupper((unsigned char)*word++)) * 1099511628211ULL;
+  return hash;
+}
+
+// Return 1 if words a and b are equal (ignoring case if fold is set)
+static inline int SameWord(const char *a, const char *b, int fold) {
+  if (!fold) return !strcmp(a, b);
+  while (*a && toupper((unsigned char)*a) == toupper((unsigned char)*b)) a++, b++;
+  return toupper((unsigned char)*a) == toupper((unsigned char)*b);
+}
+
+// Build a hash index of the words of v (ignoring case if v->fold is
+// set); where words are the same, the first is found
+void IndexVectors(struct vectors *v) {
+  long long b;
+  uint64_t slot;
+  for (v->index_slots = 1; v->index_slots < 2 * v->words; v->index_slots *= 2);
+  v->index = (uint32_t *)malloc(v->index_slots * sizeof(uint32_t));
+  memset(v->index, 0xFF, v->index_slots * sizeof(uint32_t));
+  for (b = 0; b < v->words; b++) {
+    slot = (v->fold ? FoldedHash(Word(v, b)) : VectorsHash(Word(v, b))) & (v->index_slots - 1);
+    while (v->index[slot] != VECTORS_EMPTY) slot = (slot + 1) & (v->index_slots - 1);
+    v->index[slot] = b;
+  }
+}
+
+// Scale each row of v->M to unit length
+void NormalizeVectors(struct vectors *v) {
+  long long a, b;
+  float len;
+  for (b = 0; b < v->words; b++) {
+    len = 0;
+    for (a = 0; a < v->size; a++) len += v->M[a + b * v->size] * v->M[a + b * v->size];
+    len = sqrt(len);
+    for (a = 0; a < v->size; a++) v->M[a + b * v->size] /= len;
+  }
+}
+
+// Return 1 if count elements of elem bytes at offset lie within a file
+// of bytes bytes
+static inline int InFile(uint64_t offset, uint64_t count, uint64_t elem, size_t bytes) {
+  return offset <= bytes && count <= (bytes - offset) / elem;
+}
+
+// Return 1 if the mapped vector file at h (of size bytes) is consistent:
+// its parts lie within it, every word starts within the string table,
+// which ends in a null, and the index (if any) is a power of two slots
+// with at least one empty one, so that FindWord stops
+int ValidVectors(struct vectors_header *h, size_t bytes) {
+  uint64_t *word_offsets, a;
+  uint32_t *index;
+  char *strings;
+  if (bytes < sizeof(*h) || h->version != VECTORS_VERSION || h->header_size != sizeof(*h) ||
+      h->dtype != VECTORS_FLOAT32 || h->file_size != bytes ||
+      h->size > bytes / sizeof(float) || h->words >= VECTORS_EMPTY ||
+      (h->size > 0 && !InFile(h->matrix_offset, h->words, h->size * sizeof(float), bytes)) ||
+      h->matrix_offset % sizeof(float) || h->word_offsets_offset % sizeof(uint64_t) ||
+      h->index_offset % sizeof(uint32_t) ||
+      !InFile(h->word_offsets_offset, h->words + 1, sizeof(uint64_t), bytes) ||
+      !InFile(h->index_offset, h->index_slots, sizeof(uint32_t), bytes) ||
+      !InFile(h->strings_offset, h->strings_bytes, 1, bytes)) return 0;
+  word_offsets = (uint64_t *)((char *)h + h->word_offsets_offset);
+  index = (uint32_t *)((char *)h + h->index_offset);
+  strings = (char *)h + h->strings_offset;
+  if (h->words > 0 && (h->strings_bytes == 0 || strings[h->strings_bytes - 1] != 0)) return 0;
+  for (a = 0; a < h->words; a++) if (word_offsets[a] >= h->strings_bytes) return 0;
+  if (h->index_slots == 0) return 1;
+  if ((h->index_slots & (h->index_slots - 1)) || h->index_slots <= h->words) return 0;
+  for (a = 0; a < h->index_slots; a++) if (index[a] == VECTORS_EMPTY) return 1;
+  return 0;
+}
+
+// Map the vector file f (of size bytes) into v; the matrix is used in
+// place if it is normalized, otherwise copied and normalized.  Return
+// 0 on success, -1 (with nothing left mapped) if the file is not a
+// valid mapped vector file.
+int MapVectors(FILE *f, size_t bytes, struct vectors *v) {
+  struct vectors_header *h;
+  v->map = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fileno(f), 0);
+  if (v->map == MAP_FAILED) {
+    v->map = NULL;
+    return -1;
+  }
+  v->map_size = bytes;
+  h = (struct vectors_header *)v->map;
+  if (!ValidVectors(h, bytes)) {
+    munmap(v->map, bytes);
+    v->map = NULL;
+    return -1;
+  }
+  v->words = h->words;
+  v->size = h->size;
+  v->strings = (char *)v->map + h->strings_offset;
+  v->word_offsets = (uint64_t *)((char *)v->map + h->word_offsets_offset);
+  v->index = h->index_slots ? (uint32_t *)((char *)v->map + h->index_offset) : NULL;
+  v->index_slots = h->index_slots;
+  if (h->flags & VECTORS_NORMALIZED) v->M = (float *)((char *)v->map + h->matrix_offset);
+  else {
+    v->M = (float *)malloc(v->words * v->size * sizeof(float));
+    if (v->M == NULL) {
+      munmap(v->map, bytes);
+      v->map = NULL;
+      return -1;
+    }
+    memcpy(v->M, (char *)v->map + h->matrix_offset, v->words * v->size * sizeof(float));
+    NormalizeVectors(v);
+  }
+  return 0;
+}
+
+// Read the word vectors in file_name (in the binary or mapped format)
+// into v, keeping only the first max_words if that is positive, and
+// index the words (ignoring case if fold is set) unless the file's
+// index will do.  Return 0 on success, otherwise print an error and
+// return -1.
+int ReadVectors(char *file_name, long long max_words, int fold, struct vectors *v) {
+  FILE *f;
+  struct stat st;
+  char magic[8], st1[2000], dtype[2000];
+  long long a, b, c, capacity;
+  int half, ch;
+  unsigned short h;
+  memset(v, 0, sizeof(*v));
+  v->fold = fold;
+  v->threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (v->threads < 1) v->threads = 1;
+  f = fopen(file_name, "rb");
+  if (f == NULL) {
+    printf("Input file not found\n");
+    return -1;
+  }
+  if (fread(magic, 1, sizeof(magic), f) == sizeof(magic) && !memcmp(magic, VECTORS_MAGIC, sizeof(magic))) {
+    fstat(fileno(f), &st);
+    if (MapVectors(f, st.st_size, v)) {
+      printf("Invalid vector file %s\n", file_name);
+      fclose(f);
+      return -1;
+    }
+    fclose(f);
+    if (max_words > 0 && v->words > max_words) v->words = max_words;
+    if (fold || v->index == NULL) IndexVectors(v);
+    return 0;
+  }
+  rewind(f);
+  fscanf(f, "%lld", &v->words);
+  if (max_words > 0 && v->words > max_words) v->words = max_words;
+  fscanf(f, "%lld", &v->size);
+  // rest of the header line: the element type, if not float
+  dtype[0] = 0;
+  fgets(st1, sizeof(st1), f);
+  sscanf(st1, "%s", dtype);
+  half = !strcmp(dtype, "fp16") ? 1 : (!strcmp(dtype, "bf16") ? 2 : 0);
+  capacity = v->words * 16 + 1;
+  v->strings = (char *)malloc(capacity);
+  v->word_offsets = (uint64_t *)malloc((v->words + 1) * sizeof(uint64_t));
+  v->M = (float *)malloc(v->words * v->size * sizeof(float));
+  if (v->strings == NULL || v->word_offsets == NULL || v->M == NULL) {
+    printf("Cannot allocate memory: %lld MB    %lld  %lld\n", v->words * v->size * (long long)sizeof(float) / 1048576, v->words, v->size);
+    fclose(f);
+    return -1;
+  }
+  c = 0;
+  for (b = 0; b < v->words; b++) {
+    // read word into the string table (growing it as needed)
+    v->word_offsets[b] = c;
+    while (1) {
+      ch = fgetc(f);
+      if (ch == '\n') continue;
+      if (c == capacity) {
+        capacity *= 2;
+        v->strings = (char *)realloc(v->strings, capacity);
+        if (v->strings == NULL) {
+          printf("Cannot allocate memory for the words\n");
+          fclose(f);
+          return -1;
+        }
+      }
+      if (ch == EOF || ch == ' ') break;
+      v->strings[c++] = ch;
+    }
+    v->strings[c++] = 0;
+    // read word vector
+    if (half) for (a = 0; a < v->size; a++) {
+      fread(&h, sizeof(h), 1, f);
+      v->M[a + b * v->size] = HalfToFloat(h, half == 2);
+    } else fread(&v->M[b * v->size], sizeof(float), v->size, f);
+  }
+  v->word_offsets[v->words] = c;
+  fclose(f);
+  NormalizeVectors(v);
+  IndexVectors(v);
+  return 0;
+}
+
+// Return the row of word in v (the first one, ignoring case if v->fold
+// is set), or -1 if it is not there
+long long FindWord(struct vectors *v, char *word) {
+  uint64_t slot = (v->fold ? FoldedHash(word) : VectorsHash(word)) & (v->index_slots - 1);
+  for (; v->index[slot] != VECTORS_EMPTY; slot = (slot + 1) & (v->index_slots - 1))
+    if (v->index[slot] < v->words && SameWord(Word(v, v->index[slot]), word, v->fold)) return v->index[slot];
+  return -1;
+}
+
+// Dot products of x with rows m[0 .. 3] (of size elements each, the
+// rows size apart) into d, eight elements at a time
+static inline void Dot4(const float *x, const float *m, long long size, float *d) {
+  v8sf s0 = {0}, s1 = {0}, s2 = {0}, s3 = {0}, y, r;
+  long long a, b;
+  for (a = 0; a + 8 <= size; a += 8) {
+    memcpy(&y, x + a, sizeof(y));
+    memcpy(&r, m + a, sizeof(r));
+    s0 += y * r;
+    memcpy(&r, m + size + a, sizeof(r));
+    s1 += y * r;
+    memcpy(&r, m + 2 * size + a, sizeof(r));
+    s2 += y * r;
+    memcpy(&r, m + 3 * size + a, sizeof(r));
+    s3 += y * r;
+  }
+  for (b = 0; b < 4; b++) d[b] = 0;
+  for (b = 0; b < 8; b++) {
+    d[0] += s0[b];
+    d[1] += s1[b];
+    d[2] += s2[b];
+    d[3] += s3[b];
+  }
+  for (; a < size; a++) for (b = 0; b < 4; b++) d[b] += x[a] * m[b * size + a];
+}
+
+// Return 1 if row r with dot product d ranks before row q with dot
+// product e (higher first, then lower rows first)
+static inline int Ranks(float d, long long r, float e, long long q) {
+  return d > e || (d == e && r < q);
+}
+
+// Keep row r, with dot product d, among the best rows of job (if it
+// ranks before the worst of them, or there are fewer than job->n)
+static inline void KeepRow(struct scan_job *job, long long r, float d) {
+  long long a, b, c;
+  if (job->count == job->n) {
+    if (!Ranks(d, r, job->dists[0], job->rows[0])) return;
+    // replace the worst, then sift it down
+    a = 0;
+    while ((b = 2 * a + 1) < job->n) {
+      c = (b + 1 < job->n && Ranks(job->dists[b], job->rows[b], job->dists[b + 1], job->rows[b + 1])) ? b + 1 : b;
+      if (!Ranks(d, r, job->dists[c], job->rows[c])) break;
+      job->rows[a] = job->rows[c];
+      job->dists[a] = job->dists[c];
+      a = c;
+    }
+  } else {
+    // add at the end, then sift it up
+    a = job->count++;
+    while (a > 0 && Ranks(job->dists[(a - 1) / 2], job->rows[(a - 1) / 2], d, r)) {
+      job->rows[a] = job->rows[(a - 1) / 2];
+      job->dists[a] = job->dists[(a - 1) / 2];
+      a = (a - 1) / 2;
+    }
+  }
+  job->rows[a] = r;
+  job->dists[a] = d;
+}
+
+// Offer row r, with dot product d, to the best rows of the query of
+// heap (unless it is one of the query's rows to skip)
+static inline void OfferRow(struct scan_job *heap, long long r, float d) {
+  long long c;
+  if (!(d > heap->min)) return;
+  if (heap->count == heap->n && !Ranks(d, r, heap->dists[0], heap->rows[0])) return;
+  for (c = 0; c < heap->nskip; c++) if (heap->skip[c] == r) return;
+  KeepRow(heap, r, d);
+}
+
+// Scan the rows of a NearestRows job, four at a time
+void *ScanThread(void *arg) {
+  struct scan_job *job = (struct scan_job *)arg;
+  long long size = job->v->size, a, b, c;
+  float d[4];
+  for (a = job->begin; a < job->end; a += 4) {
+    if (a + 4 <= job->end) Dot4(job->vec, job->v->M + a * size, size, d);
+    else for (b = 0; a + b < job->end; b++) {
+      d[b] = 0;
+      for (c = 0; c < size; c++) d[b] += job->vec[c] * job->v->M[(a + b) * size + c];
+    }
+    for (b = 0; b < 4 && a + b < job->end; b++) OfferRow(job, a + b, d[b]);
+  }
+  return NULL;
+}
+
+// (qsort order of the (dot product, row) pairs of NearestRows)
+int CompareRanks(const void *x, const void *y) {
+  const struct ranked_row *p = x, *q = y;
+  return Ranks(p->d, p->r, q->d, q->r) ? -1 : (Ranks(q->d, q->r, p->d, p->r) ? 1 : 0);
+}
+
+// Merge the best rows of threads scan jobs, jobs[0], jobs[stride], ...
+// (using all, of room for all their rows) into best and bestd, as
+// NearestRows returns them
+void MergeHeaps(struct scan_job *jobs, long long threads, long long stride, struct ranked_row *all, long long *best, float *bestd) {
+  long long a, b, c;
+  for (a = 0, c = 0; a < threads; a++) for (b = 0; b < jobs[a * stride].count; b++, c++) {
+    all[c].d = jobs[a * stride].dists[b];
+    all[c].r = jobs[a * stride].rows[b];
+  }
+  qsort(all, c, sizeof(struct ranked_row), CompareRanks);
+  for (a = 0; a < jobs[0].n; a++) {
+    best[a] = a < c ? all[a].r : -1;
+    bestd[a] = a < c ? all[a].d : jobs[0].min;
+  }
+}
+
+// Dot product of x with row m (of size elements), summed as by Dot4
+static inline float Dot(const float *x, const float *m, long long size) {
+  v8sf s = {0}, y, r;
+  long long a;
+  float d = 0;
+  for (a = 0; a + 8 <= size; a += 8) {
+    memcpy(&y, x + a, sizeof(y));
+    memcpy(&r, m + a, sizeof(r));
+    s += y * r;
+  }
+  for (a = 0; a < 8; a++) d += s[a];
+  for (a = size / 8 * 8; a < size; a++) d += x[a] * m[a];
+  return d;
+}
+
+// Add row r with dot product d to heap h
+void PushRow(struct row_heap *h, long long r, float d) {
+  long long a;
+  if (h->count == h->capacity) {
+    h->capacity = h->capacity ? 2 * h->capacity : 64;
+    h->rows = (struct ranked_row *)realloc(h->rows, h->capacity * sizeof(struct ranked_row));
+  }
+  a = h->count++;
+  while (a > 0 && (h->low_first ? d < h->rows[(a - 1) / 2].d : d > h->rows[(a - 1) / 2].d)) {
+    h->rows[a] = h->rows[(a - 1) / 2];
+    a = (a - 1) / 2;
+  }
+  h->rows[a].r = r;
+  h->rows[a].d = d;
+}
+
+// Take the top row off heap h (which is not empty)
+struct ranked_row PopRow(struct row_heap *h) {
+  struct ranked_row top = h->rows[0], last = h->rows[--h->count];
+  long long a = 0, b, c;
+  while ((b = 2 * a + 1) < h->count) {
+    c = b;
+    if (b + 1 < h->count && (h->low_first ? h->rows[b + 1].d < h->rows[b].d : h->rows[b + 1].d > h->rows[b].d)) c = b + 1;
+    if (h->low_first ? !(h->rows[c].d < last.d) : !(h->rows[c].d > last.d)) break;
+    h->rows[a] = h->rows[c];
+    a = c;
+  }
+  h->rows[a] = last;
+  return top;
+}
+
+// Neighbor list of row r in layer level of graph h (a count, then the
+// rows)
+static inline uint32_t *Links(struct hnsw *h, long long r, long long level) {
+  if (level == 0) return h->links + r * (2 * h->M + 1);
+  return h->upper + h->upper_offsets[r] + (level - 1) * (h->M + 1);
+}
+
+// Number of layers above 0 that row r of graph h is in
+static inline long long Level(struct hnsw *h, long long r) {
+  return (h->upper_offsets[r + 1] - h->upper_offsets[r]) / (h->M + 1);
+}
+
+// Copy the neighbors of row r in layer level of graph h into links
+// (under the lock of the row while the graph is being built); return
+// how many there are (at most as many as the list has room for, even
+// if a corrupt file says more)
+static inline long long CopyLinks(struct hnsw *h, long long r, long long level, uint32_t *links) {
+  uint32_t *l = Links(h, r, level);
+  long long n, m = level ? h->M : 2 * h->M;
+  if (h->locks != NULL) pthread_mutex_lock(&h->locks[r % HNSW_LOCKS]);
+  n = l[0] < m ? l[0] : m;
+  memcpy(links, l + 1, n * sizeof(uint32_t));
+  if (h->locks != NULL) pthread_mutex_unlock(&h->locks[r % HNSW_LOCKS]);
+  return n;
+}
+
+// Search layer level of the graph index of v with s, from row ep, for
+// the ef rows with the largest dot products with vec: follow the
+// neighbors of the best row not followed yet until it is worse than
+// all the ef best found, which are left in s->results (worst on top).
+// Neighbors that are not rows in the layer (only in a corrupt file) are
+// skipped.
+void SearchLayer(struct vectors *v, struct hnsw_search *s, const float *vec, long long ep, long long ef, long long level) {
+  struct hnsw *h = v->hnsw;
+  struct ranked_row c;
+  long long a, n, r;
+  float d;
+  if (++s->mark == 0) {
+    memset(s->visited, 0, h->words * sizeof(uint16_t));
+    s->mark = 1;
+  }
+  s->candidates.count = 0;
+  s->results.count = 0;
+  d = Dot(vec, v->M + ep * v->size, v->size);
+  s->visited[ep] = s->mark;
+  PushRow(&s->candidates, ep, d);
+  PushRow(&s->results, ep, d);
+  while (s->candidates.count > 0) {
+    c = PopRow(&s->candidates);
+    if (s->results.count == ef && c.d < s->results.rows[0].d) break;
+    n = CopyLinks(h, c.r, level, s->links);
+    for (a = 0; a < n; a++) {
+      if (a + 1 < n) __builtin_prefetch(v->M + s->links[a + 1] * v->size);
+      r = s->links[a];
+      if (r >= h->words || (level > 0 && Level(h, r) < level)) continue;
+      if (s->visited[r] == s->mark) continue;
+      s->visited[r] = s->mark;
+      d = Dot(vec, v->M + r * v->size, v->size);
+      if (s->results.count < ef || d > s->results.rows[0].d) {
+        PushRow(&s->candidates, r, d);
+        PushRow(&s->results, r, d);
+        if (s->results.count > ef) PopRow(&s->results);
+      }
+    }
+  }
+}
+
+// Find (approximately) the best rows for vec, as ScanThread would for
+// the NearestRows job heap, in the graph index of v with s: go down
+// from its entry row through the upper layers to the row nearest to
+// vec in each, then search layer 0 for the v->ef (but at least enough)
+// best rows and offer them to heap
+void HnswSearch(struct vectors *v, struct hnsw_search *s, float *vec, struct scan_job *heap) {
+  struct hnsw *h = v->hnsw;
+  long long a, ep = h->entry, ef = v->ef > heap->n + heap->nskip ? v->ef : heap->n + heap->nskip;
+  if (h->words == 0) return;
+  for (a = h->max_level; a > 0; a--) {
+    SearchLayer(v, s, vec, ep, 1, a);
+    ep = s->results.rows[0].r;
+  }
+  SearchLayer(v, s, vec, ep, ef, 0);
+  for (a = 0; a < s->results.count; a++) OfferRow(heap, s->results.rows[a].r, s->results.rows[a].d);
+}
+
+// Answer the range of queries of a NearestRowsBatch job in the graph
+// index
+void *HnswBatchThread(void *arg) {
+  struct batch_job *job = (struct batch_job *)arg;
+  long long q;
+  for (q = job->begin; q < job->end; q++) HnswSearch(job->v, job->search, job->Q + q * job->v->size, &job->heaps[q]);
+  return NULL;
+}
+
+// Allocate what threads threads need to search graph h
+void NewHnswSearches(struct hnsw *h, long long threads) {
+  long long a;
+  h->searches = (struct hnsw_search *)calloc(threads, sizeof(struct hnsw_search));
+  for (a = 0; a < threads; a++) {
+    h->searches[a].visited = (uint16_t *)calloc(h->words + 1, sizeof(uint16_t));
+    h->searches[a].links = (uint32_t *)malloc((2 * h->M + 1) * sizeof(uint32_t));
+    h->searches[a].results.low_first = 1;
+  }
+}
+
+// Return 1 if the graph index file at hd (of size bytes) is consistent:
+// its parts lie within it, every row's upper layer lists follow the
+// previous row's within them, no row is above HNSW_MAX_LEVEL, and the
+// entry row is in the top layer.  (The neighbors in the lists are
+// checked as they are followed, by SearchLayer and CopyLinks.)
+int ValidHnsw(struct hnsw_header *hd, size_t bytes) {
+  uint64_t *upper_offsets, a;
+  if (bytes < sizeof(*hd) || memcmp(hd->magic, HNSW_MAGIC, sizeof(hd->magic)) ||
+      hd->version != HNSW_VERSION || hd->header_size != sizeof(*hd) || hd->file_size != bytes ||
+      hd->M == 0 || hd->M > bytes / sizeof(uint32_t) || hd->max_level > HNSW_MAX_LEVEL ||
+      hd->words >= VECTORS_EMPTY || (hd->words > 0 && hd->entry >= hd->words) ||
+      hd->links_offset % sizeof(uint32_t) || hd->upper_offsets_offset % sizeof(uint64_t) ||
+      hd->upper_offset % sizeof(uint32_t) ||
+      !InFile(hd->links_offset, hd->words, (2 * hd->M + 1) * sizeof(uint32_t), bytes) ||
+      !InFile(hd->upper_offsets_offset, hd->words + 1, sizeof(uint64_t), bytes) ||
+      !InFile(hd->upper_offset, hd->upper_count, sizeof(uint32_t), bytes)) return 0;
+  upper_offsets = (uint64_t *)((char *)hd + hd->upper_offsets_offset);
+  if (upper_offsets[0] != 0 || upper_offsets[hd->words] > hd->upper_count) return 0;
+  for (a = 0; a < hd->words; a++)
+    if (upper_offsets[a + 1] < upper_offsets[a] || (upper_offsets[a + 1] - upper_offsets[a]) % (hd->M + 1) ||
+        (upper_offsets[a + 1] - upper_offsets[a]) / (hd->M + 1) > HNSW_MAX_LEVEL) return 0;
+  if (hd->words > 0 && (upper_offsets[hd->entry + 1] - upper_offsets[hd->entry]) / (hd->M + 1) < hd->max_level) return 0;
+  return 1;
+}
+
+// Open the graph index of the vectors v read from file_name (the file
+// file_name.hnsw), to be searched by NearestRows and NearestRowsBatch
+// keeping ef rows.  Return 0 on success, otherwise print an error and
+// return -1 (with nothing left allocated or mapped).
+int OpenHnsw(struct vectors *v, char *file_name, long long ef) {
+  FILE *f;
+  struct stat st;
+  struct hnsw_header *hd;
+  struct hnsw *h;
+  char index_name[2100];
+  void *map;
+  snprintf(index_name, sizeof(index_name), "%s.hnsw", file_name);
+  f = fopen(index_name, "rb");
+  if (f == NULL) {
+    printf("Index file %s not found (build it with build-hnsw)\n", index_name);
+    return -1;
+  }
+  fstat(fileno(f), &st);
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fileno(f), 0);
+  fclose(f);
+  if (map == MAP_FAILED) {
+    printf("Invalid index file %s\n", index_name);
+    return -1;
+  }
+  hd = (struct hnsw_header *)map;
+  if (!ValidHnsw(hd, st.st_size)) {
+    printf("Invalid index file %s\n", index_name);
+    munmap(map, st.st_size);
+    return -1;
+  }
+  if (hd->words != (uint64_t)v->words || hd->size != (uint64_t)v->size) {
+    printf("Index file %s is not of the vectors in %s (build it again)\n", index_name, file_name);
+    munmap(map, st.st_size);
+    return -1;
+  }
+  h = (struct hnsw *)calloc(1, sizeof(struct hnsw));
+  h->map = map;
+  h->map_size = st.st_size;
+  h->words = hd->words;
+  h->M = hd->M;
+  h->max_level = hd->max_level;
+  h->entry = hd->entry;
+  h->links = (uint32_t *)((char *)h->map + hd->links_offset);
+  h->upper_offsets = (uint64_t *)((char *)h->map + hd->upper_offsets_offset);
+  h->upper = (uint32_t *)((char *)h->map + hd->upper_offset);
+  NewHnswSearches(h, v->threads);
+  v->hnsw = h;
+  v->ef = ef;
+  return 0;
+}
+
+// Take the option "-ef <EF>" out of the argc arguments in argv; return
+// EF, or 0 if it is not there
+long long TakeEfArg(int *argc, char **argv) {
+  long long a, b, c, ef = 0;
+  for (a = 1; a < *argc; a++) if (!strcmp(argv[a], "-ef")) {
+    b = a + 1 < *argc ? 2 : 1;
+    if (b == 2) ef = atoll(argv[a + 1]);
+    if (ef < 1) ef = 1;
+    for (c = a; c + b < *argc; c++) argv[c] = argv[c + b];
+    *argc -= b;
+    break;
+  }
+  return ef;
+}
+
+// Find the n rows of v with the largest dot products with vec (of
+// v->size elements), if greater than min, other than the nskip rows in
+// skip; store them in best and their dot products in bestd, best first
+// (where there are fewer than n rows, the rest of best is -1 and of
+// bestd is min).  Each of v->threads threads scans a range of rows,
+// keeping a heap of its n best; the heaps are merged at the end.  If v
+// has a graph index, it is searched instead (by one thread).
+void NearestRows(struct vectors *v, float *vec, float min, long long *skip, long long nskip, long long n, long long *best, float *bestd) {
+  long long a, threads = v->threads;
+  pthread_t *pt;
+  struct scan_job *jobs;
+  struct ranked_row *all;
+  if (threads > v->words / 1024 + 1) threads = v->words / 1024 + 1;
+  if (v->hnsw != NULL) threads = 1;
+  pt = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  jobs = (struct scan_job *)calloc(threads, sizeof(struct scan_job));
+  all = (struct ranked_row *)malloc(threads * n * sizeof(struct ranked_row));
+  for (a = 0; a < threads; a++) {
+    jobs[a].v = v;
+    jobs[a].vec = vec;
+    jobs[a].min = min;
+    jobs[a].skip = skip;
+    jobs[a].nskip = nskip;
+    jobs[a].begin = v->words * a / threads;
+    jobs[a].end = v->words * (a + 1) / threads;
+    jobs[a].n = n;
+    jobs[a].rows = (long long *)malloc(n * sizeof(long long));
+    jobs[a].dists = (float *)malloc(n * sizeof(float));
+  }
+  if (v->hnsw != NULL) HnswSearch(v, v->hnsw->searches, vec, jobs);
+  else if (threads == 1) ScanThread(jobs);
+  else {
+    for (a = 0; a < threads; a++) pthread_create(&pt[a], NULL, ScanThread, (void *)&jobs[a]);
+    for (a = 0; a < threads; a++) pthread_join(pt[a], NULL);
+  }
+  MergeHeaps(jobs, threads, 1, all, best, bestd);
+  for (a = 0; a < threads; a++) {
+    free(jobs[a].rows);
+    free(jobs[a].dists);
+  }
+  free(all);
+  free(jobs);
+  free(pt);
+}
+
+// Dot products of the four queries q[0 .. 3] with the four rows m[0 ..
+// 3] (all of size elements, size apart) into d (by query, then row)
+static inline void Dot4x4(const float *q, const float *m, long long size, float d[4][4]) {
+  v8sf s[4][4], x[4], r;
+  long long a, b, c;
+  memset(s, 0, sizeof(s));
+  for (a = 0; a + 8 <= size; a += 8) {
+    for (b = 0; b < 4; b++) memcpy(&x[b], q + b * size + a, sizeof(r));
+    for (c = 0; c < 4; c++) {
+      memcpy(&r, m + c * size + a, sizeof(r));
+      for (b = 0; b < 4; b++) s[b][c] += x[b] * r;
+    }
+  }
+  for (b = 0; b < 4; b++) for (c = 0; c < 4; c++) {
+    d[b][c] = 0;
+    for (a = 0; a < 8; a++) d[b][c] += s[b][c][a];
+  }
+  for (a = size / 8 * 8; a < size; a++) for (b = 0; b < 4; b++) for (c = 0; c < 4; c++) d[b][c] += q[b * size + a] * m[c * size + a];
+}
+
+// Scan the rows of a NearestRowsBatch job in blocks that stay in the
+// cache while all the queries (four at a time) are compared with them
+// (four rows at a time)
+void *BatchScanThread(void *arg) {
+  struct batch_job *job = (struct batch_job *)arg;
+  long long size = job->v->size, block = 256 * 1024 / (size * sizeof(float)) / 4 * 4 + 4, r0, r1, r, q, a, b, c;
+  float d[4][4], *Q = job->Q, *M = job->v->M;
+  for (r0 = job->begin; r0 < job->end; r0 = r1) {
+    r1 = r0 + block < job->end ? r0 + block : job->end;
+    for (q = 0; q < job->nq; q += 4) {
+      // (the query matrix is padded to a multiple of four queries)
+      for (r = r0; r + 4 <= r1; r += 4) {
+        Dot4x4(Q + q * size, M + r * size, size, d);
+        for (b = 0; b < 4 && q + b < job->nq; b++) for (c = 0; c < 4; c++) OfferRow(&job->heaps[q + b], r + c, d[b][c]);
+      }
+      for (; r < r1; r++) for (b = 0; b < 4 && q + b < job->nq; b++) {
+        d[0][0] = 0;
+        for (a = 0; a < size; a++) d[0][0] += Q[(q + b) * size + a] * M[r * size + a];
+        OfferRow(&job->heaps[q + b], r, d[0][0]);
+      }
+    }
+  }
+  return NULL;
+}
+
+// Find, for each of the nq queries in Q (nq rows of v->size elements,
+// with room for a multiple of four rows), what NearestRows would find
+// for it with the nskip[q] rows in skip[q] to skip, into best + q * n
+// and bestd + q * n.  Each of v->threads threads compares a range of
+// rows with all the queries, a block of rows at a time, so v->M is read
+// once for all of them.  If v has a graph index, each thread searches
+// it for a range of the queries instead.
+void NearestRowsBatch(struct vectors *v, float *Q, long long nq, float min, long long **skip, long long *nskip, long long n, long long *best, float *bestd) {
+  long long a, q, threads = v->threads;
+  pthread_t *pt;
+  struct batch_job *jobs;
+  struct scan_job *heaps;
+  struct ranked_row *all;
+  if (threads > v->words / 1024 + 1) threads = v->words / 1024 + 1;
+  if (v->hnsw != NULL) threads = nq < v->threads ? nq : v->threads;
+  pt = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  jobs = (struct batch_job *)calloc(threads, sizeof(struct batch_job));
+  heaps = (struct scan_job *)calloc(threads * nq, sizeof(struct scan_job));
+  all = (struct ranked_row *)malloc(threads * n * sizeof(struct ranked_row));
+  for (a = 0; a < threads; a++) {
+    jobs[a].v = v;
+    jobs[a].Q = Q;
+    jobs[a].nq = nq;
+    jobs[a].begin = (v->hnsw != NULL ? nq : v->words) * a / threads;
+    jobs[a].end = (v->hnsw != NULL ? nq : v->words) * (a + 1) / threads;
+    jobs[a].heaps = heaps + a * nq;
+    if (v->hnsw != NULL) jobs[a].search = v->hnsw->searches + a;
+    for (q = 0; q < nq; q++) {
+      jobs[a].heaps[q].min = min;
+      jobs[a].heaps[q].skip = skip[q];
+      jobs[a].heaps[q].nskip = nskip[q];
+      jobs[a].heaps[q].n = n;
+      jobs[a].heaps[q].rows = (long long *)malloc(n * sizeof(long long));
+      jobs[a].heaps[q].dists = (float *)malloc(n * sizeof(float));
+    }
+  }
+  if (threads == 1) (v->hnsw != NULL ? HnswBatchThread : BatchScanThread)(jobs);
+  else {
+    for (a = 0; a < threads; a++) pthread_create(&pt[a], NULL, v->hnsw != NULL ? HnswBatchThread : BatchScanThread, (void *)&jobs[a]);
+    for (a = 0; a < threads; a++) pthread_join(pt[a], NULL);
+  }
+  for (q = 0; q < nq; q++) MergeHeaps(heaps + q, threads, nq, all, best + q * n, bestd + q * n);
+  for (a = 0; a < threads * nq; a++) {
+    free(heaps[a].rows);
+    free(heaps[a].dists);
+  }
+  free(all);
+  free(heaps);
+  free(jobs);
+  free(pt);
+}
+
+// Print word to f as a JSON string
+void PrintJsonString(FILE *f, const char *word) {
+  fputc('"', f);
+  for (; *word; word++) {
+    if (*word == '"' || *word == '\\') fprintf(f, "\\%c", *word);
+    else if ((unsigned char)*word < 0x20) fprintf(f, "\\u%04x", *word);
+    else fputc(*word, f);
+  }
+  fputc('"', f);
+}
+
+// Print the n results of a batch query (best and bestd, as NearestRows
+// returns them) to stdout: in JSON (one object per query and line) if
+// json is set, otherwise as tab-separated lines of the query, the rank
+// (from 1), the word and its cosine similarity.  If the query could not
+// be answered, the reason is given in error instead (and the rank in
+// tab-separated output is 0).
+void PrintBatchResult(struct vectors *v, char *query, char *error, long long n, long long *best, float *bestd, int json) {
+  long long a, c = 0;
+  if (json) {
+    printf("{\"query\": ");
+    PrintJsonString(stdout, query);
+    if (error != NULL) {
+      printf(", \"error\": ");
+      PrintJsonString(stdout, error);
+      printf("}\n");
+      return;
+    }
+    printf(", \"results\": [");
+    for (a = 0; a < n; a++) if (best[a] != -1) {
+      printf(c++ ? ", {\"word\": " : "{\"word\": ");
+      PrintJsonString(stdout, Word(v, best[a]));
+      printf(", \"similarity\": %f}", bestd[a]);
+    }
+    printf("]}\n");
+    return;
+  }
+  if (error != NULL) {
+    printf("%s\t0\t%s\t\n", query, error);
+    return;
+  }
+  for (a = 0; a < n; a++) if (best[a] != -1) printf("%s\t%lld\t%s\t%f\n", query, a + 1, Word(v, best[a]), bestd[a]);
+}
+
+// Answer the queries in file_name, one per line (of words separated by
+// spaces), with the n best rows by NearestRowsBatch (with threshold
+// min) for up to 1024 queries at a time, printing the results with
+// PrintBatchResult.  For each query, build is given v, its cn words,
+// and room for its (normalized) vector and the rows to skip (cn of
+// them); it returns NULL, or the reason the query cannot be answered.
+// Return 0 on success, -1 if the file cannot be read.
+int RunBatch(struct vectors *v, char *file_name, int json, long long n, float min,
+             char *(*build)(struct vectors *, char **, long long, float *, long long *)) {
+  const long long batch = 1024, max_words = 100;
+  FILE *f;
+  char line[2000], **queries, **errors, *words[max_words], *w, *error;
+  float *Q, *bestd;
+  long long a, q, nq, cn, *rows, **skip, *nskip, *best, *query_rows;
+  f = fopen(file_name, "rb");
+  if (f == NULL) {
+    printf("Query file not found\n");
+    return -1;
+  }
+  queries = (char **)calloc(batch, sizeof(char *));
+  errors = (char **)calloc(batch, sizeof(char *));
+  Q = (float *)malloc((batch + 3) * v->size * sizeof(float));
+  rows = (long long *)malloc(batch * max_words * sizeof(long long));
+  skip = (long long **)malloc(batch * sizeof(long long *));
+  nskip = (long long *)malloc(batch * sizeof(long long));
+  query_rows = (long long *)malloc(batch * sizeof(long long));
+  best = (long long *)malloc(batch * n * sizeof(long long));
+  bestd = (float *)malloc(batch * n * sizeof(float));
+  while (!feof(f)) {
+    // read a batch of queries, building the vectors of those that can
+    // be answered (query_rows[a] is the row in Q of query a, or -1)
+    for (a = 0, nq = 0; a < batch && fgets(line, sizeof(line), f) != NULL; ) {
+      line[strcspn(line, "\r\n")] = 0;
+      free(queries[a]);
+      queries[a] = strdup(line);
+      for (cn = 0, w = strtok(line, " \t"); w != NULL && cn < max_words; w = strtok(NULL, " \t")) words[cn++] = w;
+      if (cn == 0) continue;
+      skip[nq] = rows + nq * max_words;
+      error = build(v, words, cn, Q + nq * v->size, skip[nq]);
+      free(errors[a]);
+      errors[a] = error == NULL ? NULL : strdup(error);
+      nskip[nq] = cn;
+      query_rows[a] = errors[a] == NULL ? nq++ : -1;
+      a++;
+    }
+    if (a == 0) break;
+    memset(Q + nq * v->size, 0, 3 * v->size * sizeof(float));
+    if (nq > 0) NearestRowsBatch(v, Q, nq, min, skip, nskip, n, best, bestd);
+    for (q = 0; q < a; q++) {
+      if (query_rows[q] == -1) PrintBatchResult(v, queries[q], errors[q], n, NULL, NULL, json);
+      else PrintBatchResult(v, queries[q], NULL, n, best + query_rows[q] * n, bestd + query_rows[q] * n, json);
+    }
+  }
+  fclose(f);
+  for (a = 0; a < batch; a++) {
+    free(queries[a]);
+    free(errors[a]);
+  }
+  free(queries);
+  free(errors);
+  free(Q);
+  free(rows);
+  free(skip);
+  free(nskip);
+  free(query_rows);
+  free(best);
+  free(bestd);
+  return 0;
+}
+
+#endif
+#endif
@@ -16,56 +16,59 @@
 #include <string.h>
 #include <math.h>
 #include <stdlib.h>
+#include "vectors.h"
 
 const long long max_size = 2000;         // max length of strings
 const long long N = 40;                  // number of closest words that will be shown
-const long long max_w = 50;              // max length of vocabulary entries
+
+// Build the vector of a batch query (see RunBatch): the normalized
+// vector of the second word minus the first plus the third
+char *AnalogyQuery(struct vectors *v, char **words, long long cn, float *vec, long long *bi) {
+  static char error[2100];
+  long long a, b;
+  float len;
+  if (cn < 3) {
+    snprintf(error, sizeof(error), "Only %lld words were entered.. three words are needed at the input to perform the calculation", cn);
+    return error;
+  }
+  for (b = 0; b < cn; b++) {
+    bi[b] = FindWord(v, words[b]);
+    if (bi[b] <= 0) {
+      snprintf(error, sizeof(error), "Out of dictionary word: %s", words[b]);
+      return error;
+    }
+  }
+  for (a = 0; a < v->size; a++) vec[a] = v->M[a + bi[1] * v->size] - v->M[a + bi[0] * v->size] + v->M[a + bi[2] * v->size];
+  len = 0;
+  for (a = 0; a < v->size; a++) len += vec[a] * vec[a];
+  len = sqrt(len);
+  for (a = 0; a < v->size; a++) vec[a] /= len;
+  return NULL;
+}
 
 int main(int argc, char **argv) {
-  FILE *f;
   char st1[max_size];
-  char bestw[N][max_size];
   char file_name[max_size], st[100][max_size];
-  float dist, len, bestd[N], vec[max_size];
-  long long words, size, a, b, c, d, cn, bi[100];
+  float len, bestd[N], vec[max_size];
+  long long size, a, b, c, cn, bi[100], best[N];
   float *M;
-  char *vocab;
+  struct vectors v;
+  long long ef = TakeEfArg(&argc, argv);
   if (argc < 2) {
-    printf("Usage: ./word-analogy <FILE>\nwhere FILE contains word projections in the BINARY FORMAT\n");
+    printf("Usage: ./word-analogy <FILE> [<QUERIES> [tsv|json]] [-ef <EF>]\nwhere FILE contains word projections in the BINARY or MAPPED FORMAT (word2vec -binary 1, 2 or 3)\n");
+    printf("and QUERIES, if given, is a file of analogies (three words per line) to answer in a batch, writing the results\n");
+    printf("as tab-separated lines (query, rank, word, distance) or as JSON (an object per line)\n");
+    printf("With -ef, the nearest words are found approximately through the graph index FILE.hnsw (from build-hnsw), keeping\n");
+    printf("the EF best words while searching it (more is slower but finds more of the nearest)\n");
     return 0;
   }
   strcpy(file_name, argv[1]);
-  f = fopen(file_name, "rb");
-  if (f == NULL) {
-    printf("Input file not found\n");
-    return -1;
-  }
-  fscanf(f, "%lld", &words);
-  fscanf(f, "%lld", &size);
-  vocab = (char *)malloc((long long)words * max_w * sizeof(char));
-  M = (float *)malloc((long long)words * (long long)size * sizeof(float));
-  if (M == NULL) {
-    printf("Cannot allocate memory: %lld MB    %lld  %lld\n", (long long)words * size * sizeof(float) / 1048576, words, size);
-    return -1;
-  }
-  for (b = 0; b < words; b++) {
-    a = 0;
-    while (1) {
-      vocab[b * max_w + a] = fgetc(f);
-      if (feof(f) || (vocab[b * max_w + a] == ' ')) break;
-      if ((a < max_w) && (vocab[b * max_w + a] != '\n')) a++;
-    }
-    vocab[b * max_w + a] = 0;
-    for (a = 0; a < size; a++) fread(&M[a + b * size], sizeof(float), 1, f);
-    len = 0;
-    for (a = 0; a < size; a++) len += M[a + b * size] * M[a + b * size];
-    len = sqrt(len);
-    for (a = 0; a < size; a++) M[a + b * size] /= len;
-  }
-  fclose(f);
+  if (ReadVectors(file_name, 0, 0, &v)) return -1;
+  if (ef > 0 && OpenHnsw(&v, file_name, ef)) return -1;
+  size = v.size;
+  M = v.M;
+  if (argc > 2) return RunBatch(&v, argv[2], argc > 3 && !strcmp(argv[3], "json"), N, 0, AnalogyQuery);
   while (1) {
-    for (a = 0; a < N; a++) bestd[a] = 0;
-    for (a = 0; a < N; a++) bestw[a][0] = 0;
     printf("Enter three words (EXIT to break): ");
     a = 0;
     while (1) {
@@ -98,8 +101,8 @@ int main(int argc, char **argv) {
       continue;
     }
     for (a = 0; a < cn; a++) {
-      for (b = 0; b < words; b++) if (!strcmp(&vocab[b * max_w], st[a])) break;
-      if (b == words) b = 0;
+      b = FindWord(&v, st[a]);
+      if (b == -1) b = 0;
       bi[a] = b;
       printf("\nWord: %s  Position in vocabulary: %lld\n", st[a], bi[a]);
       if (b == 0) {
@@ -114,30 +117,8 @@ int main(int argc, char **argv) {
     for (a = 0; a < size; a++) len += vec[a] * vec[a];
     len = sqrt(len);
     for (a = 0; a < size; a++) vec[a] /= len;
-    for (a = 0; a < N; a++) bestd[a] = 0;
-    for (a = 0; a < N; a++) bestw[a][0] = 0;
-    for (c = 0; c < words; c++) {
-      if (c == bi[0]) continue;
-      if (c == bi[1]) continue;
-      if (c == bi[2]) continue;
-      a = 0;
-      for (b = 0; b < cn; b++) if (bi[b] == c) a = 1;
-      if (a == 1) continue;
-      dist = 0;
-      for (a = 0; a < size; a++) dist += vec[a] * M[a + c * size];
-      for (a = 0; a < N; a++) {
-        if (dist > bestd[a]) {
-          for (d = N - 1; d > a; d--) {
-            bestd[d] = bestd[d - 1];
-            strcpy(bestw[d], bestw[d - 1]);
-          }
-          bestd[a] = dist;
-          strcpy(bestw[a], &vocab[c * max_w]);
-          break;
-        }
-      }
-    }
-    for (a = 0; a < N; a++) printf("%50s\t\t%f\n", bestw[a], bestd[a]);
+    NearestRows(&v, vec, 0, bi, cn, N, best, bestd);
+    for (a = 0; a < N; a++) printf("%50s\t\t%f\n", best[a] == -1 ? "" : Word(&v, best[a]), bestd[a]);
   }
   return 0;
 }
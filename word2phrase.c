@@ -17,10 +17,19 @@
 #include <string.h>
 #include <math.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define MAX_STRING 60
 
-const int vocab_hash_size = 500000000; // Maximum 500M entries in the vocabulary
+const long long vocab_reduce_size = 350000000; // Maximum 350M entries in the vocabulary before pruning
+const long long vocab_hash_init_size = 1 << 16; // Initial hash table size (doubles when 70% full)
+const long long vocab_arena_block_size = 1 << 20; // Size of blocks in which words are stored
 
 typedef float real;                    // Precision of float numbers
 
@@ -29,71 +38,218 @@ struct vocab_word {
   char *word;
 };
 
+// Hash table slot: full hash and length of a word and its position in the vocabulary (-1 if empty)
+struct vocab_hash_slot {
+  unsigned long long hash;
+  int len, index;
+};
+
+// Block of word storage; blocks are never moved, so words stay put until the arena is freed
+struct vocab_arena_block {
+  struct vocab_arena_block *next;
+  long long size, used;
+  char data[];
+};
+
 char train_file[MAX_STRING], output_file[MAX_STRING];
+char *train_data;                      // Memory-mapped train_file
 struct vocab_word *vocab;
-int debug_mode = 2, min_count = 5, *vocab_hash, min_reduce = 1;
-long long vocab_max_size = 10000, vocab_size = 0;
-long long train_words = 0;
+struct vocab_hash_slot *vocab_hash = NULL;
+struct vocab_arena_block *vocab_arena = NULL;
+int debug_mode = 2, min_count = 5, min_reduce = 1;
+long long vocab_max_size = 10000, vocab_size = 0, vocab_hash_size = 0;
+long long train_words = 0, file_size = 0;
 real threshold = 100;
 
 unsigned long long next_random = 1;
 
-// Reads a single word from a file, assuming space + tab + EOL to be word boundaries
-void ReadWord(char *word, FILE *fin) {
-  int a = 0, ch;
-  while (!feof(fin)) {
-    ch = fgetc(fin);
-    if (ch == 13) continue;
-    if ((ch == ' ') || (ch == '\t') || (ch == '\n')) {
-      if (a > 0) {
-        if (ch == '\n') ungetc(ch, fin);
-        break;
-      }
-      if (ch == '\n') {
-        strcpy(word, (char *)"</s>");
-        return;
-      } else continue;
+// Memory-maps train_file into train_data and sets file_size
+void MapTrainFile() {
+  struct stat st;
+  int fd = open(train_file, O_RDONLY);
+  if ((fd < 0) || fstat(fd, &st)) {
+    printf("ERROR: training data file not found!\n");
+    exit(1);
+  }
+  file_size = st.st_size;
+  if (file_size == 0) train_data = (char *)"";
+  else {
+    train_data = (char *)mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (train_data == MAP_FAILED) {
+      printf("ERROR: cannot map training data file %s\n", train_file);
+      exit(1);
     }
-    word[a] = ch;
+    madvise(train_data, file_size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+}
+
+static inline int IsBoundary(char ch) {
+  return (ch == ' ') || (ch == '\t') || (ch == '\n') || (ch == '\r');
+}
+
+// Returns position of the first word boundary at or after pos (16 bytes at a time with SSE2)
+long long FindBoundary(long long pos) {
+#ifdef __SSE2__
+  const __m128i sp = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'),
+    nl = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+  __m128i x;
+  int mask;
+  while (pos + 16 <= file_size) {
+    x = _mm_loadu_si128((const __m128i *)(train_data + pos));
+    mask = _mm_movemask_epi8(_mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(x, sp), _mm_cmpeq_epi8(x, tab)),
+      _mm_or_si128(_mm_cmpeq_epi8(x, nl), _mm_cmpeq_epi8(x, cr))));
+    if (mask) return pos + __builtin_ctz(mask);
+    pos += 16;
+  }
+#endif
+  while ((pos < file_size) && !IsBoundary(train_data[pos])) pos++;
+  return pos;
+}
+
+// Finds the next word in train_data at or after *pos, assuming space + tab + CR + EOL to be word
+// boundaries; points *word at it (no copy, not null-terminated) and returns its length, or -1 at
+// end of data. A newline before any word gives "</s>"
+int ReadToken(long long *pos, char **word) {
+  long long a = *pos, b;
+  char ch;
+  while (a < file_size) {
+    ch = train_data[a];
+    if (ch == '\n') {
+      *pos = a + 1;
+      *word = (char *)"</s>";
+      return 4;
+    }
+    if (!IsBoundary(ch)) break;
     a++;
-    if (a >= MAX_STRING - 1) a--;   // Truncate too long words
   }
-  word[a] = 0;
+  if (a >= file_size) {
+    *pos = a;
+    return -1;
+  }
+  b = FindBoundary(a + 1);
+  *pos = b;
+  *word = train_data + a;
+  if (b - a > MAX_STRING - 2) return MAX_STRING - 2;   // Truncate too long words
+  return b - a;
 }
 
-// Returns hash value of a word
-int GetWordHash(char *word) {
-  unsigned long long a, hash = 1;
-  for (a = 0; a < strlen(word); a++) hash = hash * 257 + word[a];
-  hash = hash % vocab_hash_size;
+// Returns hash value (64-bit FNV-1a) of a word
+unsigned long long GetWordHash(char *word, int len) {
+  unsigned long long hash = 14695981039346656037ULL;
+  int a;
+  for (a = 0; a < len; a++) hash = (hash ^ (unsigned char)word[a]) * 1099511628211ULL;
   return hash;
 }
 
 // Returns position of a word in the vocabulary; if the word is not found, returns -1
-int SearchVocab(char *word) {
-  unsigned int hash = GetWordHash(word);
-  while (1) {
-    if (vocab_hash[hash] == -1) return -1;
-    if (!strcmp(word, vocab[vocab_hash[hash]].word)) return vocab_hash[hash];
-    hash = (hash + 1) % vocab_hash_size;
+int SearchVocab(char *word, int len) {
+  unsigned long long hash = GetWordHash(word, len), mask = vocab_hash_size - 1, slot = hash & mask;
+  while (vocab_hash[slot].index != -1) {
+    if ((vocab_hash[slot].hash == hash) && (vocab_hash[slot].len == len) &&
+        !memcmp(word, vocab[vocab_hash[slot].index].word, len))
+      return vocab_hash[slot].index;
+    slot = (slot + 1) & mask;
   }
   return -1;
 }
 
-// Reads a word and returns its index in the vocabulary
-int ReadWordIndex(FILE *fin) {
-  char word[MAX_STRING];
-  ReadWord(word, fin);
-  if (feof(fin)) return -1;
-  return SearchVocab(word);
+void FreeArena(struct vocab_arena_block *arena) {
+  struct vocab_arena_block *next;
+  while (arena != NULL) {
+    next = arena->next;
+    free(arena);
+    arena = next;
+  }
+}
+
+// Copies a word into the arena and returns the (null-terminated) copy
+char *ArenaCopyWord(char *word, int len) {
+  struct vocab_arena_block *block = vocab_arena;
+  char *copy;
+  if ((block == NULL) || (block->used + len + 1 > block->size)) {
+    block = (struct vocab_arena_block *)malloc(sizeof(struct vocab_arena_block) + vocab_arena_block_size);
+    if (block == NULL) {
+      printf("Memory allocation failed\n");
+      exit(1);
+    }
+    block->size = vocab_arena_block_size;
+    block->used = 0;
+    block->next = vocab_arena;
+    vocab_arena = block;
+  }
+  copy = block->data + block->used;
+  memcpy(copy, word, len);
+  copy[len] = 0;
+  block->used += len + 1;
+  return copy;
+}
+
+void InsertVocabHash(unsigned long long hash, int len, int index) {
+  unsigned long long mask = vocab_hash_size - 1, slot = hash & mask;
+  while (vocab_hash[slot].index != -1) slot = (slot + 1) & mask;
+  vocab_hash[slot].hash = hash;
+  vocab_hash[slot].len = len;
+  vocab_hash[slot].index = index;
+}
+
+// Reallocates the hash table with the given number (a power of two) of empty slots
+void ClearVocabHash(long long size) {
+  long long a;
+  free(vocab_hash);
+  vocab_hash_size = size;
+  vocab_hash = (struct vocab_hash_slot *)malloc(vocab_hash_size * sizeof(struct vocab_hash_slot));
+  if (vocab_hash == NULL) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
+  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a].index = -1;
+}
+
+// Doubles the hash table, re-inserting the stored hashes
+void GrowVocabHash() {
+  long long a, size = vocab_hash_size;
+  struct vocab_hash_slot *old = vocab_hash;
+  vocab_hash = NULL;
+  ClearVocabHash(size * 2);
+  for (a = 0; a < size; a++) if (old[a].index != -1)
+    InsertVocabHash(old[a].hash, old[a].len, old[a].index);
+  free(old);
+}
+
+// Rebuilds the hash table for the first vocab_size words and moves them to a fresh arena,
+// releasing the storage of removed words
+void RebuildVocab() {
+  long long a, size = vocab_hash_init_size;
+  int len;
+  struct vocab_arena_block *old = vocab_arena;
+  while (vocab_size > size * 0.7) size *= 2;
+  ClearVocabHash(size);
+  vocab_arena = NULL;
+  for (a = 0; a < vocab_size; a++) {
+    len = strlen(vocab[a].word);
+    vocab[a].word = ArenaCopyWord(vocab[a].word, len);
+    InsertVocabHash(GetWordHash(vocab[a].word, len), len, a);
+  }
+  FreeArena(old);
+}
+
+// Writes "a_b" to bigram, truncated to MAX_STRING - 1 characters, and returns its length
+int MakeBigram(char *bigram, char *a, int alen, char *b, int blen) {
+  int len = alen + 1 + blen;
+  memcpy(bigram, a, alen);
+  bigram[alen] = '_';
+  memcpy(bigram + alen + 1, b, blen);
+  if (len > MAX_STRING - 1) len = MAX_STRING - 1;
+  bigram[len] = 0;
+  return len;
 }
 
 // Adds a word to the vocabulary
-int AddWordToVocab(char *word) {
-  unsigned int hash, length = strlen(word) + 1;
-  if (length > MAX_STRING) length = MAX_STRING;
-  vocab[vocab_size].word = (char *)calloc(length, sizeof(char));
-  strcpy(vocab[vocab_size].word, word);
+int AddWordToVocab(char *word, int len) {
+  if (len > MAX_STRING - 1) len = MAX_STRING - 1;
+  vocab[vocab_size].word = ArenaCopyWord(word, len);
   vocab[vocab_size].cn = 0;
   vocab_size++;
   // Reallocate memory if needed
@@ -101,9 +257,8 @@ int AddWordToVocab(char *word) {
     vocab_max_size += 10000;
     vocab=(struct vocab_word *)realloc(vocab, vocab_max_size * sizeof(struct vocab_word));
   }
-  hash = GetWordHash(word);
-  while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-  vocab_hash[hash]=vocab_size - 1;
+  if (vocab_size > vocab_hash_size * 0.7) GrowVocabHash();
+  InsertVocabHash(GetWordHash(word, len), len, vocab_size - 1);
   return vocab_size - 1;
 }
 
@@ -114,63 +269,44 @@ int VocabCompare(const void *a, const void *b) {
 
 // Sorts the vocabulary by frequency using word counts
 void SortVocab() {
-  int a;
-  unsigned int hash;
+  int a, size = vocab_size;
   // Sort the vocabulary and keep </s> at the first position
   qsort(&vocab[1], vocab_size - 1, sizeof(struct vocab_word), VocabCompare);
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-  for (a = 0; a < vocab_size; a++) {
-    // Words occuring less than min_count times will be discarded from the vocab
-    if (vocab[a].cn < min_count) {
-      vocab_size--;
-      free(vocab[vocab_size].word);
-    } else {
-      // Hash will be re-computed, as after the sorting it is not actual
-      hash = GetWordHash(vocab[a].word);
-      while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-      vocab_hash[hash] = a;
-    }
-  }
+  // Words occuring less than min_count times will be discarded from the vocab
+  // (they are all at the end after sorting)
+  vocab_size = 1;
+  for (a = 1; a < size; a++) if (vocab[a].cn >= min_count) vocab_size++;
+  // Hash will be re-computed, as after the sorting it is not actual
+  RebuildVocab();
   vocab = (struct vocab_word *)realloc(vocab, vocab_size * sizeof(struct vocab_word));
 }
 
 // Reduces the vocabulary by removing infrequent tokens
 void ReduceVocab() {
   int a, b = 0;
-  unsigned int hash;
   for (a = 0; a < vocab_size; a++) if (vocab[a].cn > min_reduce) {
     vocab[b].cn = vocab[a].cn;
     vocab[b].word = vocab[a].word;
     b++;
-  } else free(vocab[a].word);
-  vocab_size = b;
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-  for (a = 0; a < vocab_size; a++) {
-    // Hash will be re-computed, as it is not actual
-    hash = GetWordHash(vocab[a].word);
-    while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-    vocab_hash[hash] = a;
   }
+  vocab_size = b;
+  // Hash will be re-computed, as it is not actual
+  RebuildVocab();
   fflush(stdout);
   min_reduce++;
 }
 
 void LearnVocabFromTrainFile() {
-  char word[MAX_STRING], last_word[MAX_STRING], bigram_word[MAX_STRING * 2];
-  FILE *fin;
-  long long a, i, start = 1;
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-  fin = fopen(train_file, "rb");
-  if (fin == NULL) {
-    printf("ERROR: training data file not found!\n");
-    exit(1);
-  }
+  char *word, *last_word = (char *)"", bigram_word[MAX_STRING * 2];
+  long long a, i, start = 1, pos = 0;
+  int len, last_len = 0, bigram_len;
+  ClearVocabHash(vocab_hash_init_size);
   vocab_size = 0;
-  AddWordToVocab((char *)"</s>");
+  AddWordToVocab((char *)"</s>", 4);
   while (1) {
-    ReadWord(word, fin);
-    if (feof(fin)) break;
-    if (!strcmp(word, "</s>")) {
+    len = ReadToken(&pos, &word);
+    if (len < 0) break;
+    if ((len == 4) && !strncmp(word, "</s>", 4)) {
       start = 1;
       continue;
     } else start = 0;
@@ -179,45 +315,45 @@ void LearnVocabFromTrainFile() {
       printf("Words processed: %lldK     Vocab size: %lldK  %c", train_words / 1000, vocab_size / 1000, 13);
       fflush(stdout);
     }
-    i = SearchVocab(word);
+    i = SearchVocab(word, len);
     if (i == -1) {
-      a = AddWordToVocab(word);
+      a = AddWordToVocab(word, len);
       vocab[a].cn = 1;
     } else vocab[i].cn++;
     if (start) continue;
-    sprintf(bigram_word, "%s_%s", last_word, word);
-    bigram_word[MAX_STRING - 1] = 0;
-    strcpy(last_word, word);
-    i = SearchVocab(bigram_word);
+    bigram_len = MakeBigram(bigram_word, last_word, last_len, word, len);
+    last_word = word;
+    last_len = len;
+    i = SearchVocab(bigram_word, bigram_len);
     if (i == -1) {
-      a = AddWordToVocab(bigram_word);
+      a = AddWordToVocab(bigram_word, bigram_len);
       vocab[a].cn = 1;
     } else vocab[i].cn++;
-    if (vocab_size > vocab_hash_size * 0.7) ReduceVocab();
+    if (vocab_size > vocab_reduce_size) ReduceVocab();
   }
   SortVocab();
   if (debug_mode > 0) {
     printf("\nVocab size (unigrams + bigrams): %lld\n", vocab_size);
     printf("Words in train file: %lld\n", train_words);
   }
-  fclose(fin);
 }
 
 void TrainModel() {
-  long long pa = 0, pb = 0, pab = 0, oov, i, li = -1, cn = 0;
-  char word[MAX_STRING], last_word[MAX_STRING], bigram_word[MAX_STRING * 2];
+  long long pa = 0, pb = 0, pab = 0, oov, i, li = -1, cn = 0, pos = 0;
+  char *word = (char *)"", *last_word, bigram_word[MAX_STRING * 2];
+  int len = 0, last_len, bigram_len;
   real score;
-  FILE *fo, *fin;
+  FILE *fo;
   printf("Starting training using file %s\n", train_file);
+  MapTrainFile();
   LearnVocabFromTrainFile();
-  fin = fopen(train_file, "rb");
   fo = fopen(output_file, "wb");
-  word[0] = 0;
   while (1) {
-    strcpy(last_word, word);
-    ReadWord(word, fin);
-    if (feof(fin)) break;
-    if (!strcmp(word, "</s>")) {
+    last_word = word;
+    last_len = len;
+    len = ReadToken(&pos, &word);
+    if (len < 0) break;
+    if ((len == 4) && !strncmp(word, "</s>", 4)) {
       fprintf(fo, "\n");
       continue;
     }
@@ -227,25 +363,23 @@ void TrainModel() {
       fflush(stdout);
     }
     oov = 0;
-    i = SearchVocab(word);
+    i = SearchVocab(word, len);
     if (i == -1) oov = 1; else pb = vocab[i].cn;
     if (li == -1) oov = 1;
     li = i;
-    sprintf(bigram_word, "%s_%s", last_word, word);
-    bigram_word[MAX_STRING - 1] = 0;
-    i = SearchVocab(bigram_word);
+    bigram_len = MakeBigram(bigram_word, last_word, last_len, word, len);
+    i = SearchVocab(bigram_word, bigram_len);
     if (i == -1) oov = 1; else pab = vocab[i].cn;
     if (pa < min_count) oov = 1;
     if (pb < min_count) oov = 1;
     if (oov) score = 0; else score = (pab - min_count) / (real)pa / (real)pb * (real)train_words;
     if (score > threshold) {
-      fprintf(fo, "_%s", word);
+      fprintf(fo, "_%.*s", len, word);
       pb = 0;
-    } else fprintf(fo, " %s", word);
+    } else fprintf(fo, " %.*s", len, word);
     pa = pb;
   }
   fclose(fo);
-  fclose(fin);
 }
 
 int ArgPos(char *str, int argc, char **argv) {
@@ -286,7 +420,6 @@ int main(int argc, char **argv) {
   if ((i = ArgPos((char *)"-min-count", argc, argv)) > 0) min_count = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-threshold", argc, argv)) > 0) threshold = atof(argv[i + 1]);
   vocab = (struct vocab_word *)calloc(vocab_max_size, sizeof(struct vocab_word));
-  vocab_hash = (int *)calloc(vocab_hash_size, sizeof(int));
   TrainModel();
   return 0;
 }
@@ -56,37 +56,146 @@
 //
 //   main
 //   |
+//   |- InitKernels
+//   |
 //   L- TrainModel
 //      |
+//      |- OpenDistSocket
+//      |
+//      |- ReadCheckpointVocab
+//      |
+//      |- JoinCoordinator
+//      |  |- OpenDistSocket
+//      |  L- AddWordToVocab
+//      |
 //      |- ReadVocab
 //      |  |- ReadWord
 //      |  |- AddWordToVocab
+//      |  |- MergeModelVocab
 //      |  L- SortVocab
 //      |
+//      |- MapTrainFile
+//      |
 //      |- LearnVocabFromTrainFile
-//      |  |- ReadWord
+//      |  |- LearnVocabParallel
+//      |  |  L- LearnVocabThread
+//      |  |     |- ReadToken
+//      |  |     L- ShardSlot
+//      |  |- ReadToken
+//      |  |  L- FindBoundary
 //      |  |- AddWordToVocab
 //      |  |- SearchVocab
 //      |  |- ReduceVocab
+//      |  |- MergeModelVocab
 //      |  L- SortVocab
 //      |
+//      |- InitStream
+//      |
 //      |- SaveVocab
+//      |- EncodeTrainFile
+//      |  L- ReadWordIndex
+//      |- MapEncodedFile
+//      |- InitChunks
+//      |  |- ShardStart
+//      |  L- FindBoundary
+//      |- InitNuma
 //      |- InitNet
+//      |  |- AllocParams
+//      |  |  L- PinParams
+//      |  L- NumaBind
+//      |- ReadCheckpointNet
+//      |- ReadModelNet
+//      |  |- SameHuffmanTree
+//      |  |  L- BuildHuffmanTree
+//      |  L- ReadParamRow
+//      |- InitReplicas
+//      |- InitDistBase
 //      |- InitUnigramTable
+//      |- InitAliasTable
+//      |
+//      |- RunCoordinator
+//      |
+//      |- MonitorThread
+//      |  |- SyncReplicas
+//      |  |- WorkerSync
+//      |  L- WriteCheckpoint (in a forked process)
+//      |
+//      |- StreamReaderThread
+//      |  |- ReadWord
+//      |  |- SearchVocab
+//      |  |- StreamAddWord
+//      |  |  L- RemoveVocabHash
+//      |  |- StreamSample
+//      |  L- StreamPush
+//      |
+//      |- TrainModelThread
+//      |  |- PinThread
+//      |  |- ClaimChunk
+//      |  |- ReadWordIndex
+//      |  |  |- ReadToken
+//      |  |  L- SearchVocab
+//      |  |- ReadEncodedWordIndex
+//      |  |- ReadStreamSentence
+//      |  |- PrefetchRows
+//      |  |- DrawNegative
+//      |  |- Row
+//      |  |- LoadRow
+//      |  |  L- ParamsToReals
+//      |  |- StoreRow
+//      |  |  L- RealsToParams
+//      |  |- MergeHotRows
+//      |  L- DotProduct, Axpy, DualAxpy, DotBlock, AxpyBlock
+//      |
+//      |- WorkerSync
+//      |
+//      |- FinishStream
+//      |  |- AllocParams
+//      |  L- RebuildVocab
+//      |
+//      |- SaveModel
+//      |  L- WriteCheckpoint
 //      |
-//      L- TrainModelThread
-//         L- ReadWordIndex
-//            |- ReadWord
-//            L- SearchVocab
+//      L- SaveVectors
+//         |- WriteVectorsHeader
+//         |- FormatRowsThread
+//         |  L- FormatReal
+//         L- WriteVectorsIndex
 //
 // ---------------------------------------------------------------------
 
 
+// (for CPU affinity)
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sched.h>
+// (the mapped vector format, for `binary` 3)
+#define VECTORS_FORMAT_ONLY
+#include "vectors.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define X86_KERNELS
+#endif
 
 
 // max length of filenames, vocabulary words (including null terminator)
@@ -103,20 +212,157 @@
 #define MAX_SENTENCE_LENGTH 1000
 // max length of Huffman codes used by hierarchical softmax
 #define MAX_CODE_LENGTH 40
+// max NUMA node id + 1 and max number of CPUs per node (see `InitNuma`)
+#define MAX_NUMA_NODES 256
+#define MAX_NUMA_CPUS 4096
+// memory policies for the mbind system call (from <numaif.h>, which is
+// not needed otherwise)
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#define MPOL_INTERLEAVE 3
+#endif
 
 
-// Maximum 30 * 0.7 = 21M words in the vocabulary
-// (where 0.7 is the magical load factor beyond which hash table
-// performance degrades)
-const int vocab_hash_size = 30000000;
+// Maximum 21M words in the vocabulary before it is pruned (see
+// `ReduceVocab`); this was the effective capacity of the fixed-size
+// hash table (30M slots at a load factor of 0.7) this code used to use
+const long long vocab_reduce_size = 21000000;
+
+// Initial number of slots in vocabulary hash table `vocab_hash` (a
+// power of two); the table doubles in size whenever it is more than
+// 70% full
+const long long vocab_hash_init_size = 1 << 16;
+
+// Target size (in bytes) of the chunks into which the training data is
+// cut to be handed out to training threads (see `InitChunks`); word
+// indices of encoded training data count 4 bytes each
+const long long train_chunk_size = 1 << 20;
+
+// Minimum size (in bytes) of the blocks in which vocabulary words are
+// stored (see `vocab_arena`)
+const long long vocab_arena_block_size = 1 << 20;
 
 // Negative sampling distribution represented by 1e8-element discrete
 // sample from smoothed empirical unigram distribution.
 const int table_size = 1e8;
 
+// Number of entries of the negative sampling reservoir `stream_table`
+// used in streaming mode (see `StreamSample`)
+const long long stream_table_size = 1e7;
+
 // Set precision of real numbers
 typedef float real;
 
+// Set precision of the parameters `syn0`, `syn1`, and `syn1neg`: `real`
+// by default, or 16-bit bfloat16 or IEEE half-precision numbers if built
+// with `make PRECISION=bf16` or `make PRECISION=fp16`, which halves the
+// memory the parameters take and the memory traffic of training.  Rows
+// of 16-bit parameters are converted to `real` to be trained on and
+// rounded back (see `LoadRow` and `StoreRow`).
+#define PARAM_REAL 0
+#define PARAM_BF16 1
+#define PARAM_FP16 2
+#if defined(PRECISION_bf16)
+#define PARAM_TYPE PARAM_BF16
+#define HALF_PARAMS
+typedef unsigned short param;
+#elif defined(PRECISION_fp16)
+#define PARAM_TYPE PARAM_FP16
+#define HALF_PARAMS
+typedef unsigned short param;
+#else
+#define PARAM_TYPE PARAM_REAL
+typedef real param;
+#endif
+
+// Names of the parameter types (indexed by `PARAM_TYPE`), and the type
+// of the half-precision output (`binary` 2): the parameters' own type
+// if it is 16-bit, otherwise fp16
+const char *param_names[] = {"float", "bf16", "fp16"};
+#define HALF_OUTPUT_TYPE (PARAM_TYPE == PARAM_BF16 ? PARAM_BF16 : PARAM_FP16)
+
+// Magic string at the start of a pre-tokenized (encoded) training data
+// file; bump the trailing digit if the layout changes
+#define ENCODED_MAGIC "W2VENC1"
+
+// Header of a pre-tokenized training data file.  The header is followed
+// by `num_tokens` ints, each the position of a word in the vocabulary
+// (0 for "</s>", i.e. a sentence boundary); OOV words are not stored.
+// `vocab_size` and `vocab_checksum` identify the vocabulary the file was
+// encoded with so that it is not reused with a different one.
+struct encoded_header {
+  char magic[8];
+  long long vocab_size;
+  unsigned long long vocab_checksum;
+  long long num_tokens;
+};
+
+// Magic string at the start of a checkpoint file; bump the trailing
+// digit if the layout changes
+#define CHECKPOINT_MAGIC "W2VCKPT4"
+
+// Header of a checkpoint file (see `WriteCheckpoint`), also used to save
+// a model for incremental training (see `MergeModelVocab`).  The header
+// is followed by the vocabulary (for each word, its count as a long long,
+// its length as an int, and its characters), then `syn0`, `syn1` (if
+// `hs`), and `syn1neg` (if `negative` > 0), then one `thread_state` per
+// thread.
+struct checkpoint_header {
+  char magic[8];
+  long long vocab_size, layer1_size, hs, negative, num_threads, iter;
+  long long precision;         // `PARAM_TYPE` of the parameters
+  long long encoded;           // 1 if threads' positions are in
+                               //   `encoded_ids`, 0 if in `train_data`
+  long long train_words, epoch_words, word_count_actual;
+  long long num_chunks, work_cursor;
+  double alpha, starting_alpha, alpha_min;
+};
+
+// Position of a training thread in its work, from which it can resume
+struct thread_state {
+  long long
+    pos,                       // position in training data (see
+                               //   `TrainModelThread`)
+    chunk;                     // `work_cursor` value of the chunk being
+                               //   trained on (see `ClaimChunk`; -1
+                               //   before the first one)
+  unsigned long long
+    next_random;               // RNG state
+};
+
+// Magic string at the start of the setup a distributed training
+// coordinator sends to its workers; bump the trailing digit if the
+// protocol changes
+#define DIST_MAGIC "W2VDIST1"
+
+// Setup sent by the coordinator of distributed training to a worker that
+// joins (see `RunCoordinator`), followed by the vocabulary (as in a
+// checkpoint file): the worker's rank and the training options every
+// worker must share.
+struct dist_setup {
+  char magic[8];
+  long long rank, workers, precision;
+  long long vocab_size, layer1_size, window, hs, negative, cbow, batch, iter;
+  long long train_words, epoch_words;
+  double alpha, alpha_min, sample;
+};
+
+// Header of a sync message of distributed training (see `WorkerSync`).
+// It is followed by rows of parameters, each as its index (a long long)
+// and `layer1_size` reals, then by an index of -1.  Row `r` of `syn0`,
+// `syn1`, or `syn1neg` has index `r`, `vocab_size` + `r`, or
+// 2 * `vocab_size` + `r` (see `DistMatrix`).
+struct dist_sync {
+  long long
+    words,                     // from a worker: words its threads
+                               //   trained on since its last sync; from
+                               //   the coordinator: words all workers
+                               //   trained on so far
+    done;                      // from a worker: 1 if its threads have
+                               //   finished; from the coordinator: 1 if
+                               //   all workers' have (the last sync)
+};
+
 // Representation of a word in the vocabulary, including (optional,
 // for hierarchical softmax only) Huffman coding
 struct vocab_word {
@@ -125,15 +371,125 @@ struct vocab_word {
   char *word, *code, codelen;
 };
 
+// Slot in vocabulary hash table `vocab_hash`.  The full hash and the
+// length of the word are stored with its position in `vocab` so that
+// probes rarely need to look at the word itself.
+struct vocab_hash_slot {
+  unsigned long long hash;     // hash of word (see `GetWordHash`)
+  int
+    len,                       // length of word
+    index;                     // position of word in `vocab` (-1 if
+                               //   slot is empty)
+};
+
+// Block of memory in which vocabulary words are stored, one after
+// another (null-terminated).  Blocks are never moved, so pointers to
+// words stay valid until the whole arena is freed.
+struct vocab_arena_block {
+  struct vocab_arena_block *next;
+  long long size, used;        // capacity and used bytes of `data`
+  char data[];
+};
+
+// Entry of the alias table `alias_table` (Vose's alias method): a draw
+// picks an entry uniformly at random, then returns that entry's own word
+// with probability `prob` / 2^32 and word `alias` otherwise.
+struct alias_entry {
+  unsigned int prob;           // probability of keeping the entry's own
+                               //   word, scaled to [0, 2^32)
+  int alias;                   // position of the other word in `vocab`
+};
+
+// Sentence passed from `StreamReaderThread` to the training threads
+// through `stream_queue` (in streaming mode)
+struct stream_sentence {
+  long long tokens;            // word tokens read for this sentence
+                               //   (including "</s>" and words below
+                               //   `min_count`)
+  int length,                  // number of words in `ids`
+    ids[MAX_SENTENCE_LENGTH];  // positions of words in `vocab`
+};
+
+// Training statistics of one thread, written by that thread and read by
+// `MonitorThread`; padded to 64 bytes so that threads updating their
+// own statistics do not share a cache line.
+struct thread_stats {
+  long long words;             // words trained on so far, over all
+                               //   iterations
+  double
+    start_time,                // time the thread started (see
+                               //   `GetTime`)
+    end_time,                  // time the thread finished (0 while
+                               //   running)
+    read_time,                 // seconds spent reading sentences
+    loss;                      // sum of log-loss over all predictions
+                               //   so far (if `loss` is set)
+  long long
+    loss_count,                // number of predictions (input/context,
+                               //   output word pairs) in `loss`
+    epochs;                    // number of iterations finished
+  char pad[8];
+};
+
+// The `thread_state` of a training thread, published every 10k words
+// for `WriteCheckpoint`.  The thread writes the slot not pointed to by
+// `current`, then flips `current`, so a snapshot of memory taken at any
+// instant sees a consistent state.  Padded to 128 bytes.
+struct thread_checkpoint {
+  struct thread_state state[2];
+  int current;
+  char pad[76];
+};
+
 struct vocab_word *vocab;      // vocabulary
+struct vocab_hash_slot
+  *vocab_hash = NULL;          // open-addressing (linear-probing) hash
+                               //   table of words to positions in
+                               //   vocabulary
+struct vocab_arena_block
+  *vocab_arena = NULL;         // storage for words in vocabulary (most
+                               //   recently allocated block first)
 char
+  *train_data = NULL,          // memory-mapped `train_file`
   train_file[MAX_STRING],      // training data (text) input file
+                               //   ("-" for stdin if `stream` is set)
   output_file[MAX_STRING],     // word vector (or word vector cluster)
                                //   (binary/text) output file
   save_vocab_file[MAX_STRING], // vocabulary (text) output file
-  read_vocab_file[MAX_STRING]; // vocabulary (text) input file
+  read_vocab_file[MAX_STRING], // vocabulary (text) input file
+  encoded_file[MAX_STRING],    // pre-tokenized (binary) training data
+                               //   file, created from `train_file` if
+                               //   needed
+  simd[MAX_STRING],            // name of vector kernels to use for
+                               //   training ("auto" to pick the best
+                               //   ones the CPU supports; see
+                               //   `InitKernels`)
+  stats_file[MAX_STRING],      // training statistics (JSON lines)
+                               //   output file (see `MonitorThread`)
+  checkpoint_file[MAX_STRING], // checkpoint file, written every
+                               //   `checkpoint_interval` seconds
+  checkpoint_tmp_file[MAX_STRING + 4], // `checkpoint_file` + ".tmp"
+                               //   (written first, then renamed)
+  weights_dir[MAX_STRING],     // directory of scratch files that
+                               //   `syn0`, `syn1`, and `syn1neg` are
+                               //   mapped from (out-of-core training;
+                               //   see `AllocParams`), or empty
+  dist_addr[MAX_STRING],       // (if `dist` is set) address the
+                               //   coordinator listens on and workers
+                               //   connect to (see `OpenDistSocket`)
+  save_model_file[MAX_STRING], // model output file (for incremental
+                               //   training; see `SaveModel`)
+  init_model_file[MAX_STRING], // model input file to continue training
+                               //   (see `MergeModelVocab`)
+  **model_words = NULL;        // words of `init_model_file`, in order
 int
-  binary = 0,                  // 0 for text output, 1 for binary
+  binary = 0,                  // 0 for text output, 1 for binary, 2
+                               //   for binary in half precision (see
+                               //   `HALF_OUTPUT_TYPE`), 3 for the
+                               //   mapped vector format (see
+                               //   `SaveVectors`)
+  normalize = 0,               // (if `binary` is 3) 1 to scale the
+                               //   output vectors to unit length
   cbow = 1,                    // 0 for skip-gram, 1 for CBOW
   debug_mode = 2,              // 1 for extra terminal output, 2 for
                                //   extra extra terminal output
@@ -149,47 +505,859 @@ int
                                //   (will be incremented as necessary)
                                //   (do not change)
   hs = 0,                      // 1 for hierarchical softmax
-  negative = 5;                // number of negative samples to draw
+  stochastic_round = 0,        // (with 16-bit parameters) 1 to round
+                               //   updated parameters stochastically
+                               //   rather than to nearest (see
+                               //   `RealsToParams`)
+  negative = 5,                // number of negative samples to draw
                                //   per word
-int *vocab_hash,               // hash table of words to positions in
-                               //   vocabulary
-  *table;                      // discrete sample of words used as
+  resume = 0,                  // 1 to resume training from
+                               //   `checkpoint_file`
+  loss = 0,                    // 1 to compute training loss (reported
+                               //   by `MonitorThread`)
+  alias = 0,                   // 1 to draw negative samples from
+                               //   `alias_table` rather than `table`
+  batch = 0,                   // 1 for skip-gram negative sampling to
+                               //   share one set of negative samples
+                               //   among all input words of a window,
+                               //   trained as a minibatch with matrix
+                               //   products (see `TrainModelThread`)
+  stream = 0,                  // 1 to learn vocabulary and embeddings
+                               //   in a single pass over `train_file`,
+                               //   read sequentially (see
+                               //   `StreamReaderThread`)
+  numa = 0,                    // 1 to pin training threads to CPUs of
+                               //   NUMA nodes in turn and interleave
+                               //   parameters across nodes, 2 to also
+                               //   give each node its own replica of
+                               //   `syn0` and `syn1neg` (see
+                               //   `SyncReplicas`)
+  dist = 0,                    // 1 to coordinate distributed
+                               //   training by worker processes, 2 to
+                               //   be one of its workers (see
+                               //   `RunCoordinator`)
+  dist_workers = 0,            // number of worker processes
+  dist_rank = 0,               // (if a worker) its number, from 0 to
+                               //   `dist_workers` - 1
+  dist_listen_fd = -1,         // (if the coordinator) socket workers
+                               //   connect to
+  *dist_count = NULL,          // (if the coordinator) number of workers
+                               //   that sent a change of each row in
+                               //   the current sync
+  num_nodes = 1,               // number of NUMA nodes with CPUs
+  node_id[MAX_NUMA_NODES],     // id of each node (in sysfs)
+  node_ncpus[MAX_NUMA_NODES],  // number of CPUs of each node
+  *node_cpus[MAX_NUMA_NODES];  // ids of those CPUs
+int
+  *table = NULL,               // discrete sample of words used as
                                //   negative sampling distribution
+  *encoded_ids = NULL;         // memory-mapped word indices from
+                               //   `encoded_file` (NULL if training on
+                               //   text)
 long long
   vocab_max_size = 1000,       // capacity of vocabulary
                                //   (will be incremented as necessary)
   vocab_size = 0,              // number of words in vocabulary
                                //   (do not change)
+  vocab_hash_size = 0,         // number of slots in `vocab_hash`
+                               //   (do not change)
   layer1_size = 100,           // size of embeddings
   train_words = 0,             // number of word tokens in training data
+                               //   (or, with `init_model_file`, in the
+                               //   training data and that model's
+                               //   training data; used for subsampling)
+                               //   (do not change)
+  epoch_words = 0,             // number of word tokens in training data
+                               //   (trained on in each iteration)
                                //   (do not change)
+  model_vocab_size = 0,        // number of words in `init_model_file`
+  *model_cn = NULL,            // counts of words in `init_model_file`
   word_count_actual = 0,       // number of word tokens seen so far
                                //   during training, over all
                                //   iterations; updated infrequently
+                               //   (and atomically)
                                //   (used for terminal output and
                                //   learning rate)
                                //   (do not change)
   iter = 5,                    // number of passes to take through
                                //   training data
   file_size = 0,               // size (in bytes) of training data file
-  classes = 0;                 // number of k-means clusters to learn
+  encoded_tokens = 0,          // number of word indices in
+                               //   `encoded_ids`
+  classes = 0,                 // number of k-means clusters to learn
                                //   of word vectors and write to output
                                //   file (0 to write word vectors to
                                //   output file, no clustering)
+  stream_vocab_size = 1000000, // (if `stream` is set) max number of
+                               //   words in vocabulary besides "</s>"
+  stream_table_filled = 0,     // entries of `stream_table` in use
+  stream_evictions = 0,        // words evicted from vocabulary to make
+                               //   room for new ones
+  stream_queue_size,           // number of slots in `stream_queue`
+  stream_head = 0,             // sentences taken from `stream_queue`
+  stream_tail = 0,             // sentences put into `stream_queue`
+  num_chunks = 1,              // number of chunks of training data
+  *chunk_start = NULL,         // position in training data of start of
+                               //   each chunk, and of end of data
+  work_cursor = 0,             // number of chunks handed out to
+                               //   training threads so far, over all
+                               //   iterations (see `ClaimChunk`)
+  hot_words = 0,               // number of most frequent words whose
+                               //   rows each training thread keeps a
+                               //   private copy of (see
+                               //   `TrainModelThread`)
+  hot_sync = 10000,            // words a training thread trains on
+                               //   between merges of its hot rows
+  remote_words = 0,            // (if a worker) words other workers
+                               //   trained on, as of the last sync
+                               //   (counted with `word_count_actual`
+                               //   for the learning rate)
+  dist_words_sent = 0,         // (if a worker) `word_count_actual` as
+                               //   of the last sync
+  dist_syncs = 0,              // number of syncs of distributed
+                               //   training so far
+  pin_words = 100000,          // (if `weights_dir` is set) number of
+                               //   most frequent words whose rows are
+                               //   kept in memory (see `PinParams`)
+  pinned_bytes = 0,            // bytes of those rows
+  mapped_bytes = 0,            // bytes of parameters in `weights_dir`
+  page_bytes = 4096,           // size of a memory page
+  start_faults = 0;            // major page faults of this process
+                               //   when training started (see
+                               //   `MajorFaults`)
+double
+  dist_bytes_in = 0,           // bytes received and sent in those
+  dist_bytes_out = 0;          //   syncs
 real
   alpha = 0.025,               // linear-decay learning rate
   starting_alpha,              // initial learning rate
                                //   (do not change; initialized at
                                //   beginning of training)
   sample = 1e-3;               // word subsampling threshold
-real
+struct alias_entry
+  *alias_table = NULL;         // alias table of negative sampling
+                               //   distribution (one entry per word in
+                               //   vocabulary; used if `alias` is set)
+double
+  sampler_build_time = 0,      // seconds taken to build `table` or
+                               //   `alias_table`
+  sampler_draw_time = 0;       // average time (in nanoseconds) of one
+                               //   negative sample draw (see
+                               //   `MeasureNegativeSampler`)
+param
   *syn0,                       // input word embeddings
   *syn1,                       // (used by hierarchical softmax)
   *syn1neg,                    // output word embeddings
-  *expTable;                   // precomputed table of
+  *syn0_replica[MAX_NUMA_NODES],    // (if `numa` is 2) copies of
+  *syn1neg_replica[MAX_NUMA_NODES], //   `syn0` and `syn1neg` on each
+                                    //   node, trained by its threads
+  *dist_base[3];               // (if a worker) `syn0`, `syn1`, and
+                               //   `syn1neg` as of the last sync
+real
+  *dist_sum[3];                // (if the coordinator) sum of the changes
+                               //   of each row of `syn0`, `syn1`, and
+                               //   `syn1neg` sent in the current sync
+FILE
+  **dist_in = NULL,            // streams reading from and writing to
+  **dist_out = NULL;           //   each worker (if the coordinator) or
+                               //   the coordinator (if a worker)
+real
+  *expTable,                   // precomputed table of
                                //   e^x / (e^x + 1) for x in
                                //   [-MAX_EXP, MAX_EXP)
-clock_t start;                 // start time of training algorithm
+  *logSigTable = NULL;         // precomputed table of
+                               //   log(e^x / (e^x + 1)) for x in
+                               //   [-MAX_EXP, MAX_EXP] (if `loss` is
+                               //   set)
+double
+  alpha_min = -1,              // minimum learning rate (if negative,
+                               //   set to `starting_alpha` * 0.0001)
+  start,                       // start time of training algorithm
+                               //   (see `GetTime`)
+  stats_interval = 10,         // seconds between lines of `stats_file`
+  checkpoint_interval = 3600,  // seconds between checkpoints
+  numa_sync_interval = 1,      // (if `numa` is 2) seconds between
+                               //   merges of parameter replicas
+  dist_sync_interval = 10;     // (if a worker) seconds between syncs
+                               //   with the coordinator
+long long
+  start_words = 0;             // `word_count_actual` when training
+                               //   (re)started
+struct thread_checkpoint
+  *train_states;               // state of each training thread (see
+                               //   `thread_checkpoint`)
+struct thread_state
+  *resume_states = NULL;       // state of each training thread as read
+                               //   from `checkpoint_file` (if `resume`)
+struct thread_stats
+  *train_stats;                // statistics of each training thread
+double
+  *epoch_loss = NULL;          // (if `loss` is set) `loss` and
+long long                      //   `loss_count` of each thread at the
+  *epoch_loss_count = NULL;    //   end of each iteration (thread `t`,
+                               //   iteration `e` at `t` * `iter` + `e`)
+volatile int
+  training_done = 0;           // set when all training threads have
+                               //   finished (see `MonitorThread`)
+char
+  *stream_words = NULL;        // storage for words in vocabulary in
+                               //   streaming mode, `MAX_STRING` bytes
+                               //   per slot (reused on eviction)
+int
+  *stream_heap = NULL,         // min-heap of positions in `vocab` (all
+                               //   but "</s>") ordered by count
+  *stream_heap_pos = NULL,     // position in `stream_heap` of each word
+  *stream_table = NULL;        // reservoir sample of word tokens used
+                               //   as negative sampling distribution
+                               //   in streaming mode
+double
+  stream_weight = 0;           // total weight offered to `stream_table`
+struct stream_sentence
+  *stream_queue = NULL;        // ring buffer of sentences read but not
+                               //   yet trained on
+int
+  *hot_syn0_changers = NULL,   // (used by `hot_words`) for each of the
+  *hot_syn1neg_changers = NULL, //  first `hot_words` rows of `syn0` and
+                               //   `syn1neg` (of each node's replicas if
+                               //   `numa` is 2), the number of threads
+                               //   whose latest merge changed it (see
+                               //   `MergeHotRows`)
+  stream_closed = 0;           // set when the reader has put the last
+                               //   sentence into `stream_queue`
+pthread_mutex_t
+  stream_lock = PTHREAD_MUTEX_INITIALIZER; // guards `stream_queue`
+pthread_cond_t
+  stream_not_empty = PTHREAD_COND_INITIALIZER,
+  stream_not_full = PTHREAD_COND_INITIALIZER;
+
+// Vector kernels used by the training loop, set by `InitKernels`:
+//
+//   DotProduct: return < `x`, `y` >
+//   Axpy: `y` += `a` * `x`
+//   DualAxpy: `neu1e` += `g` * `out`, then `out` += `g` * `in`, in one
+//     pass over `out` (the gradient step for one output row; `neu1e`
+//     gets the value of `out` before the update)
+//
+// and the block kernels used by skip-gram with shared negative samples
+// (`batch`), on matrices stored as contiguous rows:
+//
+//   DotBlock: `out`[i * `ny` + j] = < row i of `x`, row j of `y` > for
+//     i < `nx`, j < `ny`
+//   AxpyBlock: row i of `out` += sum over j < `ny` of
+//     `g`[i * `gi` + j * `gj`] * row j of `y`, for i < `nx` (passing
+//     `gi` = 1 and `gj` = number of columns of `g` uses its transpose)
+//
+// All vectors (rows) have `n` elements.
+real (*DotProduct)(const real *x, const real *y, long long n);
+void (*Axpy)(real a, const real *x, real *y, long long n);
+void (*DualAxpy)(real g, real *out, const real *in, real *neu1e, long long n);
+void (*DotBlock)(const real *x, long long nx, const real *y, long long ny, real *out, long long n);
+void (*AxpyBlock)(const real *g, long long gi, long long gj, const real *y, long long ny, real *out, long long nx, long long n);
+
+// Scalar kernels; these perform exactly the operations of the original
+// loops, in the same order.  They are compiled without contracting
+// multiplies and adds into fused multiply-adds so that their results do
+// not depend on the compiler's choices (with one thread, training is
+// bitwise reproducible, and matches the original loops compiled with
+// -ffp-contract=off).
+__attribute__((optimize("fp-contract=off")))
+real DotProductScalar(const real *x, const real *y, long long n) {
+  long long c;
+  real f = 0;
+  for (c = 0; c < n; c++) f += x[c] * y[c];
+  return f;
+}
+
+__attribute__((optimize("fp-contract=off")))
+void AxpyScalar(real a, const real *x, real *y, long long n) {
+  long long c;
+  for (c = 0; c < n; c++) y[c] += a * x[c];
+}
+
+__attribute__((optimize("fp-contract=off")))
+void DualAxpyScalar(real g, real *out, const real *in, real *neu1e, long long n) {
+  long long c;
+  for (c = 0; c < n; c++) {
+    neu1e[c] += g * out[c];
+    out[c] += g * in[c];
+  }
+}
+
+// Block kernels made of the vector kernels above, one pair of rows at
+// a time (used with the scalar and SSE kernels)
+void DotBlockGeneric(const real *x, long long nx, const real *y, long long ny, real *out, long long n) {
+  long long a, b;
+  for (a = 0; a < nx; a++) for (b = 0; b < ny; b++)
+    out[a * ny + b] = DotProduct(x + a * n, y + b * n, n);
+}
+
+void AxpyBlockGeneric(const real *g, long long gi, long long gj, const real *y, long long ny, real *out, long long nx, long long n) {
+  long long a, b;
+  for (a = 0; a < nx; a++) for (b = 0; b < ny; b++)
+    Axpy(g[a * gi + b * gj], y + b * n, out + a * n, n);
+}
+
+#ifdef X86_KERNELS
+// SSE kernels (four floats at a time)
+__attribute__((target("sse2")))
+real DotProductSSE(const real *x, const real *y, long long n) {
+  __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+  long long c = 0;
+  real f;
+  for (; c + 8 <= n; c += 8) {
+    s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(x + c), _mm_loadu_ps(y + c)));
+    s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(x + c + 4), _mm_loadu_ps(y + c + 4)));
+  }
+  for (; c + 4 <= n; c += 4)
+    s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(x + c), _mm_loadu_ps(y + c)));
+  s0 = _mm_add_ps(s0, s1);
+  s0 = _mm_add_ps(s0, _mm_movehl_ps(s0, s0));
+  s0 = _mm_add_ss(s0, _mm_shuffle_ps(s0, s0, 1));
+  f = _mm_cvtss_f32(s0);
+  for (; c < n; c++) f += x[c] * y[c];
+  return f;
+}
+
+__attribute__((target("sse2")))
+void AxpySSE(real a, const real *x, real *y, long long n) {
+  __m128 va = _mm_set1_ps(a);
+  long long c = 0;
+  for (; c + 4 <= n; c += 4)
+    _mm_storeu_ps(y + c, _mm_add_ps(_mm_loadu_ps(y + c), _mm_mul_ps(va, _mm_loadu_ps(x + c))));
+  for (; c < n; c++) y[c] += a * x[c];
+}
+
+__attribute__((target("sse2")))
+void DualAxpySSE(real g, real *out, const real *in, real *neu1e, long long n) {
+  __m128 vg = _mm_set1_ps(g), o;
+  long long c = 0;
+  for (; c + 4 <= n; c += 4) {
+    o = _mm_loadu_ps(out + c);
+    _mm_storeu_ps(neu1e + c, _mm_add_ps(_mm_loadu_ps(neu1e + c), _mm_mul_ps(vg, o)));
+    _mm_storeu_ps(out + c, _mm_add_ps(o, _mm_mul_ps(vg, _mm_loadu_ps(in + c))));
+  }
+  for (; c < n; c++) {
+    neu1e[c] += g * out[c];
+    out[c] += g * in[c];
+  }
+}
+
+// AVX2 kernels (eight floats at a time, with fused multiply-add)
+__attribute__((target("avx2,fma")))
+real DotProductAVX2(const real *x, const real *y, long long n) {
+  __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+  __m128 h;
+  long long c = 0;
+  real f;
+  for (; c + 16 <= n; c += 16) {
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + c), _mm256_loadu_ps(y + c), s0);
+    s1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + c + 8), _mm256_loadu_ps(y + c + 8), s1);
+  }
+  for (; c + 8 <= n; c += 8)
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + c), _mm256_loadu_ps(y + c), s0);
+  s0 = _mm256_add_ps(s0, s1);
+  h = _mm_add_ps(_mm256_castps256_ps128(s0), _mm256_extractf128_ps(s0, 1));
+  h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+  h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+  f = _mm_cvtss_f32(h);
+  for (; c < n; c++) f += x[c] * y[c];
+  return f;
+}
+
+__attribute__((target("avx2,fma")))
+void AxpyAVX2(real a, const real *x, real *y, long long n) {
+  __m256 va = _mm256_set1_ps(a);
+  long long c = 0;
+  for (; c + 8 <= n; c += 8)
+    _mm256_storeu_ps(y + c, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + c), _mm256_loadu_ps(y + c)));
+  for (; c < n; c++) y[c] += a * x[c];
+}
+
+__attribute__((target("avx2,fma")))
+void DualAxpyAVX2(real g, real *out, const real *in, real *neu1e, long long n) {
+  __m256 vg = _mm256_set1_ps(g), o;
+  long long c = 0;
+  for (; c + 8 <= n; c += 8) {
+    o = _mm256_loadu_ps(out + c);
+    _mm256_storeu_ps(neu1e + c, _mm256_fmadd_ps(vg, o, _mm256_loadu_ps(neu1e + c)));
+    _mm256_storeu_ps(out + c, _mm256_fmadd_ps(vg, _mm256_loadu_ps(in + c), o));
+  }
+  for (; c < n; c++) {
+    neu1e[c] += g * out[c];
+    out[c] += g * in[c];
+  }
+}
+
+static inline __attribute__((target("avx2,fma"))) real HorizontalSumAVX2(__m256 s) {
+  __m128 h = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+  h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+  h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+  return _mm_cvtss_f32(h);
+}
+
+// Dot products in tiles of four rows of `x` by two rows of `y`, so that
+// each loaded vector is used two or four times and the eight sums stay
+// in registers; the edges of the matrices are done one pair at a time
+__attribute__((target("avx2,fma")))
+void DotBlockAVX2(const real *x, long long nx, const real *y, long long ny, real *out, long long n) {
+  __m256 s[4][2], v0, v1, u;
+  long long a, b, c, d, e;
+  for (a = 0; a + 4 <= nx; a += 4) for (b = 0; b + 2 <= ny; b += 2) {
+    for (d = 0; d < 4; d++) s[d][0] = s[d][1] = _mm256_setzero_ps();
+    for (c = 0; c + 8 <= n; c += 8) {
+      v0 = _mm256_loadu_ps(y + b * n + c);
+      v1 = _mm256_loadu_ps(y + (b + 1) * n + c);
+      for (d = 0; d < 4; d++) {
+        u = _mm256_loadu_ps(x + (a + d) * n + c);
+        s[d][0] = _mm256_fmadd_ps(u, v0, s[d][0]);
+        s[d][1] = _mm256_fmadd_ps(u, v1, s[d][1]);
+      }
+    }
+    for (d = 0; d < 4; d++) for (e = 0; e < 2; e++) {
+      out[(a + d) * ny + b + e] = HorizontalSumAVX2(s[d][e]);
+      for (c = n & ~7LL; c < n; c++) out[(a + d) * ny + b + e] += x[(a + d) * n + c] * y[(b + e) * n + c];
+    }
+  }
+  for (a = 0; a < nx; a++) for (b = (a < (nx & ~3LL)) ? (ny & ~1LL) : 0; b < ny; b++)
+    out[a * ny + b] = DotProductAVX2(x + a * n, y + b * n, n);
+}
+
+// Row updates four rows of `out` at a time, keeping eight elements of
+// each in registers while the rows of `y` are added in
+__attribute__((target("avx2,fma")))
+void AxpyBlockAVX2(const real *g, long long gi, long long gj, const real *y, long long ny, real *out, long long nx, long long n) {
+  __m256 s[4], v;
+  long long a, b, c, d;
+  for (a = 0; a + 4 <= nx; a += 4) {
+    for (c = 0; c + 8 <= n; c += 8) {
+      for (d = 0; d < 4; d++) s[d] = _mm256_loadu_ps(out + (a + d) * n + c);
+      for (b = 0; b < ny; b++) {
+        v = _mm256_loadu_ps(y + b * n + c);
+        for (d = 0; d < 4; d++) s[d] = _mm256_fmadd_ps(_mm256_set1_ps(g[(a + d) * gi + b * gj]), v, s[d]);
+      }
+      for (d = 0; d < 4; d++) _mm256_storeu_ps(out + (a + d) * n + c, s[d]);
+    }
+    for (; c < n; c++) for (d = 0; d < 4; d++) for (b = 0; b < ny; b++)
+      out[(a + d) * n + c] += g[(a + d) * gi + b * gj] * y[b * n + c];
+  }
+  for (; a < nx; a++) for (b = 0; b < ny; b++)
+    AxpyAVX2(g[a * gi + b * gj], y + b * n, out + a * n, n);
+}
+
+// AVX-512 kernels (sixteen floats at a time; the remainder is handled
+// with masked loads and stores)
+__attribute__((target("avx512f")))
+real DotProductAVX512(const real *x, const real *y, long long n) {
+  __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+  __mmask16 m;
+  long long c = 0;
+  for (; c + 32 <= n; c += 32) {
+    s0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + c), _mm512_loadu_ps(y + c), s0);
+    s1 = _mm512_fmadd_ps(_mm512_loadu_ps(x + c + 16), _mm512_loadu_ps(y + c + 16), s1);
+  }
+  for (; c + 16 <= n; c += 16)
+    s0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + c), _mm512_loadu_ps(y + c), s0);
+  if (c < n) {
+    m = (__mmask16)((1 << (n - c)) - 1);
+    s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, x + c), _mm512_maskz_loadu_ps(m, y + c), s1);
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+}
+
+__attribute__((target("avx512f")))
+void AxpyAVX512(real a, const real *x, real *y, long long n) {
+  __m512 va = _mm512_set1_ps(a);
+  __mmask16 m;
+  long long c = 0;
+  for (; c + 16 <= n; c += 16)
+    _mm512_storeu_ps(y + c, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + c), _mm512_loadu_ps(y + c)));
+  if (c < n) {
+    m = (__mmask16)((1 << (n - c)) - 1);
+    _mm512_mask_storeu_ps(y + c, m, _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, x + c), _mm512_maskz_loadu_ps(m, y + c)));
+  }
+}
+
+__attribute__((target("avx512f")))
+void DualAxpyAVX512(real g, real *out, const real *in, real *neu1e, long long n) {
+  __m512 vg = _mm512_set1_ps(g), o;
+  __mmask16 m;
+  long long c = 0;
+  for (; c + 16 <= n; c += 16) {
+    o = _mm512_loadu_ps(out + c);
+    _mm512_storeu_ps(neu1e + c, _mm512_fmadd_ps(vg, o, _mm512_loadu_ps(neu1e + c)));
+    _mm512_storeu_ps(out + c, _mm512_fmadd_ps(vg, _mm512_loadu_ps(in + c), o));
+  }
+  if (c < n) {
+    m = (__mmask16)((1 << (n - c)) - 1);
+    o = _mm512_maskz_loadu_ps(m, out + c);
+    _mm512_mask_storeu_ps(neu1e + c, m, _mm512_fmadd_ps(vg, o, _mm512_maskz_loadu_ps(m, neu1e + c)));
+    _mm512_mask_storeu_ps(out + c, m, _mm512_fmadd_ps(vg, _mm512_maskz_loadu_ps(m, in + c), o));
+  }
+}
+
+// Dot products in tiles of four rows of `x` by four rows of `y` (sixteen
+// sums in registers); the last partial vector of each row is masked
+__attribute__((target("avx512f")))
+void DotBlockAVX512(const real *x, long long nx, const real *y, long long ny, real *out, long long n) {
+  __m512 s[4][4], v[4], u;
+  __mmask16 m;
+  long long a, b, c, d, e;
+  for (a = 0; a + 4 <= nx; a += 4) for (b = 0; b + 4 <= ny; b += 4) {
+    for (d = 0; d < 4; d++) for (e = 0; e < 4; e++) s[d][e] = _mm512_setzero_ps();
+    for (c = 0; c < n; c += 16) {
+      m = (n - c >= 16) ? (__mmask16)0xFFFF : (__mmask16)((1 << (n - c)) - 1);
+      for (e = 0; e < 4; e++) v[e] = _mm512_maskz_loadu_ps(m, y + (b + e) * n + c);
+      for (d = 0; d < 4; d++) {
+        u = _mm512_maskz_loadu_ps(m, x + (a + d) * n + c);
+        for (e = 0; e < 4; e++) s[d][e] = _mm512_fmadd_ps(u, v[e], s[d][e]);
+      }
+    }
+    for (d = 0; d < 4; d++) for (e = 0; e < 4; e++)
+      out[(a + d) * ny + b + e] = _mm512_reduce_add_ps(s[d][e]);
+  }
+  for (a = 0; a < nx; a++) for (b = (a < (nx & ~3LL)) ? (ny & ~3LL) : 0; b < ny; b++)
+    out[a * ny + b] = DotProductAVX512(x + a * n, y + b * n, n);
+}
+
+// Row updates four rows of `out` at a time, sixteen elements of each
+// kept in registers while the rows of `y` are added in
+__attribute__((target("avx512f")))
+void AxpyBlockAVX512(const real *g, long long gi, long long gj, const real *y, long long ny, real *out, long long nx, long long n) {
+  __m512 s[4], v;
+  __mmask16 m;
+  long long a, b, c, d;
+  for (a = 0; a + 4 <= nx; a += 4) for (c = 0; c < n; c += 16) {
+    m = (n - c >= 16) ? (__mmask16)0xFFFF : (__mmask16)((1 << (n - c)) - 1);
+    for (d = 0; d < 4; d++) s[d] = _mm512_maskz_loadu_ps(m, out + (a + d) * n + c);
+    for (b = 0; b < ny; b++) {
+      v = _mm512_maskz_loadu_ps(m, y + b * n + c);
+      for (d = 0; d < 4; d++) s[d] = _mm512_fmadd_ps(_mm512_set1_ps(g[(a + d) * gi + b * gj]), v, s[d]);
+    }
+    for (d = 0; d < 4; d++) _mm512_mask_storeu_ps(out + (a + d) * n + c, m, s[d]);
+  }
+  for (a = nx & ~3LL; a < nx; a++) for (b = 0; b < ny; b++)
+    AxpyAVX512(g[a * gi + b * gj], y + b * n, out + a * n, n);
+}
+#endif
+
+// Conversions between `real` and the 16-bit floating-point types.
+// bfloat16 is the upper half of a `real` (same exponent range, 8 bits of
+// precision); IEEE half precision (fp16) has 11 bits of precision but a
+// narrow exponent range (largest finite value 65504, subnormals below
+// 2^-14).
+static inline real BF16ToReal(unsigned short h) {
+  unsigned int u = (unsigned int)h << 16;
+  real x;
+  memcpy(&x, &u, sizeof(x));
+  return x;
+}
+
+static inline real FP16ToReal(unsigned short h) {
+  unsigned int sign = (unsigned int)(h & 0x8000) << 16, e = (h >> 10) & 0x1F, m = h & 0x3FF, u;
+  real x;
+  if (e == 0) {
+    // zero or subnormal
+    x = m * (1.0f / 16777216);
+    return sign ? -x : x;
+  }
+  if (e == 31) u = sign | 0x7F800000 | (m << 13);
+  else u = sign | ((e + 112) << 23) | (m << 13);
+  memcpy(&x, &u, sizeof(x));
+  return x;
+}
+
+static inline unsigned int RealBits(real x) {
+  unsigned int u;
+  memcpy(&u, &x, sizeof(u));
+  return u;
+}
+
+// Round the `real` with bit pattern `u` to bfloat16 or fp16: to nearest
+// (ties to even) if `nearest` is set, otherwise toward zero.  Infinities
+// and NaNs are kept.
+static inline unsigned short RealBitsToBF16(unsigned int u, int nearest) {
+  if ((u & 0x7F800000) == 0x7F800000 || !nearest) return u >> 16;
+  return (u + 0x7FFF + ((u >> 16) & 1)) >> 16;
+}
+
+static inline unsigned short RealBitsToFP16(unsigned int u, int nearest) {
+  unsigned int sign = (u >> 16) & 0x8000, m = u & 0x7FFFFFFF, e = m >> 23, k, h;
+  if (e == 255) return sign | 0x7C00 | (m & 0x7FFFFF ? 0x200 | ((m >> 13) & 0x3FF) : 0);
+  // (below 2^-25, everything rounds to zero)
+  if (e < 102) return sign;
+  if (e >= 113) {
+    // normal: rebias the exponent and drop 13 bits of the mantissa
+    m -= 112 << 23;
+    k = 13;
+  } else {
+    // subnormal: multiples of 2^-24
+    m = (m & 0x7FFFFF) | 0x800000;
+    k = 126 - e;
+  }
+  h = nearest ? (m + (1U << (k - 1)) - 1 + ((m >> k) & 1)) >> k : m >> k;
+  // overflow goes to infinity, or to the largest finite value
+  if (h >= 0x7C00) h = nearest ? 0x7C00 : 0x7BFF;
+  return sign | h;
+}
+
+// Mask of the bits of the `real` with bit pattern `u` that rounding to
+// bfloat16 or fp16 drops (0 for infinities and NaNs), for stochastic
+// rounding: adding a random number below the mask to `u`, then rounding
+// toward zero, rounds `u` up with probability equal to the fraction of
+// the way it is to the next representable value.  (fp16 values below
+// 2^-25 are always rounded to zero.)
+static inline unsigned int BF16RoundMask(unsigned int u) {
+  return ((u & 0x7F800000) == 0x7F800000) ? 0 : 0xFFFF;
+}
+
+static inline unsigned int FP16RoundMask(unsigned int u) {
+  int e = (u >> 23) & 0xFF, k = 126 - e;
+  if (e == 255) return 0;
+  if (k < 13) k = 13;
+  if (k > 24) k = 24;
+  return (1U << k) - 1;
+}
+
+// Return parameter `p` as a `real`, and `real` `x` rounded to nearest as
+// a parameter (the identity with `real` parameters)
+static inline real ParamToReal(param p) {
+#if PARAM_TYPE == PARAM_BF16
+  return BF16ToReal(p);
+#elif PARAM_TYPE == PARAM_FP16
+  return FP16ToReal(p);
+#else
+  return p;
+#endif
+}
+
+static inline param RealToParam(real x) {
+#if PARAM_TYPE == PARAM_BF16
+  return RealBitsToBF16(RealBits(x), 1);
+#elif PARAM_TYPE == PARAM_FP16
+  return RealBitsToFP16(RealBits(x), 1);
+#else
+  return x;
+#endif
+}
+
+// Return parameter `p` in the type of the half-precision output
+// (`HALF_OUTPUT_TYPE`), rounded to nearest
+static inline unsigned short ParamToHalf(param p) {
+#ifdef HALF_PARAMS
+  return p;
+#else
+  return RealBitsToFP16(RealBits(p), 1);
+#endif
+}
+
+#ifdef HALF_PARAMS
+// Row conversion kernels for 16-bit parameters, set by `InitKernels`:
+//
+//   ParamsToReals: `x`[c] = `p`[c] as a `real`
+//   RealsToParams: `p`[c] = `x`[c] rounded to nearest, or stochastically
+//     if `next_random` is not NULL (advancing it by one step)
+//
+// for c < `n`.  The random numbers of stochastic rounding come from eight
+// xorshift generators seeded from `next_random`, element c using
+// generator c % 8, so that all kernels round alike.
+void (*ParamsToReals)(const param *p, real *x, long long n);
+void (*RealsToParams)(const real *x, param *p, long long n, unsigned long long *next_random);
+
+static inline param RoundParamBits(unsigned int u, int nearest) {
+#if PARAM_TYPE == PARAM_BF16
+  return RealBitsToBF16(u, nearest);
+#else
+  return RealBitsToFP16(u, nearest);
+#endif
+}
+
+static inline unsigned int ParamRoundMask(unsigned int u) {
+#if PARAM_TYPE == PARAM_BF16
+  return BF16RoundMask(u);
+#else
+  return FP16RoundMask(u);
+#endif
+}
+
+// Seed the eight generators `s` of stochastic rounding from
+// `next_random`
+void SeedRoundLanes(unsigned int *s, unsigned long long *next_random) {
+  int l;
+  *next_random = *next_random * (unsigned long long)25214903917 + 11;
+  for (l = 0; l < 8; l++) s[l] = ((unsigned int)(*next_random >> 16) ^ (l * 0x9E3779B9U)) | 1;
+}
+
+// `RealsToParams` from element `c` (a multiple of eight) on, with
+// generators `s` (NULL to round to nearest); every generator steps at
+// the start of each group of eight elements
+void RealsToParamsFrom(const real *x, param *p, long long c, long long n, unsigned int *s) {
+  unsigned int u;
+  int l;
+  for (; c < n; c++) {
+    u = RealBits(x[c]);
+    if (s == NULL) p[c] = RoundParamBits(u, 1);
+    else {
+      if ((c & 7) == 0) for (l = 0; l < 8; l++) {
+        s[l] ^= s[l] << 13;
+        s[l] ^= s[l] >> 17;
+        s[l] ^= s[l] << 5;
+      }
+      p[c] = RoundParamBits(u + (s[c & 7] & ParamRoundMask(u)), 0);
+    }
+  }
+}
+
+void ParamsToRealsScalar(const param *p, real *x, long long n) {
+  long long c;
+  for (c = 0; c < n; c++) x[c] = ParamToReal(p[c]);
+}
+
+void RealsToParamsScalar(const real *x, param *p, long long n, unsigned long long *next_random) {
+  unsigned int s[8];
+  if (next_random != NULL) SeedRoundLanes(s, next_random);
+  RealsToParamsFrom(x, p, 0, n, next_random != NULL ? s : NULL);
+}
+
+#ifdef X86_KERNELS
+// AVX2 conversions, eight elements at a time (fp16 with the F16C
+// instructions, bfloat16 with integer shifts)
+__attribute__((target("avx2,f16c")))
+void ParamsToRealsAVX2(const param *p, real *x, long long n) {
+  long long c = 0;
+  for (; c + 8 <= n; c += 8) {
+#if PARAM_TYPE == PARAM_BF16
+    _mm256_storeu_ps(x + c, _mm256_castsi256_ps(_mm256_slli_epi32(
+     _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(p + c))), 16)));
+#else
+    _mm256_storeu_ps(x + c, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(p + c))));
+#endif
+  }
+  for (; c < n; c++) x[c] = ParamToReal(p[c]);
+}
+
+// Round the `real`s with bit patterns `u` as `RoundParamBits` does and
+// return the eight 16-bit results
+static inline __attribute__((target("avx2,f16c"))) __m128i RoundParamsAVX2(__m256i u, int nearest) {
+#if PARAM_TYPE == PARAM_BF16
+  __m256i special = _mm256_cmpeq_epi32(_mm256_and_si256(u, _mm256_set1_epi32(0x7F800000)), _mm256_set1_epi32(0x7F800000));
+  if (nearest) u = _mm256_add_epi32(u, _mm256_andnot_si256(special, _mm256_add_epi32(_mm256_set1_epi32(0x7FFF),
+   _mm256_and_si256(_mm256_srli_epi32(u, 16), _mm256_set1_epi32(1)))));
+  u = _mm256_srli_epi32(u, 16);
+  return _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi32(u, u), 0x08));
+#else
+  if (nearest) return _mm256_cvtps_ph(_mm256_castsi256_ps(u), _MM_FROUND_TO_NEAREST_INT);
+  return _mm256_cvtps_ph(_mm256_castsi256_ps(u), _MM_FROUND_TO_ZERO);
+#endif
+}
+
+// `ParamRoundMask` of eight `real`s with bit patterns `u`
+static inline __attribute__((target("avx2,f16c"))) __m256i ParamRoundMaskAVX2(__m256i u) {
+  __m256i e = _mm256_and_si256(_mm256_srli_epi32(u, 23), _mm256_set1_epi32(0xFF));
+#if PARAM_TYPE == PARAM_BF16
+  return _mm256_andnot_si256(_mm256_cmpeq_epi32(e, _mm256_set1_epi32(255)), _mm256_set1_epi32(0xFFFF));
+#else
+  __m256i k = _mm256_min_epi32(_mm256_max_epi32(_mm256_sub_epi32(_mm256_set1_epi32(126), e), _mm256_set1_epi32(13)),
+   _mm256_set1_epi32(24));
+  return _mm256_andnot_si256(_mm256_cmpeq_epi32(e, _mm256_set1_epi32(255)),
+   _mm256_sub_epi32(_mm256_sllv_epi32(_mm256_set1_epi32(1), k), _mm256_set1_epi32(1)));
+#endif
+}
+
+__attribute__((target("avx2,f16c")))
+void RealsToParamsAVX2(const real *x, param *p, long long n, unsigned long long *next_random) {
+  unsigned int s[8];
+  __m256i u, r = _mm256_setzero_si256();
+  long long c = 0;
+  if (next_random != NULL) {
+    SeedRoundLanes(s, next_random);
+    r = _mm256_loadu_si256((const __m256i *)s);
+  }
+  for (; c + 8 <= n; c += 8) {
+    u = _mm256_castps_si256(_mm256_loadu_ps(x + c));
+    if (next_random == NULL) _mm_storeu_si128((__m128i *)(p + c), RoundParamsAVX2(u, 1));
+    else {
+      r = _mm256_xor_si256(r, _mm256_slli_epi32(r, 13));
+      r = _mm256_xor_si256(r, _mm256_srli_epi32(r, 17));
+      r = _mm256_xor_si256(r, _mm256_slli_epi32(r, 5));
+      u = _mm256_add_epi32(u, _mm256_and_si256(r, ParamRoundMaskAVX2(u)));
+      _mm_storeu_si128((__m128i *)(p + c), RoundParamsAVX2(u, 0));
+    }
+  }
+  if (next_random != NULL) _mm256_storeu_si256((__m256i *)s, r);
+  RealsToParamsFrom(x, p, c, n, next_random != NULL ? s : NULL);
+}
+#endif
+#endif
+
+// Set vector kernels `DotProduct`, `Axpy`, and `DualAxpy` (and the block
+// kernels `DotBlock` and `AxpyBlock`) according to
+// `simd`: "scalar", "sse", "avx2", or "avx512", or "auto" for the
+// widest ones supported by the CPU we are running on.  Exit if the
+// requested kernels are unknown or not supported.
+void InitKernels() {
+  char *name = simd;
+  DotProduct = DotProductScalar;
+  Axpy = AxpyScalar;
+  DualAxpy = DualAxpyScalar;
+  DotBlock = DotBlockGeneric;
+  AxpyBlock = AxpyBlockGeneric;
+#ifdef HALF_PARAMS
+  ParamsToReals = ParamsToRealsScalar;
+  RealsToParams = RealsToParamsScalar;
+#endif
+#ifdef X86_KERNELS
+  __builtin_cpu_init();
+  if (!strcmp(name, "auto")) {
+    if (__builtin_cpu_supports("avx512f")) name = (char *)"avx512";
+    else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) name = (char *)"avx2";
+    else if (__builtin_cpu_supports("sse2")) name = (char *)"sse";
+    else name = (char *)"scalar";
+  }
+  if (!strcmp(name, "sse") && __builtin_cpu_supports("sse2")) {
+    DotProduct = DotProductSSE;
+    Axpy = AxpySSE;
+    DualAxpy = DualAxpySSE;
+  } else if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    DotProduct = DotProductAVX2;
+    Axpy = AxpyAVX2;
+    DualAxpy = DualAxpyAVX2;
+    DotBlock = DotBlockAVX2;
+    AxpyBlock = AxpyBlockAVX2;
+  } else if (!strcmp(name, "avx512") && __builtin_cpu_supports("avx512f")) {
+    DotProduct = DotProductAVX512;
+    Axpy = AxpyAVX512;
+    DualAxpy = DualAxpyAVX512;
+    DotBlock = DotBlockAVX512;
+    AxpyBlock = AxpyBlockAVX512;
+  } else if (strcmp(name, "scalar")) {
+    printf("ERROR: SIMD kernels %s are not supported\n", name);
+    exit(1);
+  }
+#ifdef HALF_PARAMS
+  // (AVX2 conversions are used with the AVX2 and AVX-512 kernels)
+  if (strcmp(name, "scalar") && strcmp(name, "sse") && __builtin_cpu_supports("avx2") &&
+   (PARAM_TYPE == PARAM_BF16 || __builtin_cpu_supports("f16c"))) {
+    ParamsToReals = ParamsToRealsAVX2;
+    RealsToParams = RealsToParamsAVX2;
+  }
+#endif
+#else
+  if (!strcmp(name, "auto")) name = (char *)"scalar";
+  if (strcmp(name, "scalar")) {
+    printf("ERROR: SIMD kernels %s are not supported\n", name);
+    exit(1);
+  }
+#endif
+  if (debug_mode > 0) printf("Using %s kernels, %s parameters\n", name, param_names[PARAM_TYPE]);
+}
+
+// Return the current time in seconds, from a monotonic clock (wall
+// time, unlike `clock()`, which adds up the CPU time of all threads).
+double GetTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
 // Allocate and populate negative-sampling data structure `table`, an
 // array of `table_size` words distributed approximately according to
@@ -217,6 +1385,95 @@ void InitUnigramTable() {
   }
 }
 
+// Allocate and populate `alias_table`, an alternative to `table` with
+// one entry per word in `vocab` representing the same (smoothed unigram)
+// distribution exactly, using Vose's alias method: scale the
+// probabilities so they average one, then repeatedly pair an entry whose
+// scaled probability is below one with an entry above one, which donates
+// the rest of the first entry's mass and becomes its alias.
+void InitAliasTable() {
+  long long a, n_small = 0, n_large = 0, s, l;
+  long long
+    *small = (long long *)malloc(vocab_size * sizeof(long long)),
+    *large = (long long *)malloc(vocab_size * sizeof(long long));
+  double train_words_pow = 0, power = 0.75;
+  double *p = (double *)malloc(vocab_size * sizeof(double));
+  alias_table = (struct alias_entry *)malloc(vocab_size * sizeof(struct alias_entry));
+  if (small == NULL || large == NULL || p == NULL || alias_table == NULL) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
+  for (a = 0; a < vocab_size; a++) {
+    p[a] = pow(vocab[a].cn, power);
+    train_words_pow += p[a];
+  }
+  for (a = 0; a < vocab_size; a++) {
+    p[a] = p[a] * vocab_size / train_words_pow;
+    if (p[a] < 1) small[n_small++] = a;
+    else large[n_large++] = a;
+  }
+  while (n_small > 0 && n_large > 0) {
+    s = small[--n_small];
+    l = large[--n_large];
+    alias_table[s].prob = (unsigned int)(p[s] * 4294967296.0);
+    alias_table[s].alias = l;
+    p[l] = (p[l] + p[s]) - 1;
+    if (p[l] < 1) small[n_small++] = l;
+    else large[n_large++] = l;
+  }
+  // whatever is left has (up to rounding error) probability one
+  while (n_large > 0) {
+    l = large[--n_large];
+    alias_table[l].prob = 0xFFFFFFFF;
+    alias_table[l].alias = l;
+  }
+  while (n_small > 0) {
+    s = small[--n_small];
+    alias_table[s].prob = 0xFFFFFFFF;
+    alias_table[s].alias = s;
+  }
+  free(small);
+  free(large);
+  free(p);
+}
+
+// Draw a negative sample (position of a word in `vocab`) from `table`,
+// or from `alias_table` if `alias` is set, advancing the thread's RNG
+// state `next_random`.  A draw of "</s>" (word 0) is replaced by a word
+// drawn uniformly from the rest of the vocabulary.
+static inline long long DrawNegative(unsigned long long *next_random) {
+  long long target;
+  *next_random = *next_random * (unsigned long long)25214903917 + 11;
+  if (alias) {
+    target = (*next_random >> 16) % vocab_size;
+    // second RNG step for the coin flip between the entry and its alias
+    *next_random = *next_random * (unsigned long long)25214903917 + 11;
+    if ((unsigned int)(*next_random >> 16) >= alias_table[target].prob) target = alias_table[target].alias;
+  } else if (stream) {
+    target = stream_table[(*next_random >> 16) % stream_table_filled];
+  } else {
+    target = table[(*next_random >> 16) % table_size];
+  }
+  if (target == 0) target = *next_random % (vocab_size - 1) + 1;
+  return target;
+}
+
+// Set `sampler_draw_time` to the average time taken by `DrawNegative`
+// over a chain of draws, each depending on the last (so that the
+// latencies of the memory accesses add up as they do in training).
+void MeasureNegativeSampler() {
+  long long a, draws = 2000000, target = 0;
+  unsigned long long next_random = 1;
+  double begin = GetTime();
+  for (a = 0; a < draws; a++) {
+    next_random += target;
+    target = DrawNegative(&next_random);
+  }
+  sampler_draw_time = (GetTime() - begin) / draws * 1e9;
+  // keep the chain from being optimized away
+  if (target < 0) printf("%lld\n", target);
+}
+
 // Read a single word from file `fin` into length `MAX_STRING` array
 // `word`, terminating with a null byte, treating space, tab, and
 // newline as word boundaries.  Ignore carriage returns.  If the first
@@ -255,94 +1512,300 @@ void ReadWord(char *word, FILE *fin, char *eof) {
   word[a] = 0;
 }
 
-// Return hash (integer between 0, inclusive, and `vocab_hash_size`,
-// exclusive) of `word`
-int GetWordHash(char *word) {
-  unsigned long long a, hash = 0;
-  for (a = 0; a < strlen(word); a++) hash = hash * 257 + word[a];
-  hash = hash % vocab_hash_size;
-  return hash;
+// Memory-map `train_file` into `train_data` and set `file_size` to its
+// size (in bytes).
+void MapTrainFile() {
+  struct stat st;
+  int fd = open(train_file, O_RDONLY);
+  if ((fd < 0) || fstat(fd, &st)) {
+    printf("ERROR: training data file not found!\n");
+    exit(1);
+  }
+  file_size = st.st_size;
+  if (file_size == 0) train_data = (char *)"";
+  else {
+    train_data = (char *)mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (train_data == MAP_FAILED) {
+      printf("ERROR: cannot map training data file %s\n", train_file);
+      exit(1);
+    }
+  }
+  close(fd);
 }
 
-// Return position of `word` in vocabulary `vocab` using `vocab_hash`,
-// a linear-probing hash table; if the word is not found, return -1.
-int SearchVocab(char *word) {
-  // compute initial hash
-  unsigned int hash = GetWordHash(word);
-  while (1) {
-    // return -1 if cell is empty
-    if (vocab_hash[hash] == -1) return -1;
-    // return position at current hash if word is a match
-    if (!strcmp(word, vocab[vocab_hash[hash]].word)) return vocab_hash[hash];
-    // no match, increment hash
-    hash = (hash + 1) % vocab_hash_size;
+// Return 1 if `ch` is a word boundary (space, tab, newline, or
+// carriage return), 0 otherwise.
+static inline int IsBoundary(char ch) {
+  return (ch == ' ') || (ch == '\t') || (ch == '\n') || (ch == '\r');
+}
+
+// Return position of the first word boundary in `train_data` at or
+// after `pos`, or `file_size` if there is none.  Compare 16 bytes at a
+// time when SSE2 is available.
+long long FindBoundary(long long pos) {
+#ifdef __SSE2__
+  const __m128i sp = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'),
+    nl = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+  __m128i x;
+  int mask;
+  while (pos + 16 <= file_size) {
+    x = _mm_loadu_si128((const __m128i *)(train_data + pos));
+    mask = _mm_movemask_epi8(_mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(x, sp), _mm_cmpeq_epi8(x, tab)),
+      _mm_or_si128(_mm_cmpeq_epi8(x, nl), _mm_cmpeq_epi8(x, cr))));
+    if (mask) return pos + __builtin_ctz(mask);
+    pos += 16;
   }
-  return -1;
+#endif
+  while ((pos < file_size) && !IsBoundary(train_data[pos])) pos++;
+  return pos;
 }
 
-// Read a word from file `fin` and return its position in vocabulary
-// `vocab`.  If the next thing in the file is a newline, return 0 (the
-// index of "</s>").  If the word is not in the vocabulary, return -1.
-// If the end of file is reached, set `eof` to 1 and return -1.  TODO:
-// if the file is not newline-terminated, the last word will be
-// swallowed (-1 will be returned because we have reached EOF, even if
-// a word was read).
-int ReadWordIndex(FILE *fin, char *eof) {
-  char word[MAX_STRING], eof_l = 0;
-  ReadWord(word, fin, &eof_l);
-  if (eof_l) {
-    *eof = 1;
+// Find the next word in memory-mapped training data `train_data`,
+// starting at byte `*pos`, and advance `*pos` to the boundary just
+// after it.  The word is not copied: set `*word` to point at it in
+// `train_data` (it is not null-terminated) and return its length.
+// This follows `ReadWord`: if a newline comes before any word, consume
+// it, set `*word` to "</s>", and return 4; words are truncated to
+// `MAX_STRING` - 2 characters.  Unlike `ReadWord`, a carriage return
+// is a word boundary, and the last word of a file that is not
+// newline-terminated is not swallowed.  If the end of the data is
+// reached before any word, return -1.
+int ReadToken(long long *pos, char **word) {
+  long long a = *pos, b;
+  char ch;
+  // skip boundaries before word
+  while (a < file_size) {
+    ch = train_data[a];
+    if (ch == '\n') {
+      *pos = a + 1;
+      *word = (char *)"</s>";
+      return 4;
+    }
+    if (!IsBoundary(ch)) break;
+    a++;
+  }
+  if (a >= file_size) {
+    *pos = a;
     return -1;
   }
-  return SearchVocab(word);
+  b = FindBoundary(a + 1);
+  *pos = b;
+  *word = train_data + a;
+  if (b - a > MAX_STRING - 2) return MAX_STRING - 2;  // Truncate too-long words
+  return b - a;
 }
 
-// Add word `word` to first empty slot in vocabulary `vocab`, increment
-// vocabulary length `vocab_size`, increase `vocab_max_size` by
-// increments of 1000 (increasing `vocab` allocation) as needed, and set
-// position of that slot in vocabulary hash table `vocab_hash`.
-// Return index of `word` in `vocab`.
-int AddWordToVocab(char *word) {
-  unsigned int hash, length = strlen(word) + 1;
-  if (length > MAX_STRING) length = MAX_STRING;
-  // add word to `vocab` and increment `vocab_size`
-  vocab[vocab_size].word = (char *)calloc(length, sizeof(char));
-  // TODO: this may blow up if strlen(word) + 1 > MAX_STRING
-  strcpy(vocab[vocab_size].word, word);
-  vocab[vocab_size].cn = 0;
-  vocab_size++;
-  // Reallocate memory if needed
-  if (vocab_size + 2 >= vocab_max_size) {
-    vocab_max_size += 1000;
-    vocab = (struct vocab_word *)realloc(vocab, vocab_max_size * sizeof(struct vocab_word));
+// Return 64-bit (FNV-1a) hash of the `len` characters at `word`
+unsigned long long GetWordHash(char *word, int len) {
+  unsigned long long hash = 14695981039346656037ULL;
+  int a;
+  for (a = 0; a < len; a++) hash = (hash ^ (unsigned char)word[a]) * 1099511628211ULL;
+  return hash;
+}
+
+// Return position of the `len` characters at `word` (which need not be
+// null-terminated) in vocabulary `vocab` using `vocab_hash`, a
+// linear-probing hash table; if the word is not found, return -1.
+int SearchVocab(char *word, int len) {
+  unsigned long long hash = GetWordHash(word, len),
+    mask = vocab_hash_size - 1,
+    slot = hash & mask;
+  // probe until an empty slot is found, comparing words only if their
+  // hashes and lengths match
+  while (vocab_hash[slot].index != -1) {
+    if ((vocab_hash[slot].hash == hash) && (vocab_hash[slot].len == len) &&
+        !memcmp(word, vocab[vocab_hash[slot].index].word, len))
+      return vocab_hash[slot].index;
+    slot = (slot + 1) & mask;
   }
-  // add word vocabulary position to `vocab_hash`
-  hash = GetWordHash(word);
-  while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-  vocab_hash[hash] = vocab_size - 1;
-  return vocab_size - 1;
+  return -1;
 }
 
-// Given pointers `a` and `b` to `vocab_word` structs, return 1 if the
-// stored count `cn` of b is greater than that of a, -1 if less than,
-// and 0 if equal.  (Comparator for a reverse sort by word count.)
-int VocabCompare(const void *a, const void *b) {
-  long long l = ((struct vocab_word *)b)->cn - ((struct vocab_word *)a)->cn;
-  if (l > 0) return 1;
-  if (l < 0) return -1;
-  return 0;
+// Free all blocks of vocabulary word storage `arena`.
+void FreeArena(struct vocab_arena_block *arena) {
+  struct vocab_arena_block *next;
+  while (arena != NULL) {
+    next = arena->next;
+    free(arena);
+    arena = next;
+  }
 }
 
-// Sort vocabulary `vocab` by word count, decreasing, while removing
+// Copy the `len` characters at `word` into `vocab_arena` (allocating a
+// new block if needed), null-terminate them, and return the copy.
+char *ArenaCopyWord(char *word, int len) {
+  struct vocab_arena_block *block = vocab_arena;
+  char *copy;
+  if ((block == NULL) || (block->used + len + 1 > block->size)) {
+    block = (struct vocab_arena_block *)malloc(sizeof(struct vocab_arena_block) + vocab_arena_block_size);
+    if (block == NULL) {
+      printf("Memory allocation failed\n");
+      exit(1);
+    }
+    block->size = vocab_arena_block_size;
+    block->used = 0;
+    block->next = vocab_arena;
+    vocab_arena = block;
+  }
+  copy = block->data + block->used;
+  memcpy(copy, word, len);
+  copy[len] = 0;
+  block->used += len + 1;
+  return copy;
+}
+
+// Insert position `index` of a word with hash `hash` and length `len`
+// into `vocab_hash` (which must not already contain the word and must
+// have an empty slot).
+void InsertVocabHash(unsigned long long hash, int len, int index) {
+  unsigned long long mask = vocab_hash_size - 1, slot = hash & mask;
+  while (vocab_hash[slot].index != -1) slot = (slot + 1) & mask;
+  vocab_hash[slot].hash = hash;
+  vocab_hash[slot].len = len;
+  vocab_hash[slot].index = index;
+}
+
+// Remove position `index` of a word from `vocab_hash` (backward-shift
+// deletion: later entries of the same run of occupied slots are moved
+// back into the hole when that does not put them before their home slot,
+// so probes never stop early and no tombstones are needed).
+void RemoveVocabHash(int index) {
+  unsigned long long mask = vocab_hash_size - 1, hole, slot, home;
+  hole = GetWordHash(vocab[index].word, strlen(vocab[index].word)) & mask;
+  while (vocab_hash[hole].index != index) hole = (hole + 1) & mask;
+  slot = hole;
+  while (1) {
+    slot = (slot + 1) & mask;
+    if (vocab_hash[slot].index == -1) break;
+    home = vocab_hash[slot].hash & mask;
+    if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+      vocab_hash[hole] = vocab_hash[slot];
+      hole = slot;
+    }
+  }
+  vocab_hash[hole].index = -1;
+}
+
+// Reallocate `vocab_hash` with `size` (a power of two) empty slots.
+void ClearVocabHash(long long size) {
+  long long a;
+  free(vocab_hash);
+  vocab_hash_size = size;
+  vocab_hash = (struct vocab_hash_slot *)malloc(vocab_hash_size * sizeof(struct vocab_hash_slot));
+  if (vocab_hash == NULL) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
+  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a].index = -1;
+}
+
+// Double the number of slots in `vocab_hash`, re-inserting the
+// (stored) hashes of the words in it.
+void GrowVocabHash() {
+  long long a, size = vocab_hash_size;
+  struct vocab_hash_slot *old = vocab_hash;
+  vocab_hash = NULL;
+  ClearVocabHash(size * 2);
+  for (a = 0; a < size; a++) if (old[a].index != -1)
+    InsertVocabHash(old[a].hash, old[a].len, old[a].index);
+  free(old);
+}
+
+// Empty vocabulary `vocab`, freeing word storage `vocab_arena` and
+// shrinking `vocab_hash` to its initial size.
+void ResetVocab() {
+  FreeArena(vocab_arena);
+  vocab_arena = NULL;
+  ClearVocabHash(vocab_hash_init_size);
+  vocab_size = 0;
+}
+
+// Rebuild `vocab_hash` from the first `vocab_size` words in `vocab`
+// (after words have been removed or re-ordered), sizing it to the
+// vocabulary, and copy those words into a fresh `vocab_arena` so that
+// the storage of removed words is released.
+void RebuildVocab() {
+  long long a, size = vocab_hash_init_size;
+  int len;
+  struct vocab_arena_block *old = vocab_arena;
+  while (vocab_size > size * 0.7) size *= 2;
+  ClearVocabHash(size);
+  vocab_arena = NULL;
+  for (a = 0; a < vocab_size; a++) {
+    len = strlen(vocab[a].word);
+    vocab[a].word = ArenaCopyWord(vocab[a].word, len);
+    InsertVocabHash(GetWordHash(vocab[a].word, len), len, a);
+  }
+  FreeArena(old);
+}
+
+// Read a word from memory-mapped training data `train_data` at byte
+// `*pos` (see `ReadToken`) and return its position in vocabulary
+// `vocab`.  If the next thing in the data is a newline, return 0 (the
+// index of "</s>").  If the word is not in the vocabulary, return -1.
+// If the end of the data is reached, set `eof` to 1 and return -1.
+int ReadWordIndex(long long *pos, char *eof) {
+  char *word;
+  int len = ReadToken(pos, &word);
+  if (len < 0) {
+    *eof = 1;
+    return -1;
+  }
+  return SearchVocab(word, len);
+}
+
+// Return the word index at position `*pos` in the memory-mapped encoded
+// training data `encoded_ids` and advance `*pos`.  If the end of the
+// data is reached, set `eof` to 1 and return -1.
+int ReadEncodedWordIndex(long long *pos, char *eof) {
+  if (*pos >= encoded_tokens) {
+    *eof = 1;
+    return -1;
+  }
+  return encoded_ids[(*pos)++];
+}
+
+// Add the `len` characters at `word` to first empty slot in vocabulary
+// `vocab` (copying them into `vocab_arena`), increment vocabulary
+// length `vocab_size`, increase `vocab_max_size` by increments of 1000
+// (increasing `vocab` allocation) as needed, and set position of that
+// slot in vocabulary hash table `vocab_hash` (growing it as needed).
+// Return index of `word` in `vocab`.
+int AddWordToVocab(char *word, int len) {
+  if (len > MAX_STRING - 1) len = MAX_STRING - 1;
+  // add word to `vocab` and increment `vocab_size`
+  vocab[vocab_size].word = ArenaCopyWord(word, len);
+  vocab[vocab_size].cn = 0;
+  vocab_size++;
+  // Reallocate memory if needed
+  if (vocab_size + 2 >= vocab_max_size) {
+    vocab_max_size += 1000;
+    vocab = (struct vocab_word *)realloc(vocab, vocab_max_size * sizeof(struct vocab_word));
+  }
+  // add word vocabulary position to `vocab_hash`
+  if (vocab_size > vocab_hash_size * 0.7) GrowVocabHash();
+  InsertVocabHash(GetWordHash(word, len), len, vocab_size - 1);
+  return vocab_size - 1;
+}
+
+// Given pointers `a` and `b` to `vocab_word` structs, return 1 if the
+// stored count `cn` of b is greater than that of a, -1 if less than,
+// and 0 if equal.  (Comparator for a reverse sort by word count.)
+int VocabCompare(const void *a, const void *b) {
+  long long l = ((struct vocab_word *)b)->cn - ((struct vocab_word *)a)->cn;
+  if (l > 0) return 1;
+  if (l < 0) return -1;
+  return 0;
+}
+
+// Sort vocabulary `vocab` by word count, decreasing, while removing
 // words that have count less than `min_count`; re-compute `vocab_hash`
 // accordingly; shrink vocab memory allocation to minimal size.
 void SortVocab() {
   int a, size;
-  unsigned int hash;
   // Sort the vocabulary but keep "</s>" at the first position
   qsort(&vocab[1], vocab_size - 1, sizeof(struct vocab_word), VocabCompare);
-  // clear `vocab_hash` cells
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
   // save initial `vocab_size` (we will decrease `vocab_size` as we
   // prune infrequent words)
   size = vocab_size;
@@ -350,17 +1813,16 @@ void SortVocab() {
   train_words = 0;
   for (a = 0; a < size; a++) {
     if ((vocab[a].cn < min_count) && (a != 0)) {
-      // word is infrequent and not "</s>", discard it
+      // word is infrequent and not "</s>", discard it (infrequent
+      // words are all at the end after sorting)
       vocab_size--;
-      free(vocab[a].word);
     } else {
-      // word is frequent or "</s>", add to hash table
-      hash=GetWordHash(vocab[a].word);
-      while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-      vocab_hash[hash] = a;
+      // word is frequent or "</s>", keep it
       train_words += vocab[a].cn;
     }
   }
+  // re-compute hash table for remaining words
+  RebuildVocab();
   // shrink vocab memory allocation to minimal size
   // TODO: to be safe we should probably update vocab_max_size which
   // seems to be interpreted as the allocation size
@@ -373,40 +1835,33 @@ void SortVocab() {
 }
 
 // Reduce vocabulary `vocab` size by removing words with count equal to
-// `min_reduce` or less, in order to make room in hash table (not for
+// `min_reduce` or less, in order to bound memory use (not for
 // mitigating data sparsity).  Increment `min_reduce` by one, so that
 // this function can be called in a loop until there is enough space.
 void ReduceVocab() {
   int a, b = 0;
-  unsigned int hash;
   for (a = 0; a < vocab_size; a++) if (vocab[a].cn > min_reduce) {
     vocab[b].cn = vocab[a].cn;
     vocab[b].word = vocab[a].word;
     b++;
-  } else free(vocab[a].word);
+  }
   vocab_size = b;
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
   // recompute `vocab_hash` as we have removed some items and it may
   // now be broken
-  for (a = 0; a < vocab_size; a++) {
-    hash = GetWordHash(vocab[a].word);
-    while (vocab_hash[hash] != -1) hash = (hash + 1) % vocab_hash_size;
-    vocab_hash[hash] = a;
-  }
+  RebuildVocab();
   fflush(stdout);
   min_reduce++;
 }
 
-// Create binary Huffman tree from word counts in `vocab`, storing
-// codes in `vocab`; frequent words will have short uniqe binary codes.
-// Used by hierarchical softmax.
-void CreateBinaryTree() {
-  long long a, b, i, min1i, min2i, pos1, pos2, point[MAX_CODE_LENGTH];
-  char code[MAX_CODE_LENGTH];
+// Build the binary Huffman tree of `vocab_size` words with counts `cn`
+// (sorted in decreasing order): for each node (words first, then inner
+// nodes, the root last), its parent in `parent_node` and in `binary`
+// whether it is its parent's second child.  Both have room for
+// vocab_size * 2 + 1 nodes.
+void BuildHuffmanTree(long long *cn, long long *binary, long long *parent_node) {
+  long long a, min1i, min2i, pos1, pos2;
   long long *count = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
-  long long *binary = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
-  long long *parent_node = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
-  for (a = 0; a < vocab_size; a++) count[a] = vocab[a].cn;
+  for (a = 0; a < vocab_size; a++) count[a] = cn[a];
   for (a = vocab_size; a < vocab_size * 2; a++) count[a] = 1e15;
   pos1 = vocab_size - 1;
   pos2 = vocab_size;
@@ -442,6 +1897,20 @@ void CreateBinaryTree() {
     parent_node[min2i] = vocab_size + a;
     binary[min2i] = 1;
   }
+  free(count);
+}
+
+// Create binary Huffman tree from word counts in `vocab`, storing
+// codes in `vocab`; frequent words will have short uniqe binary codes.
+// Used by hierarchical softmax.
+void CreateBinaryTree() {
+  long long a, b, i, point[MAX_CODE_LENGTH];
+  char code[MAX_CODE_LENGTH];
+  long long *cn = (long long *)malloc(vocab_size * sizeof(long long));
+  long long *binary = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
+  long long *parent_node = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
+  for (a = 0; a < vocab_size; a++) cn[a] = vocab[a].cn;
+  BuildHuffmanTree(cn, binary, parent_node);
   // Now assign binary code to each vocabulary word
   for (a = 0; a < vocab_size; a++) {
     b = a;
@@ -453,156 +1922,2165 @@ void CreateBinaryTree() {
       b = parent_node[b];
       if (b == vocab_size * 2 - 2) break;
     }
-    vocab[a].codelen = i;
-    vocab[a].point[0] = vocab_size - 2;
-    for (b = 0; b < i; b++) {
-      vocab[a].code[i - b - 1] = code[b];
-      vocab[a].point[i - b] = point[b] - vocab_size;
+    vocab[a].codelen = i;
+    vocab[a].point[0] = vocab_size - 2;
+    for (b = 0; b < i; b++) {
+      vocab[a].code[i - b - 1] = code[b];
+      vocab[a].point[i - b] = point[b] - vocab_size;
+    }
+  }
+  free(cn);
+  free(binary);
+  free(parent_node);
+}
+
+// Word counts for one sentence-aligned byte range of `train_data`,
+// gathered by `LearnVocabThread`.  Words are kept in order of first
+// occurrence and point into `train_data` (they are not copied).
+struct vocab_shard {
+  long long
+    begin, end,                // byte range of `train_data` to count
+    size,                      // number of distinct words
+    words,                     // number of word tokens
+    capacity,                  // capacity of `word`, `len`, `cn`
+    hash_size;                 // number of `hash` slots (a power of
+                               //   two)
+  char **word;                 // words, in order of first occurrence
+  int *len;                    // word lengths
+  long long *cn;               // word counts
+  struct vocab_hash_slot
+    *hash;                     // hash table of positions in `word`
+                               //   (like `vocab_hash`)
+  char overflow;               // 1 if `size` exceeded the vocabulary
+                               //   pruning threshold (see
+                               //   `LearnVocabParallel`)
+};
+
+// Return slot in `shard->hash` at which the `len` characters at `word`,
+// with hash `hash`, are stored, or the empty slot at which they should
+// be.
+long long ShardSlot(struct vocab_shard *shard, char *word, int len, unsigned long long hash) {
+  unsigned long long mask = shard->hash_size - 1, slot = hash & mask;
+  while (shard->hash[slot].index != -1) {
+    if ((shard->hash[slot].hash == hash) && (shard->hash[slot].len == len) &&
+        !memcmp(shard->word[shard->hash[slot].index], word, len)) break;
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+// Count words in byte range [`begin`, `end`) of `train_data` into the
+// `vocab_shard` pointed to by `arg`.  Give up (setting `overflow`) if
+// the number of distinct words exceeds the pruning threshold.
+void *LearnVocabThread(void *arg) {
+  struct vocab_shard *shard = (struct vocab_shard *)arg;
+  long long a, slot, pos = shard->begin, wc = 0, total;
+  unsigned long long hash;
+  struct vocab_hash_slot *old;
+  char *word;
+  int len;
+  shard->capacity = vocab_hash_init_size / 2;
+  shard->hash_size = vocab_hash_init_size;
+  shard->word = (char **)malloc(shard->capacity * sizeof(char *));
+  shard->len = (int *)malloc(shard->capacity * sizeof(int));
+  shard->cn = (long long *)malloc(shard->capacity * sizeof(long long));
+  shard->hash = (struct vocab_hash_slot *)malloc(shard->hash_size * sizeof(struct vocab_hash_slot));
+  for (a = 0; a < shard->hash_size; a++) shard->hash[a].index = -1;
+  while (pos < shard->end) {
+    len = ReadToken(&pos, &word);
+    if (len < 0) break;
+    wc++;
+    shard->words++;
+    if (wc >= 1000000) {
+      total = __sync_add_and_fetch(&train_words, wc);
+      if ((debug_mode > 1) && (shard->begin == 0)) {
+        printf("%lldM%c", total / 1000000, 13);
+        fflush(stdout);
+      }
+      wc = 0;
+    }
+    hash = GetWordHash(word, len);
+    slot = ShardSlot(shard, word, len, hash);
+    if (shard->hash[slot].index != -1) {
+      shard->cn[shard->hash[slot].index]++;
+      continue;
+    }
+    // new word
+    if (shard->size + 1 > vocab_reduce_size) {
+      shard->overflow = 1;
+      break;
+    }
+    if (shard->size >= shard->capacity) {
+      shard->capacity *= 2;
+      shard->word = (char **)realloc(shard->word, shard->capacity * sizeof(char *));
+      shard->len = (int *)realloc(shard->len, shard->capacity * sizeof(int));
+      shard->cn = (long long *)realloc(shard->cn, shard->capacity * sizeof(long long));
+    }
+    shard->word[shard->size] = word;
+    shard->len[shard->size] = len;
+    shard->cn[shard->size] = 1;
+    shard->hash[slot].hash = hash;
+    shard->hash[slot].len = len;
+    shard->hash[slot].index = shard->size;
+    shard->size++;
+    // keep hash table at most half full
+    if (shard->size * 2 > shard->hash_size) {
+      old = shard->hash;
+      shard->hash_size *= 2;
+      shard->hash = (struct vocab_hash_slot *)malloc(shard->hash_size * sizeof(struct vocab_hash_slot));
+      for (a = 0; a < shard->hash_size; a++) shard->hash[a].index = -1;
+      for (a = 0; a < shard->hash_size / 2; a++) if (old[a].index != -1) {
+        slot = old[a].hash & (shard->hash_size - 1);
+        while (shard->hash[slot].index != -1) slot = (slot + 1) & (shard->hash_size - 1);
+        shard->hash[slot] = old[a];
+      }
+      free(old);
+    }
+  }
+  __sync_add_and_fetch(&train_words, wc);
+  pthread_exit(NULL);
+}
+
+// Count words in `train_data` using `num_threads` threads, each over a
+// byte range that starts at the beginning of a line, then merge the
+// per-thread counts into vocabulary `vocab` (which must contain only
+// "</s>") in order of first occurrence in the file.  The result is the
+// same as counting serially up to the point where `ReduceVocab` would
+// be called, so shards are merged only up to the first one that would
+// make the vocabulary that large (or that did alone), leaving `vocab`
+// and `train_words` as the serial pass would have them at its start.
+// Return that position in `train_data` (`file_size` if all shards were
+// merged) for the caller to go on counting serially from, pruning as
+// it always does, so that the result is the same as counting serially.
+long long LearnVocabParallel() {
+  long long a, b, i, n, pos = file_size;
+  struct vocab_shard *shards = (struct vocab_shard *)calloc(num_threads, sizeof(struct vocab_shard));
+  pthread_t *pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+  // split file into byte ranges, moving each split point past the next
+  // newline so that no sentence is split
+  for (a = 0; a < num_threads; a++) {
+    if (a == 0) shards[a].begin = 0;
+    else {
+      b = file_size / num_threads * a;
+      if (b < shards[a - 1].begin) b = shards[a - 1].begin;
+      while ((b > 0) && (b < file_size) && (train_data[b - 1] != '\n')) b++;
+      shards[a].begin = b;
+    }
+    if (a > 0) shards[a - 1].end = shards[a].begin;
+  }
+  shards[num_threads - 1].end = file_size;
+  for (a = 0; a < num_threads; a++) pthread_create(&pt[a], NULL, LearnVocabThread, (void *)&shards[a]);
+  for (a = 0; a < num_threads; a++) pthread_join(pt[a], NULL);
+  // merge shards in file order
+  train_words = 0;
+  for (a = 0; a < num_threads; a++) {
+    for (b = 0, n = 0; !shards[a].overflow && b < shards[a].size; b++)
+      if (SearchVocab(shards[a].word[b], shards[a].len[b]) == -1) n++;
+    if (shards[a].overflow || vocab_size + n > vocab_reduce_size) {
+      pos = shards[a].begin;
+      break;
+    }
+    for (b = 0; b < shards[a].size; b++) {
+      i = SearchVocab(shards[a].word[b], shards[a].len[b]);
+      if (i == -1) i = AddWordToVocab(shards[a].word[b], shards[a].len[b]);
+      vocab[i].cn += shards[a].cn[b];
+    }
+    train_words += shards[a].words;
+  }
+  for (a = 0; a < num_threads; a++) {
+    free(shards[a].word);
+    free(shards[a].len);
+    free(shards[a].cn);
+    free(shards[a].hash);
+  }
+  free(shards);
+  free(pt);
+  if (pos < file_size && debug_mode > 0)
+    printf("Vocabulary too large to count in parallel, counting serially from byte %lld\n", pos);
+  return pos;
+}
+
+// Read the header of model file `init_model_file` (written by
+// `SaveModel`, or a checkpoint) into `h`, exiting if it is not a model
+// file or has a different `layer1_size`; return the file.
+FILE *OpenModel(struct checkpoint_header *h) {
+  FILE *fin = fopen(init_model_file, "rb");
+  if (fin == NULL) {
+    printf("ERROR: model file %s not found\n", init_model_file);
+    exit(1);
+  }
+  if (fread(h, sizeof(*h), 1, fin) != 1 || memcmp(h->magic, CHECKPOINT_MAGIC, sizeof(h->magic)) ||
+   h->precision < PARAM_REAL || h->precision > PARAM_FP16) {
+    printf("ERROR: %s is not a model file\n", init_model_file);
+    exit(1);
+  }
+  if (h->layer1_size != layer1_size) {
+    printf("ERROR: model in %s has vectors of size %lld\n", init_model_file, h->layer1_size);
+    exit(1);
+  }
+  return fin;
+}
+
+// Add the word counts of the model in `init_model_file` to `vocab`
+// (just counted from the new training data, and not yet sorted or
+// pruned), adding its words that do not occur in the new data.  The
+// words and counts are kept in `model_words` and `model_cn` to map the
+// model's parameters to the new vocabulary (see `ReadModelNet`).
+void MergeModelVocab() {
+  struct checkpoint_header h;
+  long long a, i;
+  int len;
+  char word[MAX_STRING];
+  FILE *fin = OpenModel(&h);
+  model_vocab_size = h.vocab_size;
+  model_words = (char **)malloc(model_vocab_size * sizeof(char *));
+  model_cn = (long long *)malloc(model_vocab_size * sizeof(long long));
+  for (a = 0; a < model_vocab_size; a++) {
+    if (fread(&model_cn[a], sizeof(long long), 1, fin) != 1 || fread(&len, sizeof(int), 1, fin) != 1 ||
+     len < 0 || len >= MAX_STRING || fread(word, 1, len, fin) != len) {
+      printf("ERROR: model file %s is truncated\n", init_model_file);
+      exit(1);
+    }
+    word[len] = 0;
+    model_words[a] = (char *)malloc(len + 1);
+    memcpy(model_words[a], word, len + 1);
+    i = SearchVocab(word, len);
+    if (i == -1) i = AddWordToVocab(word, len);
+    vocab[i].cn += model_cn[a];
+    if (vocab_size > vocab_reduce_size) ReduceVocab();
+  }
+  fclose(fin);
+}
+
+// Compute vocabulary `vocab` and corresponding hash table `vocab_hash`
+// from text in memory-mapped `train_data`.  Insert </s> as vocab item
+// 0.  Prune vocab incrementally (as needed to keep number of items
+// below effective hash table capacity).  After reading file, sort
+// vocabulary by word count, decreasing.  Count in parallel if using
+// multiple threads (see `LearnVocabParallel`).
+void LearnVocabFromTrainFile() {
+  char *word;
+  long long a, i, wc = 0, pos = 0;
+  int len;
+  ResetVocab();
+  AddWordToVocab((char *)"</s>", 4);
+  if (num_threads > 1) pos = LearnVocabParallel();
+  while (1) {
+    len = ReadToken(&pos, &word);
+    if (len < 0) break;
+    train_words++;
+    wc++;
+    if ((debug_mode > 1) && (wc >= 1000000)) {
+      printf("%lldM%c", train_words / 1000000, 13);
+      fflush(stdout);
+      wc = 0;
+    }
+    i = SearchVocab(word, len);
+    if (i == -1) {
+      a = AddWordToVocab(word, len);
+      vocab[a].cn = 1;
+    } else vocab[i].cn++;
+    if (vocab_size > vocab_reduce_size) ReduceVocab();
+  }
+  if (init_model_file[0] != 0) MergeModelVocab();
+  SortVocab();
+  if (debug_mode > 0) {
+    printf("Vocab size: %lld\n", vocab_size);
+    printf("Words in train file: %lld\n", train_words);
+  }
+}
+
+// Write vocabulary `vocab` to file `save_vocab_file`, one word per
+// line, with each line containing a word, a space, the word count, and
+// a newline.
+void SaveVocab() {
+  long long i;
+  FILE *fo = fopen(save_vocab_file, "wb");
+  for (i = 0; i < vocab_size; i++) fprintf(fo, "%s %lld\n", vocab[i].word, vocab[i].cn);
+  fclose(fo);
+}
+
+// Read vocabulary from file `read_vocab_file` that has one word per
+// line, where each line contains a word, a space, the word count, and a
+// newline.  Store vocabulary in `vocab` and update `vocab_hash`
+// accordingly.  After reading, sort vocabulary by word count,
+// decreasing.  (The vocabulary file is small, so it is read with
+// `ReadWord` rather than memory-mapped.)
+void ReadVocab() {
+  long long a, i = 0;
+  char c, eof = 0;
+  char word[MAX_STRING];
+  FILE *fin = fopen(read_vocab_file, "rb");
+  if (fin == NULL) {
+    printf("Vocabulary file not found\n");
+    exit(1);
+  }
+  ResetVocab();
+  while (1) {
+    // TODO: if file is not newline-terminated, last word may be
+    // swallowed
+    ReadWord(word, fin, &eof);
+    if (eof) break;
+    a = AddWordToVocab(word, strlen(word));
+    fscanf(fin, "%lld%c", &vocab[a].cn, &c);
+    i++;
+  }
+  if (init_model_file[0] != 0) MergeModelVocab();
+  SortVocab();
+  if (debug_mode > 0) {
+    printf("Vocab size: %lld\n", vocab_size);
+    printf("Words in train file: %lld\n", train_words);
+  }
+}
+
+// Return a checksum of the words in vocabulary `vocab`, in order (the
+// word counts do not matter); used to check that an encoded training
+// data file matches the vocabulary.
+unsigned long long VocabChecksum() {
+  long long a;
+  unsigned long long hash = 14695981039346656037ULL;
+  char *c;
+  for (a = 0; a < vocab_size; a++) {
+    for (c = vocab[a].word; *c; c++) hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    // separate words (as if by a null byte)
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Read header of encoded training data file `encoded_file` into `h`.
+// Return 1 if the file exists, was encoded with vocabulary `vocab` and
+// holds all `num_tokens` tokens, 0 otherwise.
+int CheckEncodedFile(struct encoded_header *h) {
+  struct stat st;
+  FILE *fin = fopen(encoded_file, "rb");
+  if (fin == NULL) return 0;
+  if (fread(h, sizeof(struct encoded_header), 1, fin) != 1 || fstat(fileno(fin), &st)) {
+    fclose(fin);
+    return 0;
+  }
+  fclose(fin);
+  if (memcmp(h->magic, ENCODED_MAGIC, sizeof(ENCODED_MAGIC))) return 0;
+  if (h->num_tokens < 0 || st.st_size != sizeof(*h) + h->num_tokens * (long long)sizeof(int)) return 0;
+  return (h->vocab_size == vocab_size) && (h->vocab_checksum == VocabChecksum());
+}
+
+// Tokenize `train_file` once and write the position in vocabulary
+// `vocab` of every in-vocabulary word to `encoded_file` (see
+// `encoded_header`), so that training epochs (and later runs sharing
+// the same vocabulary) do not need to re-tokenize the text.  The file
+// is written under a temporary name and renamed when complete, so that
+// an interrupted or failed run does not leave a partial file behind.
+void EncodeTrainFile() {
+  struct encoded_header h;
+  int buf[4096];
+  long long n = 0, wc = 0, pos = 0;
+  char eof = 0, tmp_file[MAX_STRING + 8];
+  int word, ok = 1;
+  FILE *fo;
+  snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", encoded_file);
+  fo = fopen(tmp_file, "wb");
+  if (fo == NULL) {
+    printf("ERROR: cannot open encoded file %s for writing\n", tmp_file);
+    exit(1);
+  }
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, ENCODED_MAGIC, sizeof(ENCODED_MAGIC));
+  h.vocab_size = vocab_size;
+  h.vocab_checksum = VocabChecksum();
+  // write header now (to reserve space); rewrite when token count known
+  if (fwrite(&h, sizeof(h), 1, fo) != 1) ok = 0;
+  while (ok) {
+    word = ReadWordIndex(&pos, &eof);
+    if (eof) break;
+    // skip OOV
+    if (word == -1) continue;
+    buf[n % 4096] = word;
+    n++;
+    if (n % 4096 == 0 && fwrite(buf, sizeof(int), 4096, fo) != 4096) ok = 0;
+    wc++;
+    if ((debug_mode > 1) && (wc >= 1000000)) {
+      printf("Encoded: %lldM%c", n / 1000000, 13);
+      fflush(stdout);
+      wc = 0;
+    }
+  }
+  if (ok && fwrite(buf, sizeof(int), n % 4096, fo) != n % 4096) ok = 0;
+  h.num_tokens = n;
+  if (ok && (fseek(fo, 0, SEEK_SET) || fwrite(&h, sizeof(h), 1, fo) != 1)) ok = 0;
+  if (fclose(fo)) ok = 0;
+  if (!ok || rename(tmp_file, encoded_file)) {
+    printf("ERROR: cannot write encoded file %s\n", encoded_file);
+    unlink(tmp_file);
+    exit(1);
+  }
+  if (debug_mode > 0) printf("Encoded %lld words to %s\n", n, encoded_file);
+}
+
+// Memory-map encoded training data file `encoded_file` into
+// `encoded_ids`, encoding `train_file` first if the file does not
+// exist or was encoded with a different vocabulary.
+void MapEncodedFile() {
+  struct encoded_header h;
+  int fd;
+  char *data;
+  if (!CheckEncodedFile(&h)) {
+    if (train_file[0] == 0) {
+      printf("ERROR: encoded file %s is incomplete or does not match vocabulary, and no training data file given\n", encoded_file);
+      exit(1);
+    }
+    EncodeTrainFile();
+    if (!CheckEncodedFile(&h)) {
+      printf("ERROR: cannot read encoded file %s\n", encoded_file);
+      exit(1);
+    }
+  }
+  fd = open(encoded_file, O_RDONLY);
+  if (fd < 0) {
+    printf("ERROR: cannot open encoded file %s\n", encoded_file);
+    exit(1);
+  }
+  data = (char *)mmap(NULL, sizeof(h) + h.num_tokens * sizeof(int), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    printf("ERROR: cannot map encoded file %s\n", encoded_file);
+    exit(1);
+  }
+  madvise(data, sizeof(h) + h.num_tokens * sizeof(int), MADV_SEQUENTIAL);
+  encoded_ids = (int *)(data + sizeof(h));
+  encoded_tokens = h.num_tokens;
+}
+
+// Return the position in `train_data` at which the shard of worker `r`
+// of distributed training starts (`file_size` for `r` =
+// `dist_workers`): an equal share of the bytes, moved forward to the
+// start of the next sentence (or, if there is no newline within
+// `train_chunk_size` bytes, word boundary), so that all workers cut the
+// data at the same places.
+long long ShardStart(int r) {
+  long long p, limit;
+  char *nl;
+  if (r <= 0) return 0;
+  if (r >= dist_workers) return file_size;
+  p = file_size * r / dist_workers;
+  limit = p + train_chunk_size < file_size ? p + train_chunk_size : file_size;
+  nl = (char *)memchr(train_data + p, '\n', limit - p);
+  return (nl != NULL) ? nl - train_data + 1 : FindBoundary(p);
+}
+
+// Cut the training data (`train_data`, or `encoded_ids` if set) into
+// `num_chunks` chunks of about `train_chunk_size` bytes, fewer if needed
+// to give each thread at least 16 chunks, and store their start positions
+// in `chunk_start` (followed by the end of the data).  Each chunk starts
+// at the beginning of a sentence, just after a newline (or "</s>"); if
+// there is none in the next chunk's worth of data, it starts at a word
+// boundary instead.  When resuming, `num_chunks` is the number of chunks
+// in the checkpoint, which must match.
+//
+// A worker of distributed training only cuts its own shard of the data
+// (see `ShardStart`).
+void InitChunks() {
+  long long a, p, limit, size, n, lo = 0,
+    hi = (encoded_ids != NULL) ? encoded_tokens : file_size;
+  char *nl;
+  if (dist == 2) {
+    lo = ShardStart(dist_rank);
+    hi = ShardStart(dist_rank + 1);
+    if (hi < lo) hi = lo;
+  }
+  size = (encoded_ids != NULL) ? train_chunk_size / (long long)sizeof(int) : train_chunk_size;
+  if (size > (hi - lo) / (16 * num_threads)) size = (hi - lo) / (16 * num_threads);
+  if (size < 1) size = 1;
+  n = (hi - lo + size - 1) / size;
+  if (n < 1) n = 1;
+  if (resume && n != num_chunks) {
+    printf("ERROR: checkpoint was written with different training data (%lld chunks, not %lld)\n", num_chunks, n);
+    exit(1);
+  }
+  num_chunks = n;
+  chunk_start = (long long *)malloc((num_chunks + 1) * sizeof(long long));
+  if (chunk_start == NULL) {
+    printf("Memory allocation failed\n");
+    exit(1);
+  }
+  chunk_start[0] = lo;
+  for (a = 1; a < num_chunks; a++) {
+    p = lo + a * size;
+    limit = p + size < hi ? p + size : hi;
+    if (encoded_ids != NULL) {
+      while (p < limit && encoded_ids[p] != 0) p++;
+      p = (p < limit) ? p + 1 : lo + a * size;
+    } else {
+      nl = (char *)memchr(train_data + p, '\n', limit - p);
+      p = (nl != NULL) ? nl - train_data + 1 : FindBoundary(p);
+      if (p > hi) p = hi;
+    }
+    chunk_start[a] = (p > chunk_start[a - 1]) ? p : chunk_start[a - 1];
+  }
+  chunk_start[num_chunks] = hi;
+}
+
+// Write `n` bytes from `buf` to file descriptor `fd`, retrying after
+// partial writes.  Return 0 on success, -1 on error.
+int WriteAll(int fd, const void *buf, long long n) {
+  long long w;
+  const char *p = (const char *)buf;
+  while (n > 0) {
+    w = write(fd, p, n > (1 << 30) ? (1 << 30) : n);
+    if (w <= 0) return -1;
+    p += w;
+    n -= w;
+  }
+  return 0;
+}
+
+// Write a checkpoint of the training state to `tmp_file`, then rename
+// it to `file`.  Return 0 on success, -1 on error.
+//
+// This runs in a child process forked from the training process (see
+// `MonitorThread`), whose memory is a copy-on-write snapshot of the
+// parent's; training threads do not exist in the child and the parent
+// keeps training.  As other threads may have held locks (in `malloc` or
+// stdio) at the time of the fork, only system calls are used here, with
+// a buffer for the vocabulary.
+int WriteCheckpoint(char *file, char *tmp_file) {
+  static char buf[1 << 16];
+  struct checkpoint_header h;
+  struct thread_state st;
+  long long a, n = 0;
+  int fd, len;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+  h.vocab_size = vocab_size;
+  h.layer1_size = layer1_size;
+  h.hs = hs;
+  h.negative = negative;
+  h.num_threads = num_threads;
+  h.iter = iter;
+  h.precision = PARAM_TYPE;
+  h.encoded = (encoded_ids != NULL);
+  h.train_words = train_words;
+  h.epoch_words = epoch_words;
+  h.word_count_actual = word_count_actual;
+  h.num_chunks = num_chunks;
+  h.work_cursor = work_cursor;
+  h.alpha = alpha;
+  h.starting_alpha = starting_alpha;
+  h.alpha_min = alpha_min;
+  fd = open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return -1;
+  if (WriteAll(fd, &h, sizeof(h))) goto fail;
+  for (a = 0; a < vocab_size; a++) {
+    len = strlen(vocab[a].word);
+    if (n + sizeof(long long) + sizeof(int) + len > sizeof(buf)) {
+      if (WriteAll(fd, buf, n)) goto fail;
+      n = 0;
+    }
+    memcpy(buf + n, &vocab[a].cn, sizeof(long long));
+    memcpy(buf + n + sizeof(long long), &len, sizeof(int));
+    memcpy(buf + n + sizeof(long long) + sizeof(int), vocab[a].word, len);
+    n += sizeof(long long) + sizeof(int) + len;
+  }
+  if (WriteAll(fd, buf, n)) goto fail;
+  if (WriteAll(fd, syn0, vocab_size * layer1_size * sizeof(param))) goto fail;
+  if (hs && WriteAll(fd, syn1, vocab_size * layer1_size * sizeof(param))) goto fail;
+  if (negative > 0 && WriteAll(fd, syn1neg, vocab_size * layer1_size * sizeof(param))) goto fail;
+  for (a = 0; a < num_threads; a++) {
+    st = train_states[a].state[train_states[a].current];
+    if (WriteAll(fd, &st, sizeof(st))) goto fail;
+  }
+  if (fsync(fd)) goto fail;
+  if (close(fd)) return -1;
+  return rename(tmp_file, file);
+fail:
+  close(fd);
+  return -1;
+}
+
+// Read the header and vocabulary of `checkpoint_file` (written by
+// `WriteCheckpoint`) into `vocab`, in the order they were saved (which
+// the rows of the parameters follow), and restore the learning rate
+// schedule and progress.  Return the file, positioned at the
+// parameters, for `ReadCheckpointNet`.  Exit if the file cannot be
+// read or was written with different model parameters.
+FILE *ReadCheckpointVocab() {
+  struct checkpoint_header h;
+  long long a, cn;
+  int b, len;
+  char word[MAX_STRING];
+  FILE *fin = fopen(checkpoint_file, "rb");
+  if (fin == NULL) {
+    printf("ERROR: checkpoint file %s not found\n", checkpoint_file);
+    exit(1);
+  }
+  if (fread(&h, sizeof(h), 1, fin) != 1 || memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic))) {
+    printf("ERROR: %s is not a checkpoint file\n", checkpoint_file);
+    exit(1);
+  }
+  if (h.layer1_size != layer1_size || h.hs != hs || h.negative != negative || h.num_threads != num_threads || h.iter != iter) {
+    printf("ERROR: checkpoint was written with -size %lld -hs %lld -negative %lld -threads %lld -iter %lld\n",
+     h.layer1_size, h.hs, h.negative, h.num_threads, h.iter);
+    exit(1);
+  }
+  if (h.encoded != (encoded_file[0] != 0)) {
+    printf("ERROR: checkpoint was written training on %s data\n", h.encoded ? "encoded" : "text");
+    exit(1);
+  }
+  if (h.precision != PARAM_TYPE) {
+    printf("ERROR: checkpoint was written with %s parameters\n", (h.precision == PARAM_BF16) ? "bf16" :
+     (h.precision == PARAM_FP16) ? "fp16" : "float");
+    exit(1);
+  }
+  ResetVocab();
+  for (a = 0; a < h.vocab_size; a++) {
+    if (fread(&cn, sizeof(long long), 1, fin) != 1 || fread(&len, sizeof(int), 1, fin) != 1 ||
+     len < 0 || len >= MAX_STRING || fread(word, 1, len, fin) != len) {
+      printf("ERROR: checkpoint file %s is truncated\n", checkpoint_file);
+      exit(1);
+    }
+    word[len] = 0;
+    // (the rows of the parameters follow the saved order, so a word
+    // saved twice means the file is not what `WriteCheckpoint` wrote)
+    if (SearchVocab(word, len) != -1) {
+      printf("ERROR: checkpoint file %s is corrupt (word %s saved twice)\n", checkpoint_file, word);
+      exit(1);
+    }
+    b = AddWordToVocab(word, len);
+    vocab[b].cn = cn;
+  }
+  vocab = (struct vocab_word *)realloc(vocab, (vocab_size + 1) * sizeof(struct vocab_word));
+  for (a = 0; a < vocab_size; a++) {
+    vocab[a].code = (char *)calloc(MAX_CODE_LENGTH, sizeof(char));
+    vocab[a].point = (int *)calloc(MAX_CODE_LENGTH, sizeof(int));
+  }
+  train_words = h.train_words;
+  epoch_words = h.epoch_words;
+  word_count_actual = h.word_count_actual;
+  num_chunks = h.num_chunks;
+  work_cursor = h.work_cursor;
+  alpha = h.alpha;
+  starting_alpha = h.starting_alpha;
+  alpha_min = h.alpha_min;
+  if (debug_mode > 0) {
+    printf("Resuming from checkpoint %s at %.2f%%\n", checkpoint_file, word_count_actual / (real)(iter * epoch_words + 1) * 100);
+    printf("Vocab size: %lld\n", vocab_size);
+    printf("Words in train file: %lld\n", train_words);
+  }
+  return fin;
+}
+
+// Read the parameters and thread states that follow the vocabulary in
+// checkpoint file `fin` (see `ReadCheckpointVocab`) into `syn0`, `syn1`,
+// `syn1neg`, and `resume_states`, then close it.  A thread may have
+// published a chunk it was about to claim just before the checkpoint was
+// taken (see `ClaimChunk`); move `work_cursor` past it so that it is not
+// handed out again.
+void ReadCheckpointNet(FILE *fin) {
+  long long a, n = vocab_size * layer1_size;
+  resume_states = (struct thread_state *)malloc(num_threads * sizeof(struct thread_state));
+  if (fread(syn0, sizeof(param), n, fin) != n ||
+   (hs && fread(syn1, sizeof(param), n, fin) != n) ||
+   (negative > 0 && fread(syn1neg, sizeof(param), n, fin) != n) ||
+   fread(resume_states, sizeof(struct thread_state), num_threads, fin) != num_threads) {
+    printf("ERROR: checkpoint file %s is truncated\n", checkpoint_file);
+    exit(1);
+  }
+  fclose(fin);
+  for (a = 0; a < num_threads; a++)
+    if (resume_states[a].chunk < iter * num_chunks && resume_states[a].chunk >= work_cursor)
+      work_cursor = resume_states[a].chunk + 1;
+}
+
+// Write the vocabulary and parameters to `save_model_file` (in the
+// checkpoint format) for training to be continued later with
+// `init_model_file`.
+void SaveModel() {
+  char tmp_file[MAX_STRING + 4];
+  strcpy(tmp_file, save_model_file);
+  strcat(tmp_file, ".tmp");
+  if (WriteCheckpoint(save_model_file, tmp_file)) {
+    printf("ERROR: model could not be saved to %s\n", save_model_file);
+    exit(1);
+  }
+}
+
+// Powers of five that fit (with a 26-bit factor) in 64 bits, for
+// `FormatReal`
+const unsigned long long pow5[17] = {1, 5, 25, 125, 625, 3125, 15625, 78125, 390625,
+  1953125, 9765625, 48828125, 244140625, 1220703125, 6103515625, 30517578125, 152587890625ULL};
+
+// Write the shortest decimal representation of `x` that reads back as
+// exactly `x` (with `strtof` or `scanf`'s "%f") to `out`, null-
+// terminated, and return its length (at most 15 characters).  Of the
+// shortest representations, the one nearest `x` is chosen.
+//
+// `x` is m 2^e for integers m and e, and the reals that round to it lie
+// between the midpoints to its neighbors, which are also of that form.
+// If e is negative, m 2^e = m 5^-e 10^e, so scaled by 10^-e (or by 2^-e
+// if e is positive) `x` and the two bounds are integers, and digits
+// are removed from them (like Ryu's "general case", but exactly) until
+// removing another would leave no number between the bounds.  If e is
+// negative, the first k digits can be removed at once (with k the
+// number of digits of 5^-e less one): dividing m 5^-e by 10^k is
+// dividing m 5^(-e-k) by 2^k, which fits in 64 bits for the magnitudes
+// from 3e-8 to 2e19 or so.  Others (including zeros, infinities and
+// NaNs) are printed with `snprintf` at increasing precisions until they
+// read back.
+int FormatReal(real x, char *out) {
+  unsigned int u = RealBits(x), mantissa = u & 0x7FFFFF, exponent = (u >> 23) & 0xFF;
+  unsigned long long vr, vp, vm, output, m2, r;
+  int e2, e10 = 0, k, accept, vm_zeros, vr_zeros = 1, last = 0, digits, point, len = 0, a;
+  char d[24];
+  e2 = (int)exponent - 127 - 23 - 2;
+  if (exponent == 0 || exponent == 0xFF || e2 < -53 || e2 > 37) {
+    for (a = 1; a < 9; a++) {
+      len = snprintf(out, 24, "%.*g", a, x);
+      if (strtof(out, NULL) == x) return len;
+    }
+    return snprintf(out, 24, "%.9g", x);
+  }
+  // With the two low bits to spare, the bounds are integers; the lower
+  // one is nearer if `x` is a power of two.  Reals exactly at a bound
+  // round to `x` (ties to even) if the mantissa is even, so then the
+  // bounds are candidates too.
+  m2 = (1 << 23) | mantissa;
+  accept = (m2 & 1) == 0;
+  vm_zeros = accept;
+  vr = 4 * m2;
+  vp = 4 * m2 + 2;
+  vm = 4 * m2 - 1 - (mantissa != 0 || exponent <= 1);
+  if (e2 >= 0) {
+    vr <<= e2;
+    vp <<= e2;
+    vm <<= e2;
+    if (!accept) vp--;
+  } else {
+    // The bounds are at least 3 5^-e2 - 1 apart, so at least k =
+    // floor(log10(5^-e2)) digits can be removed.  The last digit
+    // removed from `x` is the top one of the k and the others are zero
+    // if the k-1 low bits are.
+    k = -e2 * 698970 / 1000000;
+    e10 = e2 + k;
+    vr *= pow5[-e2 - k];
+    vp *= pow5[-e2 - k];
+    vm *= pow5[-e2 - k];
+    if (k > 0) {
+      r = vr & ((1ULL << k) - 1);
+      vr_zeros = (r & ((1ULL << (k - 1)) - 1)) == 0;
+      last = (r * 10) >> k;
+      vm_zeros &= (vm & ((1ULL << k) - 1)) == 0;
+      vp = (vp >> k) - (!accept && (vp & ((1ULL << k) - 1)) == 0);
+      vr >>= k;
+      vm >>= k;
+    } else if (!accept) vp--;
+  }
+  while (vp / 10 > vm / 10) {
+    vm_zeros &= vm % 10 == 0;
+    vr_zeros &= last == 0;
+    last = vr % 10;
+    vr /= 10;
+    vp /= 10;
+    vm /= 10;
+    e10++;
+  }
+  // If the lower bound itself is a candidate, it may have fewer digits
+  // still
+  if (vm_zeros) while (vm % 10 == 0) {
+    vr_zeros &= last == 0;
+    last = vr % 10;
+    vr /= 10;
+    vp /= 10;
+    vm /= 10;
+    e10++;
+  }
+  // Round `x` to the digits left, ties to even, but not down to the
+  // lower bound unless it is a candidate
+  if (vr_zeros && last == 5 && vr % 2 == 0) last = 4;
+  output = vr + ((vr == vm && !vm_zeros) || last >= 5);
+  for (digits = 0; output > 0; output /= 10) d[digits++] = '0' + output % 10;
+  // Print as fixed point when the decimal point falls at most three
+  // zeros before or nine digits after the first digit (like "%g"),
+  // otherwise in scientific notation
+  if (u >> 31) out[len++] = '-';
+  point = digits + e10;
+  if (point > 9 || point < -3) {
+    out[len++] = d[--digits];
+    if (digits > 0) out[len++] = '.';
+    while (digits > 0) out[len++] = d[--digits];
+    return len + sprintf(out + len, "e%+03d", point - 1);
+  }
+  if (point <= 0) {
+    out[len++] = '0';
+    out[len++] = '.';
+    for (a = point; a < 0; a++) out[len++] = '0';
+  }
+  for (a = 0; a < point || digits > 0; a++) {
+    if (a == point && a > 0) out[len++] = '.';
+    out[len++] = digits > 0 ? d[--digits] : '0';
+  }
+  out[len] = 0;
+  return len;
+}
+
+// A block of rows of `syn0` to be formatted for `output_file` (as text,
+// or in binary as set by `binary`) by `FormatRowsThread`
+struct output_block {
+  long long begin, end;        // rows [begin, end) of `syn0`
+  long long len;               // number of bytes formatted into `buf`
+  char *buf;                   // formatted rows
+};
+
+// Format the rows of `block`, with their words (except in the mapped
+// format, which keeps them apart), into its buffer.
+void *FormatRowsThread(void *arg) {
+  struct output_block *block = (struct output_block *)arg;
+  char *p = block->buf;
+  long long a, b, l;
+  unsigned short half;
+  real x, len;
+  for (a = block->begin; a < block->end; a++) {
+    if (binary == 3) {
+      // (scaled like distance and the other tools do, so they can use
+      // the rows as they are)
+      len = 0;
+      if (normalize) for (b = 0; b < layer1_size; b++) len += ParamToReal(syn0[a * layer1_size + b]) * ParamToReal(syn0[a * layer1_size + b]);
+      len = sqrt(len);
+      for (b = 0; b < layer1_size; b++) {
+        x = ParamToReal(syn0[a * layer1_size + b]);
+        if (len > 0) x /= len;
+        memcpy(p, &x, sizeof(real));
+        p += sizeof(real);
+      }
+      continue;
+    }
+    l = strlen(vocab[a].word);
+    memcpy(p, vocab[a].word, l);
+    p += l;
+    *p++ = ' ';
+    if (binary == 2) for (b = 0; b < layer1_size; b++) {
+      half = ParamToHalf(syn0[a * layer1_size + b]);
+      memcpy(p, &half, sizeof(half));
+      p += sizeof(half);
+    } else if (binary) for (b = 0; b < layer1_size; b++) {
+      x = ParamToReal(syn0[a * layer1_size + b]);
+      memcpy(p, &x, sizeof(real));
+      p += sizeof(real);
+    } else for (b = 0; b < layer1_size; b++) {
+      p += FormatReal(ParamToReal(syn0[a * layer1_size + b]), p);
+      *p++ = ' ';
+    }
+    *p++ = '\n';
+  }
+  block->len = p - block->buf;
+  return NULL;
+}
+
+// Write the header of a mapped vector file (see vectors.h) for the
+// output vectors to `fo`, padded to the start of the matrix.
+void WriteVectorsHeader(FILE *fo) {
+  struct vectors_header header;
+  char zeros[VECTORS_ALIGN] = {0};
+  long long a;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, VECTORS_MAGIC, sizeof(header.magic));
+  header.version = VECTORS_VERSION;
+  header.dtype = VECTORS_FLOAT32;
+  header.flags = normalize ? VECTORS_NORMALIZED : 0;
+  header.header_size = sizeof(header);
+  header.words = vocab_size;
+  header.size = layer1_size;
+  header.matrix_offset = (sizeof(header) + VECTORS_ALIGN - 1) / VECTORS_ALIGN * VECTORS_ALIGN;
+  header.word_offsets_offset = (header.matrix_offset + vocab_size * layer1_size * sizeof(real) + 7) / 8 * 8;
+  header.index_offset = header.word_offsets_offset + (vocab_size + 1) * sizeof(uint64_t);
+  for (header.index_slots = 1; header.index_slots < 2 * vocab_size; header.index_slots *= 2);
+  header.strings_offset = header.index_offset + header.index_slots * sizeof(uint32_t);
+  for (a = 0; a < vocab_size; a++) header.strings_bytes += strlen(vocab[a].word) + 1;
+  header.file_size = header.strings_offset + header.strings_bytes;
+  fwrite(&header, sizeof(header), 1, fo);
+  fwrite(zeros, 1, header.matrix_offset - sizeof(header), fo);
+}
+
+// Write the parts of a mapped vector file after the matrix to `fo`: the
+// offsets of the words in the string table, the hash index of the
+// words, and the string table.
+void WriteVectorsIndex(FILE *fo) {
+  char zeros[8] = {0};
+  long long a;
+  uint64_t offset = 0, index_slots, slot;
+  uint32_t *index;
+  fwrite(zeros, 1, (8 - vocab_size * layer1_size * sizeof(real) % 8) % 8, fo);
+  for (a = 0; a < vocab_size; a++) {
+    fwrite(&offset, sizeof(offset), 1, fo);
+    offset += strlen(vocab[a].word) + 1;
+  }
+  fwrite(&offset, sizeof(offset), 1, fo);
+  for (index_slots = 1; index_slots < 2 * vocab_size; index_slots *= 2);
+  index = (uint32_t *)malloc(index_slots * sizeof(uint32_t));
+  memset(index, 0xFF, index_slots * sizeof(uint32_t));
+  for (a = 0; a < vocab_size; a++) {
+    for (slot = VectorsHash(vocab[a].word) & (index_slots - 1); index[slot] != VECTORS_EMPTY; slot = (slot + 1) & (index_slots - 1));
+    index[slot] = a;
+  }
+  fwrite(index, sizeof(uint32_t), index_slots, fo);
+  free(index);
+  for (a = 0; a < vocab_size; a++) fwrite(vocab[a].word, 1, strlen(vocab[a].word) + 1, fo);
+}
+
+// Write the word vectors to `fo`: in text, binary, binary in half
+// precision (with the type named in the header after the dimensions),
+// or the mapped vector format of vectors.h, as `binary` is 0 to 3.  The
+// mapped format holds the vectors as one 64-byte aligned matrix (of
+// unit length rows if `normalize` is set), followed by a hash index
+// and a table of the words, so distance and the other tools can map
+// it and use it in place.
+//
+// Rows are formatted in blocks of a few megabytes by `num_threads`
+// threads at a time, then the blocks are written in order.  In text
+// mode each element is written in the fewest digits that read back as
+// the same `real` (see `FormatReal`).
+void SaveVectors(FILE *fo) {
+  long long a, b, row_bytes, rows;
+  pthread_t *pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+  struct output_block *blocks = (struct output_block *)calloc(num_threads, sizeof(struct output_block));
+  if (binary == 3) WriteVectorsHeader(fo);
+  else if (binary == 2) fprintf(fo, "%lld %lld %s\n", vocab_size, layer1_size, param_names[HALF_OUTPUT_TYPE]);
+  else fprintf(fo, "%lld %lld\n", vocab_size, layer1_size);
+  if (binary == 2) row_bytes = layer1_size * sizeof(unsigned short);
+  else if (binary) row_bytes = layer1_size * sizeof(real);
+  else row_bytes = layer1_size * 16;
+  row_bytes += MAX_STRING + 2;
+  rows = (4 << 20) / row_bytes + 1;
+  for (a = 0; a < num_threads; a++) blocks[a].buf = (char *)malloc(rows * row_bytes);
+  for (a = 0; a < vocab_size; a += rows * num_threads) {
+    for (b = 0; b < num_threads; b++) {
+      blocks[b].begin = a + b * rows < vocab_size ? a + b * rows : vocab_size;
+      blocks[b].end = blocks[b].begin + rows < vocab_size ? blocks[b].begin + rows : vocab_size;
+    }
+    if (num_threads == 1) FormatRowsThread(blocks);
+    else {
+      for (b = 0; b < num_threads; b++) pthread_create(&pt[b], NULL, FormatRowsThread, (void *)&blocks[b]);
+      for (b = 0; b < num_threads; b++) pthread_join(pt[b], NULL);
+    }
+    for (b = 0; b < num_threads; b++) fwrite(blocks[b].buf, 1, blocks[b].len, fo);
+  }
+  if (binary == 3) WriteVectorsIndex(fo);
+  for (a = 0; a < num_threads; a++) free(blocks[a].buf);
+  free(blocks);
+  free(pt);
+}
+
+// Read a row of `layer1_size` parameters of type `type` (a `PARAM_TYPE`)
+// from `fin` into `buf`, then convert them into `row` (rounding to
+// nearest if the type is wider), unless `row` is NULL.  Return 1 if the
+// row was read, 0 if the file is truncated.
+int ReadParamRow(FILE *fin, long long type, char *buf, param *row) {
+  long long b, size = (type == PARAM_REAL) ? sizeof(real) : sizeof(unsigned short);
+  unsigned short h;
+  real x;
+  if (fread(buf, size, layer1_size, fin) != layer1_size) return 0;
+  if (row == NULL) return 1;
+  if (type == PARAM_TYPE) memcpy(row, buf, layer1_size * sizeof(param));
+  else for (b = 0; b < layer1_size; b++) {
+    if (type == PARAM_REAL) memcpy(&x, buf + b * size, sizeof(x));
+    else {
+      memcpy(&h, buf + b * size, sizeof(h));
+      x = (type == PARAM_BF16) ? BF16ToReal(h) : FP16ToReal(h);
+    }
+    row[b] = RealToParam(x);
+  }
+  return 1;
+}
+
+// Return 1 if the Huffman tree built from the counts of the words in
+// `vocab` is the same as the one built from `model_cn` (for the same
+// words in the same rows), 0 otherwise.
+int SameHuffmanTree() {
+  long long a, same = 1, *cn = (long long *)malloc(vocab_size * sizeof(long long));
+  long long *binary = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
+  long long *parent_node = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
+  long long *model_binary = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
+  long long *model_parent_node = (long long *)calloc(vocab_size * 2 + 1, sizeof(long long));
+  for (a = 0; a < vocab_size; a++) cn[a] = vocab[a].cn;
+  BuildHuffmanTree(cn, binary, parent_node);
+  BuildHuffmanTree(model_cn, model_binary, model_parent_node);
+  // (the codes and points of the words follow from the parents and
+  // sides of the nodes below the root)
+  for (a = 0; a < vocab_size * 2 - 2 && same; a++)
+    same = parent_node[a] == model_parent_node[a] && binary[a] == model_binary[a];
+  free(cn);
+  free(binary);
+  free(parent_node);
+  free(model_binary);
+  free(model_parent_node);
+  return same;
+}
+
+// Copy the parameters of the model in `init_model_file` into `syn0`,
+// `syn1neg` (and `syn1`), after `InitNet`, for the words that are still
+// in `vocab` (sorted and pruned after `MergeModelVocab`); new words keep
+// their fresh rows.  Set `epoch_words` to the number of word tokens in
+// the new training data only.
+//
+// The rows of `syn1` belong to the inner nodes of the Huffman tree,
+// which is built from the (merged) word counts; they are only kept if
+// the words are in the same rows and the tree built from the merged
+// counts is the same as the one built from the model's (so every word
+// has the same code and points).
+// The model's parameters may be of another type (`PARAM_TYPE`) than
+// ours; they are converted.
+void ReadModelNet() {
+  struct checkpoint_header h;
+  long long a, n = 0, same_tree;
+  long long *row = (long long *)malloc(model_vocab_size * sizeof(long long));
+  char *buf = (char *)malloc(layer1_size * sizeof(real));
+  FILE *fin = OpenModel(&h);
+  int len;
+  // skip vocabulary
+  for (a = 0; a < model_vocab_size; a++) {
+    len = strlen(model_words[a]);
+    fseek(fin, sizeof(long long) + sizeof(int) + len, SEEK_CUR);
+  }
+  // map model's rows to positions in `vocab`
+  epoch_words = train_words;
+  same_tree = (model_vocab_size == vocab_size);
+  for (a = 0; a < model_vocab_size; a++) {
+    row[a] = SearchVocab(model_words[a], strlen(model_words[a]));
+    if (row[a] == -1) {
+      same_tree = 0;
+      continue;
+    }
+    epoch_words -= model_cn[a];
+    if (row[a] != a) same_tree = 0;
+    n++;
+  }
+  if (hs && h.hs && same_tree) same_tree = SameHuffmanTree();
+  for (a = 0; a < model_vocab_size; a++)
+    if (!ReadParamRow(fin, h.precision, buf, row[a] != -1 ? syn0 + row[a] * layer1_size : NULL)) break;
+  if (h.hs) for (a = 0; a < model_vocab_size; a++)
+    if (!ReadParamRow(fin, h.precision, buf, (hs && same_tree) ? syn1 + a * layer1_size : NULL)) break;
+  if (h.negative > 0) for (a = 0; a < model_vocab_size; a++)
+    if (!ReadParamRow(fin, h.precision, buf, (negative > 0 && row[a] != -1) ? syn1neg + row[a] * layer1_size : NULL)) break;
+  if (a < model_vocab_size) {
+    printf("ERROR: model file %s is truncated\n", init_model_file);
+    exit(1);
+  }
+  fclose(fin);
+  if (debug_mode > 0) {
+    printf("Continuing from model %s: %lld of its %lld words kept, %lld new words\n", init_model_file, n, model_vocab_size, vocab_size - n);
+    printf("Words in new training data: %lld\n", epoch_words);
+    if (hs && !(h.hs && same_tree)) printf("Hierarchical softmax weights reset (Huffman tree changed)\n");
+    if (negative > 0 && h.negative == 0) printf("Negative sampling weights initialized (not in model)\n");
+  }
+  for (a = 0; a < model_vocab_size; a++) free(model_words[a]);
+  free(model_words);
+  free(model_cn);
+  free(row);
+  free(buf);
+}
+
+// Parse a Linux CPU or node list such as "0-3,8-11" in `s` into at most
+// `max` ids in `out`; return the number of ids.
+int ParseIdList(char *s, int *out, int max) {
+  int n = 0, a, b, c;
+  char *end;
+  while (*s != 0 && *s != '\n') {
+    a = b = strtol(s, &end, 10);
+    if (end == s) break;
+    s = end;
+    if (*s == '-') {
+      b = strtol(s + 1, &end, 10);
+      s = end;
+    }
+    for (c = a; c <= b && n < max; c++) out[n++] = c;
+    if (*s == ',') s++;
+  }
+  return n;
+}
+
+// Read the id list in sysfs file `path` (see `ParseIdList`) into `out`;
+// return the number of ids (0 if the file cannot be read).
+int ReadIdList(char *path, int *out, int max) {
+  char buf[4096];
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) return 0;
+  if (fgets(buf, sizeof(buf), f) == NULL) buf[0] = 0;
+  fclose(f);
+  return ParseIdList(buf, out, max);
+}
+
+// Find the NUMA nodes that have CPUs (from /sys/devices/system/node) and
+// their CPUs.  Without NUMA information, all online CPUs form one node.
+void InitNuma() {
+  char path[MAX_STRING];
+  int a, n, ids[MAX_NUMA_NODES], *cpus = (int *)malloc(MAX_NUMA_CPUS * sizeof(int));
+  n = ReadIdList((char *)"/sys/devices/system/node/online", ids, MAX_NUMA_NODES);
+  num_nodes = 0;
+  for (a = 0; a < n; a++) {
+    sprintf(path, "/sys/devices/system/node/node%d/cpulist", ids[a]);
+    node_ncpus[num_nodes] = ReadIdList(path, cpus, MAX_NUMA_CPUS);
+    if (node_ncpus[num_nodes] == 0) continue;
+    node_id[num_nodes] = ids[a];
+    node_cpus[num_nodes] = (int *)malloc(node_ncpus[num_nodes] * sizeof(int));
+    memcpy(node_cpus[num_nodes], cpus, node_ncpus[num_nodes] * sizeof(int));
+    num_nodes++;
+  }
+  if (num_nodes == 0) {
+    num_nodes = 1;
+    node_id[0] = 0;
+    node_ncpus[0] = sysconf(_SC_NPROCESSORS_ONLN);
+    if (node_ncpus[0] < 1) node_ncpus[0] = 1;
+    node_cpus[0] = (int *)malloc(node_ncpus[0] * sizeof(int));
+    for (a = 0; a < node_ncpus[0]; a++) node_cpus[0][a] = a;
+  }
+  free(cpus);
+  if (numa == 2 && num_nodes == 1) numa = 1;
+  if (debug_mode > 0) {
+    printf("NUMA: %d node(s) with CPUs, threads pinned round-robin, parameters %s\n", num_nodes,
+     numa == 2 ? "replicated on each node" : "interleaved across nodes");
+  }
+}
+
+// Set the memory policy of the `bytes` bytes at `p` (which must be
+// page-aligned and not yet touched) to node `node` (a position in
+// `node_id`), or to all nodes with CPUs, interleaved page by page, if
+// `node` is -1.  A failure only costs locality, so it is ignored.
+void NumaBind(void *p, long long bytes, int node) {
+  unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+  int a;
+  memset(mask, 0, sizeof(mask));
+  for (a = 0; a < num_nodes; a++) if (node == -1 || node == a)
+    mask[node_id[a] / (8 * sizeof(unsigned long))] |= 1UL << (node_id[a] % (8 * sizeof(unsigned long)));
+  syscall(SYS_mbind, p, bytes, node == -1 ? MPOL_INTERLEAVE : MPOL_BIND, mask, MAX_NUMA_NODES + 1, 0);
+}
+
+// Pin training thread `id` to a CPU of node `id` % `num_nodes` (threads
+// of a node take its CPUs in turn).
+void PinThread(long long id) {
+  cpu_set_t set;
+  int node = id % num_nodes;
+  CPU_ZERO(&set);
+  CPU_SET(node_cpus[node][(id / num_nodes) % node_ncpus[node]], &set);
+  sched_setaffinity(0, sizeof(set), &set);
+}
+
+// Allocate a page-aligned copy of `syn0` and of `syn1neg` on each node
+// (after the parameters have been initialized or loaded).
+void InitReplicas() {
+  long long bytes = vocab_size * layer1_size * sizeof(param);
+  int node;
+  for (node = 0; node < num_nodes; node++) {
+    posix_memalign((void **)&syn0_replica[node], 4096, bytes);
+    if (syn0_replica[node] == NULL) {printf("Memory allocation failed\n"); exit(1);}
+    NumaBind(syn0_replica[node], bytes, node);
+    memcpy(syn0_replica[node], syn0, bytes);
+    if (negative > 0) {
+      posix_memalign((void **)&syn1neg_replica[node], 4096, bytes);
+      if (syn1neg_replica[node] == NULL) {printf("Memory allocation failed\n"); exit(1);}
+      NumaBind(syn1neg_replica[node], bytes, node);
+      memcpy(syn1neg_replica[node], syn1neg, bytes);
+    }
+  }
+}
+
+// Merge the replicas `rep` of the `rows` rows of parameters at `base`
+// (updated at the last merge): add to each row of `base` the average
+// change of that row over the replicas that changed it, and copy the
+// result back into every replica.  A row only one node trained moves as
+// far as it did there; the row of a frequent word, which every node
+// moved most of the way to where the data pulls it, moves that far once
+// rather than once per node (summing would overshoot).  Training
+// threads keep writing to their replica meanwhile; an update that lands
+// between the read and the write of an element is lost, as in Hogwild.
+void MergeReplicas(param *base, param **rep, long long rows) {
+  long long a, b;
+  int node, k;
+  param *row;
+  real sum;
+  for (a = 0; a < rows; a++) {
+    row = base + a * layer1_size;
+    k = 0;
+    for (node = 0; node < num_nodes; node++)
+      if (memcmp(rep[node] + a * layer1_size, row, layer1_size * sizeof(param))) k++;
+    if (k == 0) continue;
+    for (b = 0; b < layer1_size; b++) {
+      sum = 0;
+      for (node = 0; node < num_nodes; node++) sum += ParamToReal(rep[node][a * layer1_size + b]) - ParamToReal(row[b]);
+      row[b] = RealToParam(ParamToReal(row[b]) + sum / k);
+      for (node = 0; node < num_nodes; node++) rep[node][a * layer1_size + b] = row[b];
+    }
+  }
+}
+
+// Bring `syn0` and `syn1neg` up to date with the training done on all
+// nodes' replicas (see `MergeReplicas`).
+void SyncReplicas() {
+  MergeReplicas(syn0, syn0_replica, vocab_size);
+  if (negative > 0) MergeReplicas(syn1neg, syn1neg_replica, vocab_size);
+}
+
+// Out-of-core training (`weights_dir`): `syn0`, `syn1`, and `syn1neg`
+// are mapped from scratch files rather than held in memory, so that
+// their size is bounded by disk rather than memory, and the kernel
+// pages rows in and out as needed.  The rows of the `pin_words` most
+// frequent words (first in the vocabulary, as sorted by `SortVocab`),
+// which most training updates and negative samples touch, are kept in
+// locked memory instead (see `PinParams`); the rows of the other words
+// of a sentence are read in ahead of training on it (see
+// `PrefetchRows`).
+
+// Replace the pages of the rows of the `pin_words` most frequent words
+// of newly mapped (all zero) matrix `p` of `rows` rows with anonymous
+// memory, locked if
+// possible (see ulimit -l): its first rows or, if `last` is set, its
+// last ones (the rows of `syn1` used most are those of the nodes near
+// the root of the Huffman tree, which `CreateBinaryTree` numbers last).
+// Pages of a shared file mapping would be written back to disk, and
+// write-protected while they are, every few seconds as they are
+// updated.  Advise the kernel that the other rows are accessed at
+// random, so that it does not read ahead around them.
+void PinParams(param *p, long long rows, int last) {
+  static int warned = 0;
+  long long row = layer1_size * sizeof(param), n = (pin_words < rows) ? pin_words : rows;
+  char *lo = (char *)p + (last ? (rows - n) * row : 0), *hi = lo + n * row;
+  madvise(p, rows * row, MADV_RANDOM);
+  if (n == 0) return;
+  // (the mapping spans whole pages)
+  lo -= (unsigned long long)lo % page_bytes;
+  hi += (page_bytes - (unsigned long long)hi % page_bytes) % page_bytes;
+  if (mmap(lo, hi - lo, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+    printf("ERROR: cannot allocate memory for the weights of %lld words\n", n);
+    exit(1);
+  }
+  pinned_bytes += hi - lo;
+  if (mlock(lo, hi - lo) && !warned) {
+    printf("WARNING: cannot lock the weights of %lld words in memory (see ulimit -l)\n", n);
+    warned = 1;
+  }
+}
+
+// Allocate a `rows` x `layer1_size` matrix of parameters: in
+// memory aligned to `align` bytes, or, if `weights_dir` is set, mapped
+// from a scratch file in that directory, zero-filled (the file is
+// removed right away; its space is freed when the process exits), with
+// the rows of the most frequent words in memory (see `PinParams`; if
+// `last` is set, those are the last rows).  Exit on failure.  (Mapped
+// weights are shared with forked processes, which is why -checkpoint
+// is not supported with `weights_dir`.)
+param *AllocParams(long long rows, long long align, int last) {
+  long long bytes = rows * layer1_size * sizeof(param);
+  char path[MAX_STRING + 32];
+  param *p = NULL;
+  int fd;
+  if (weights_dir[0] == 0) {
+    posix_memalign((void **)&p, align, bytes);
+    if (p == NULL) {printf("Memory allocation failed\n"); exit(1);}
+    return p;
+  }
+  page_bytes = sysconf(_SC_PAGESIZE);
+  sprintf(path, "%s/word2vec-weights-XXXXXX", weights_dir);
+  fd = mkstemp(path);
+  if (fd < 0) {
+    printf("ERROR: cannot create weights file in %s\n", weights_dir);
+    exit(1);
+  }
+  unlink(path);
+  // (reserve the space now rather than fail on a write fault later)
+  if (posix_fallocate(fd, 0, bytes)) {
+    printf("ERROR: cannot allocate %.2f MB of weights in %s\n", bytes / 1048576.0, weights_dir);
+    exit(1);
+  }
+  p = (param *)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    printf("ERROR: cannot map weights file in %s\n", weights_dir);
+    exit(1);
+  }
+  mapped_bytes += bytes;
+  PinParams(p, rows, last);
+  return p;
+}
+
+// Free matrix `p` of `rows` rows allocated by `AllocParams`.
+void FreeParams(param *p, long long rows) {
+  if (weights_dir[0] == 0) free(p);
+  else munmap(p, rows * layer1_size * sizeof(param));
+}
+
+// Advise the kernel to read in the rows of out-of-core matrix `p` (as
+// used by `TrainModelThread`) of the words of sentence `sen` of length
+// `n` that are not locked in memory.
+void PrefetchRows(param *p, long long *sen, long long n) {
+  long long a, row = layer1_size * sizeof(param);
+  char *lo;
+  for (a = 0; a < n; a++) {
+    if (sen[a] < pin_words) continue;
+    lo = (char *)p + sen[a] * row;
+    lo -= (unsigned long long)lo % page_bytes;
+    madvise(lo, (char *)p + (sen[a] + 1) * row - lo, MADV_WILLNEED);
+  }
+}
+
+// Return the number of major page faults (which had to read from disk)
+// of this process so far.
+long long MajorFaults() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_majflt;
+}
+
+// Allocate memory for and initialize neural network parameters.  Each
+// array has size `vocab_size` x `layer1_size`.
+//
+//   syn0: input word embeddings, initialized uniformly on
+//         [-0.5/`layer1_size`, 0.5/`layer1_size`)
+//   syn1: only used by hierarchical softmax; initialized to 0
+//   syn1neg: output word embeddings; initialized to zero
+//
+// With `numa`, the arrays are page-aligned and their pages interleaved
+// across NUMA nodes before they are first touched.  With `weights_dir`,
+// they are mapped from files (already zero-filled) but for the rows of
+// the most frequent words.
+void InitNet() {
+  long long a, b, align = numa ? 4096 : 128;
+  unsigned long long next_random = 1;
+  syn0 = AllocParams(vocab_size, align, 0);
+  if (numa) NumaBind(syn0, (long long)vocab_size * layer1_size * sizeof(param), -1);
+  if (hs) {
+    syn1 = AllocParams(vocab_size, align, 1);
+    if (numa) NumaBind(syn1, (long long)vocab_size * layer1_size * sizeof(param), -1);
+    if (weights_dir[0] == 0) for (a = 0; a < vocab_size; a++) for (b = 0; b < layer1_size; b++)
+     syn1[a * layer1_size + b] = 0;
+  }
+  if (negative>0) {
+    syn1neg = AllocParams(vocab_size, align, 0);
+    if (numa) NumaBind(syn1neg, (long long)vocab_size * layer1_size * sizeof(param), -1);
+    if (weights_dir[0] == 0) for (a = 0; a < vocab_size; a++) for (b = 0; b < layer1_size; b++)
+     syn1neg[a * layer1_size + b] = 0;
+  }
+  for (a = 0; a < vocab_size; a++) for (b = 0; b < layer1_size; b++) {
+    next_random = next_random * (unsigned long long)25214903917 + 11;
+    syn0[a * layer1_size + b] = RealToParam((((next_random & 0xFFFF) / (real)65536) - 0.5) / layer1_size);
+  }
+  // (Huffman codes are only used by hierarchical softmax, and do not
+  // exist yet in streaming mode)
+  if (hs) CreateBinaryTree();
+}
+
+// Distributed training (`dist`): a coordinator process and
+// `dist_workers` worker processes, on one host or several, train one
+// model together.  The coordinator learns (or reads) the vocabulary and
+// sends it, with the training options the workers must share, to each
+// worker as it joins (see `RunCoordinator` and `JoinCoordinator`).
+// Every worker then initializes the same parameters as the coordinator
+// (`InitNet` is deterministic) and trains on its own shard of
+// `train_file` (see `ShardStart`) with its own threads.
+//
+// Every `dist_sync_interval` seconds, each worker sends the coordinator
+// the change of each row of its `syn0`, `syn1`, and `syn1neg` since the
+// last sync; rows it has not changed are not sent, so the many rare
+// words cost no traffic.  The coordinator adds to each row the average
+// of the changes sent for it (as `MergeReplicas` does with NUMA
+// replicas) and sends the merged rows back to all workers, which apply
+// them without losing the updates their threads made in the meantime
+// (see `WorkerSync`).  Syncs also carry word counts, so that the
+// learning rate of every worker follows the schedule of the coordinator
+// over the words trained on by all workers (see `remote_words`).  A
+// worker that has finished keeps syncing until all have; the
+// coordinator then writes the model.
+//
+// Messages are raw structs and `real`s, so all processes must run on
+// machines of the same architecture, and be built with the same
+// `PRECISION`.
+
+// Return the matrix whose rows have indices `m` * `vocab_size` to
+// (`m` + 1) * `vocab_size` - 1 in sync messages (NULL if not used).
+param *DistMatrix(long long m) {
+  if (m == 0) return syn0;
+  if (m == 1) return hs ? syn1 : NULL;
+  return (negative > 0) ? syn1neg : NULL;
+}
+
+// Open a socket for `addr`: a Unix domain socket if it contains a
+// slash, otherwise TCP at "host:port" (the coordinator listens on all
+// interfaces if the host is empty or there is no colon).  If
+// `listening`, bind it and listen; otherwise connect, retrying for up to
+// a minute while the coordinator starts.  Exit on error.
+int OpenDistSocket(char *addr, int listening) {
+  struct sockaddr_un un;
+  struct addrinfo hints, *res = NULL, *ai;
+  char host[MAX_STRING], *port;
+  int a, fd = -1, one = 1;
+  // (a lost connection is reported as an error by `DistLost`)
+  signal(SIGPIPE, SIG_IGN);
+  strcpy(host, addr);
+  port = strrchr(host, ':');
+  if (port != NULL) *port++ = 0;
+  else {
+    port = addr;
+    host[0] = 0;
+  }
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (listening) hints.ai_flags = AI_PASSIVE;
+  if (strchr(addr, '/') == NULL && (a = getaddrinfo(host[0] ? host : NULL, port, &hints, &res)) != 0) {
+    printf("ERROR: cannot resolve %s: %s\n", addr, gai_strerror(a));
+    exit(1);
+  }
+  if (strlen(addr) >= sizeof(un.sun_path) && res == NULL) {
+    printf("ERROR: socket path %s is too long\n", addr);
+    exit(1);
+  }
+  for (a = 0; a < (listening ? 1 : 600) && fd < 0; a++) {
+    if (a > 0) usleep(100000);
+    if (res == NULL) {
+      memset(&un, 0, sizeof(un));
+      un.sun_family = AF_UNIX;
+      strcpy(un.sun_path, addr);
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (listening) unlink(addr);
+      if (fd >= 0 && (listening ? bind(fd, (struct sockaddr *)&un, sizeof(un)) || listen(fd, dist_workers) :
+       connect(fd, (struct sockaddr *)&un, sizeof(un)))) {
+        close(fd);
+        fd = -1;
+      }
+    } else for (ai = res; ai != NULL && fd < 0; ai = ai->ai_next) {
+      fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (fd < 0) continue;
+      if (listening) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      if (listening ? bind(fd, ai->ai_addr, ai->ai_addrlen) || listen(fd, dist_workers) :
+       connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+        close(fd);
+        fd = -1;
+      }
+    }
+  }
+  if (res != NULL) freeaddrinfo(res);
+  if (fd < 0) {
+    printf("ERROR: cannot %s %s\n", listening ? "listen on" : "connect to", addr);
+    exit(1);
+  }
+  return fd;
+}
+
+// Set up buffered streams `*in` and `*out` to read from and write to
+// connected socket `fd`.
+void OpenDistStreams(int fd, FILE **in, FILE **out) {
+  int one = 1;
+  // (messages are flushed whole; fails harmlessly on Unix sockets)
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  *in = fdopen(fd, "rb");
+  *out = fdopen(dup(fd), "wb");
+  if (*in == NULL || *out == NULL) {
+    printf("ERROR: cannot open socket streams\n");
+    exit(1);
+  }
+  setvbuf(*in, NULL, _IOFBF, 1 << 20);
+  setvbuf(*out, NULL, _IOFBF, 1 << 20);
+}
+
+// Report that the connection to worker `w` (or, if `w` is -1, to the
+// coordinator) was lost, and exit.
+void DistLost(long long w) {
+  if (w < 0) printf("\nERROR: lost connection to coordinator %s\n", dist_addr);
+  else printf("\nERROR: lost connection to worker %lld\n", w);
+  exit(1);
+}
+
+// Read `n` bytes into `buf` from the connection to worker `w` (or, if
+// `w` is -1, to the coordinator).
+void DistRead(void *buf, long long n, long long w) {
+  if (n > 0 && fread(buf, n, 1, dist_in[w < 0 ? 0 : w]) != 1) DistLost(w);
+  dist_bytes_in += n;
+}
+
+// Write `n` bytes from `buf` to the connection to worker `w` (or, if
+// `w` is -1, to the coordinator); `DistFlush` sends what was written.
+void DistWrite(const void *buf, long long n, long long w) {
+  if (n > 0 && fwrite(buf, n, 1, dist_out[w < 0 ? 0 : w]) != 1) DistLost(w);
+  dist_bytes_out += n;
+}
+
+void DistFlush(long long w) {
+  if (fflush(dist_out[w < 0 ? 0 : w])) DistLost(w);
+}
+
+// Connect to the coordinator at `dist_addr` and read the setup it sends
+// (see `RunCoordinator`): this worker's rank, the training options that
+// must be the same on all workers, and the vocabulary.
+void JoinCoordinator() {
+  long long a, b, cn;
+  int len;
+  char word[MAX_STRING];
+  struct dist_setup st;
+  dist_in = (FILE **)malloc(sizeof(FILE *));
+  dist_out = (FILE **)malloc(sizeof(FILE *));
+  OpenDistStreams(OpenDistSocket(dist_addr, 0), &dist_in[0], &dist_out[0]);
+  DistRead(&st, sizeof(st), -1);
+  if (memcmp(st.magic, DIST_MAGIC, sizeof(st.magic))) {
+    printf("ERROR: %s is not a word2vec coordinator\n", dist_addr);
+    exit(1);
+  }
+  if (st.precision != PARAM_TYPE) {
+    printf("ERROR: coordinator has %s parameters, not %s\n", param_names[st.precision < 0 || st.precision > 2 ? 0 : st.precision],
+     param_names[PARAM_TYPE]);
+    exit(1);
+  }
+  dist_rank = st.rank;
+  dist_workers = st.workers;
+  layer1_size = st.layer1_size;
+  window = st.window;
+  hs = st.hs;
+  negative = st.negative;
+  cbow = st.cbow;
+  batch = st.batch;
+  iter = st.iter;
+  train_words = st.train_words;
+  epoch_words = st.epoch_words;
+  alpha = starting_alpha = st.alpha;
+  alpha_min = st.alpha_min;
+  sample = st.sample;
+  ResetVocab();
+  for (a = 0; a < st.vocab_size; a++) {
+    DistRead(&cn, sizeof(long long), -1);
+    DistRead(&len, sizeof(int), -1);
+    if (len < 0 || len >= MAX_STRING) DistLost(-1);
+    DistRead(word, len, -1);
+    word[len] = 0;
+    b = AddWordToVocab(word, len);
+    vocab[b].cn = cn;
+  }
+  vocab = (struct vocab_word *)realloc(vocab, (vocab_size + 1) * sizeof(struct vocab_word));
+  for (a = 0; a < vocab_size; a++) {
+    vocab[a].code = (char *)calloc(MAX_CODE_LENGTH, sizeof(char));
+    vocab[a].point = (int *)calloc(MAX_CODE_LENGTH, sizeof(int));
+  }
+  if (debug_mode > 0) {
+    printf("Joined coordinator %s as worker %d of %d\n", dist_addr, dist_rank, dist_workers);
+    printf("Vocab size: %lld\n", vocab_size);
+    printf("Words in train file: %lld\n", train_words);
+  }
+}
+
+// Copy the parameters of a worker as initialized by `InitNet` into
+// `dist_base` (out of core too, with `weights_dir`).
+void InitDistBase() {
+  long long m, n = vocab_size * layer1_size;
+  for (m = 0; m < 3; m++) {
+    if (DistMatrix(m) == NULL) continue;
+    dist_base[m] = AllocParams(vocab_size, 128, m == 1);
+    memcpy(dist_base[m], DistMatrix(m), n * sizeof(param));
+  }
+}
+
+// Sync this worker with the coordinator: send the words trained on and
+// the rows changed since the last sync (row of `syn0` minus row of
+// `dist_base`), then apply the merged rows the coordinator sends back.
+// For each merged row `g`, the row becomes itself plus `g` minus its
+// value as of the sync (`dist_base`), so that updates made by training
+// threads since are kept, and `dist_base` becomes `g`.  `done` is 1 if
+// the training threads have finished.  Return 1 if all workers' have
+// (the coordinator's last sync).
+int WorkerSync(int done) {
+  long long a, b, m, index, n = layer1_size;
+  struct dist_sync h;
+  param *p, *q, v;
+  real *g = (real *)malloc(n * sizeof(real));
+  h.words = word_count_actual - dist_words_sent;
+  h.done = done;
+  dist_words_sent += h.words;
+  DistWrite(&h, sizeof(h), -1);
+  for (m = 0; m < 3; m++) {
+    if (DistMatrix(m) == NULL) continue;
+    for (a = 0; a < vocab_size; a++) {
+      p = DistMatrix(m) + a * n;
+      q = dist_base[m] + a * n;
+      if (!memcmp(p, q, n * sizeof(param))) continue;
+      for (b = 0; b < n; b++) {
+        v = p[b];
+        g[b] = ParamToReal(v) - ParamToReal(q[b]);
+        q[b] = v;
+      }
+      index = m * vocab_size + a;
+      DistWrite(&index, sizeof(index), -1);
+      DistWrite(g, n * sizeof(real), -1);
+    }
+  }
+  index = -1;
+  DistWrite(&index, sizeof(index), -1);
+  DistFlush(-1);
+  DistRead(&h, sizeof(h), -1);
+  remote_words = h.words - dist_words_sent;
+  while (1) {
+    DistRead(&index, sizeof(index), -1);
+    if (index < 0) break;
+    if (index >= 3 * vocab_size || DistMatrix(index / vocab_size) == NULL) DistLost(-1);
+    DistRead(g, n * sizeof(real), -1);
+    p = DistMatrix(index / vocab_size) + index % vocab_size * n;
+    q = dist_base[index / vocab_size] + index % vocab_size * n;
+    for (b = 0; b < n; b++) {
+      v = p[b];
+      p[b] = RealToParam(ParamToReal(v) + (g[b] - ParamToReal(q[b])));
+      q[b] = RealToParam(g[b]);
+    }
+  }
+  free(g);
+  dist_syncs++;
+  return h.done;
+}
+
+// Coordinate distributed training: accept `dist_workers` workers on
+// `dist_listen_fd`, send each its setup and the vocabulary (see
+// `JoinCoordinator`), then serve syncs (see `WorkerSync`) until all
+// workers have finished.  In each sync, every row of `syn0`, `syn1`,
+// and `syn1neg` that one or more workers changed gets the average of
+// their changes, and is sent to all workers.
+void RunCoordinator() {
+  long long a, b, m, w, index, rows, total = 0, n = layer1_size;
+  int len;
+  struct dist_setup st;
+  struct dist_sync h, reply;
+  param *p;
+  real *g = (real *)malloc(n * sizeof(real)), *sum;
+  dist_in = (FILE **)malloc(dist_workers * sizeof(FILE *));
+  dist_out = (FILE **)malloc(dist_workers * sizeof(FILE *));
+  dist_count = (int *)calloc(3 * vocab_size, sizeof(int));
+  for (m = 0; m < 3; m++) if (DistMatrix(m) != NULL) {
+    dist_sum[m] = (real *)calloc(vocab_size * n, sizeof(real));
+    if (dist_sum[m] == NULL) {printf("Memory allocation failed\n"); exit(1);}
+  }
+  memset(&st, 0, sizeof(st));
+  memcpy(st.magic, DIST_MAGIC, sizeof(st.magic));
+  st.workers = dist_workers;
+  st.precision = PARAM_TYPE;
+  st.vocab_size = vocab_size;
+  st.layer1_size = layer1_size;
+  st.window = window;
+  st.hs = hs;
+  st.negative = negative;
+  st.cbow = cbow;
+  st.batch = batch;
+  st.iter = iter;
+  st.train_words = train_words;
+  st.epoch_words = epoch_words;
+  st.alpha = starting_alpha;
+  st.alpha_min = alpha_min;
+  st.sample = sample;
+  if (debug_mode > 0) printf("Waiting for %d workers on %s\n", dist_workers, dist_addr);
+  for (w = 0; w < dist_workers; w++) {
+    a = accept(dist_listen_fd, NULL, NULL);
+    if (a < 0) {
+      printf("ERROR: cannot accept workers on %s\n", dist_addr);
+      exit(1);
+    }
+    OpenDistStreams(a, &dist_in[w], &dist_out[w]);
+    st.rank = w;
+    DistWrite(&st, sizeof(st), w);
+    for (a = 0; a < vocab_size; a++) {
+      len = strlen(vocab[a].word);
+      DistWrite(&vocab[a].cn, sizeof(long long), w);
+      DistWrite(&len, sizeof(int), w);
+      DistWrite(vocab[a].word, len, w);
+    }
+    DistFlush(w);
+    if (debug_mode > 0) printf("Worker %lld joined\n", w);
+  }
+  close(dist_listen_fd);
+  if (strchr(dist_addr, '/') != NULL) unlink(dist_addr);
+  start = GetTime();
+  while (1) {
+    reply.done = 1;
+    for (w = 0; w < dist_workers; w++) {
+      DistRead(&h, sizeof(h), w);
+      total += h.words;
+      if (!h.done) reply.done = 0;
+      while (1) {
+        DistRead(&index, sizeof(index), w);
+        if (index < 0) break;
+        if (index >= 3 * vocab_size || DistMatrix(index / vocab_size) == NULL) DistLost(w);
+        DistRead(g, n * sizeof(real), w);
+        sum = dist_sum[index / vocab_size] + index % vocab_size * n;
+        for (b = 0; b < n; b++) sum[b] += g[b];
+        dist_count[index]++;
+      }
+    }
+    reply.words = total;
+    for (w = 0; w < dist_workers; w++) DistWrite(&reply, sizeof(reply), w);
+    rows = 0;
+    for (index = 0; index < 3 * vocab_size; index++) {
+      if (dist_count[index] == 0) continue;
+      p = DistMatrix(index / vocab_size) + index % vocab_size * n;
+      sum = dist_sum[index / vocab_size] + index % vocab_size * n;
+      for (b = 0; b < n; b++) {
+        p[b] = RealToParam(ParamToReal(p[b]) + sum[b] / dist_count[index]);
+        g[b] = ParamToReal(p[b]);
+        sum[b] = 0;
+      }
+      dist_count[index] = 0;
+      for (w = 0; w < dist_workers; w++) {
+        DistWrite(&index, sizeof(index), w);
+        DistWrite(g, n * sizeof(real), w);
+      }
+      rows++;
+    }
+    index = -1;
+    for (w = 0; w < dist_workers; w++) {
+      DistWrite(&index, sizeof(index), w);
+      DistFlush(w);
+    }
+    dist_syncs++;
+    if (debug_mode > 1) {
+      alpha = starting_alpha * (1 - total / (real)(iter * epoch_words + 1));
+      if (alpha < alpha_min) alpha = alpha_min;
+      printf("%cAlpha: %f  Progress: %.2f%%  Words/sec: %.2fk  Rows synced: %lld  ", 13, alpha,
+       total / (real)(iter * epoch_words + 1) * 100, total / (GetTime() - start + 1e-9) / 1000, rows);
+      fflush(stdout);
     }
+    if (reply.done) break;
   }
-  free(count);
-  free(binary);
-  free(parent_node);
+  word_count_actual = total;
+  if (debug_mode > 0) printf("\nSynced %lld times with %d workers, %.2f MB received, %.2f MB sent\n",
+   dist_syncs, dist_workers, dist_bytes_in / 1048576, dist_bytes_out / 1048576);
+  for (w = 0; w < dist_workers; w++) {
+    fclose(dist_in[w]);
+    fclose(dist_out[w]);
+  }
+  for (m = 0; m < 3; m++) free(dist_sum[m]);
+  free(dist_count);
+  free(g);
 }
 
-// Compute vocabulary `vocab` and corresponding hash table `vocab_hash`
-// from text in `train_file`.  Insert </s> as vocab item 0.  Prune vocab
-// incrementally (as needed to keep number of items below effective hash
-// table capacity).  After reading file, sort vocabulary by word count,
-// decreasing.
-void LearnVocabFromTrainFile() {
-  char word[MAX_STRING], eof = 0;
-  FILE *fin;
-  long long a, i, wc = 0;
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-  fin = fopen(train_file, "rb");
-  if (fin == NULL) {
-    printf("ERROR: training data file not found!\n");
+// Streaming mode (`stream`) learns the vocabulary, the negative sampling
+// distribution, and the embeddings in a single pass over `train_file`,
+// which is read sequentially (it can be a pipe, or stdin) by
+// `StreamReaderThread` and handed to the training threads a sentence at
+// a time through `stream_queue`.  Memory is bounded:
+//
+// * The vocabulary holds at most `stream_vocab_size` words (plus "</s>")
+//   and is maintained with the space-saving algorithm: when a new word
+//   is seen and the vocabulary is full, the word with the smallest count
+//   is evicted and the new word takes over its slot (and its count, plus
+//   one), so that counts are overestimates by at most the evicted count.
+//   The slot's rows of `syn0` and `syn1neg` are re-initialized as in
+//   `InitNet`.  `stream_heap` is a min-heap of words by count.
+// * The negative sampling distribution is a weighted reservoir sample
+//   `stream_table` of `stream_table_size` words, in which each word is
+//   represented in proportion to its count raised to the 3/4 power (as in
+//   `InitUnigramTable`).
+//
+// Sentences already queued may still refer to a word that has since been
+// evicted; they are then trained on its successor's fresh rows, which
+// (like Hogwild updates) is tolerated rather than prevented.
+//
+// Only words whose count has reached `min_count` are put into sentences.
+// At the end (see `FinishStream`), words below `min_count` are dropped
+// and the vocabulary is sorted by count, as in `SortVocab`.
+
+// Allocate the bounded vocabulary (with "</s>" in it), negative sampling
+// reservoir, and sentence queue for streaming mode.
+void InitStream() {
+  long long a, size = vocab_hash_init_size;
+  vocab_max_size = stream_vocab_size + 1;
+  vocab = (struct vocab_word *)realloc(vocab, vocab_max_size * sizeof(struct vocab_word));
+  stream_words = (char *)malloc(vocab_max_size * MAX_STRING);
+  stream_heap = (int *)malloc(vocab_max_size * sizeof(int));
+  stream_heap_pos = (int *)malloc(vocab_max_size * sizeof(int));
+  stream_table = (int *)malloc(stream_table_size * sizeof(int));
+  stream_queue_size = 16 * num_threads;
+  stream_queue = (struct stream_sentence *)malloc(stream_queue_size * sizeof(struct stream_sentence));
+  if (vocab == NULL || stream_words == NULL || stream_heap == NULL || stream_heap_pos == NULL ||
+      stream_table == NULL || stream_queue == NULL) {
+    printf("Memory allocation failed\n");
     exit(1);
   }
-  vocab_size = 0;
-  AddWordToVocab((char *)"</s>");
-  while (1) {
-    // TODO: if file is not newline-terminated, last word may be
-    // swallowed
-    ReadWord(word, fin, &eof);
-    if (eof) break;
-    train_words++;
-    wc++;
-    if ((debug_mode > 1) && (wc >= 1000000)) {
-      printf("%lldM%c", train_words / 1000000, 13);
-      fflush(stdout);
-      wc = 0;
+  memset(vocab, 0, vocab_max_size * sizeof(struct vocab_word));
+  for (a = 0; a < vocab_max_size; a++) vocab[a].word = stream_words + a * MAX_STRING;
+  while (vocab_max_size > size * 0.7) size *= 2;
+  ClearVocabHash(size);
+  strcpy(vocab[0].word, "</s>");
+  InsertVocabHash(GetWordHash(vocab[0].word, 4), 4, 0);
+  vocab_size = 1;
+}
+
+// Restore the heap property of `stream_heap` for the word at position
+// `a` of the heap after its count has decreased (or it was added).
+void StreamSiftUp(long long a) {
+  int w = stream_heap[a];
+  long long p;
+  while (a > 0) {
+    p = (a - 1) / 2;
+    if (vocab[stream_heap[p]].cn <= vocab[w].cn) break;
+    stream_heap[a] = stream_heap[p];
+    stream_heap_pos[stream_heap[a]] = a;
+    a = p;
+  }
+  stream_heap[a] = w;
+  stream_heap_pos[w] = a;
+}
+
+// Restore the heap property of `stream_heap` for the word at position
+// `a` of the heap after its count has increased.
+void StreamSiftDown(long long a) {
+  int w = stream_heap[a];
+  long long c, n = vocab_size - 1;
+  while ((c = 2 * a + 1) < n) {
+    if (c + 1 < n && vocab[stream_heap[c + 1]].cn < vocab[stream_heap[c]].cn) c++;
+    if (vocab[w].cn <= vocab[stream_heap[c]].cn) break;
+    stream_heap[a] = stream_heap[c];
+    stream_heap_pos[stream_heap[a]] = a;
+    a = c;
+  }
+  stream_heap[a] = w;
+  stream_heap_pos[w] = a;
+}
+
+// Add the `len` characters at `word` to the vocabulary with count one or,
+// if it is full, in place of the word with the smallest count (see
+// above), re-initializing that word's parameters.  Return the position
+// of `word` in `vocab`.
+int StreamAddWord(char *word, int len, unsigned long long *next_random) {
+  long long a, b;
+  if (vocab_size <= stream_vocab_size) {
+    a = vocab_size;
+    vocab[a].cn = 1;
+    stream_heap[a - 1] = a;
+    vocab_size++;
+    StreamSiftUp(a - 1);
+  } else {
+    a = stream_heap[0];
+    RemoveVocabHash(a);
+    vocab[a].cn++;
+    StreamSiftDown(0);
+    for (b = 0; b < layer1_size; b++) {
+      *next_random = *next_random * (unsigned long long)25214903917 + 11;
+      syn0[a * layer1_size + b] = RealToParam((((*next_random & 0xFFFF) / (real)65536) - 0.5) / layer1_size);
     }
-    i = SearchVocab(word);
-    if (i == -1) {
-      a = AddWordToVocab(word);
-      vocab[a].cn = 1;
-    } else vocab[i].cn++;
-    if (vocab_size > vocab_hash_size * 0.7) ReduceVocab();
+    if (negative > 0) for (b = 0; b < layer1_size; b++) syn1neg[a * layer1_size + b] = 0;
+    stream_evictions++;
   }
-  SortVocab();
-  if (debug_mode > 0) {
-    printf("Vocab size: %lld\n", vocab_size);
-    printf("Words in train file: %lld\n", train_words);
+  memcpy(vocab[a].word, word, len);
+  vocab[a].word[len] = 0;
+  InsertVocabHash(GetWordHash(word, len), len, a);
+  return a;
+}
+
+// Offer one token of word `a`, whose count went from `cn` to
+// `vocab[a].cn`, to the reservoir `stream_table` with weight
+// `vocab[a].cn`^0.75 - `cn`^0.75, so that the total weight offered for
+// each word is its count raised to the 3/4 power (A-Chao weighted
+// reservoir sampling: the token replaces a random entry with probability
+// `stream_table_size` times its share of all weight offered so far).
+void StreamSample(int a, long long cn, unsigned long long *next_random) {
+  double w = pow(vocab[a].cn, 0.75) - pow(cn, 0.75);
+  stream_weight += w;
+  if (stream_table_filled < stream_table_size) {
+    stream_table[stream_table_filled] = a;
+    // (publish the entry before trainers can draw it)
+    __atomic_store_n(&stream_table_filled, stream_table_filled + 1, __ATOMIC_RELEASE);
+    return;
+  }
+  *next_random = *next_random * (unsigned long long)25214903917 + 11;
+  if ((*next_random >> 16) / (double)(1ULL << 48) < stream_table_size * w / stream_weight) {
+    *next_random = *next_random * (unsigned long long)25214903917 + 11;
+    stream_table[(*next_random >> 16) % stream_table_size] = a;
   }
-  file_size = ftell(fin);
-  fclose(fin);
 }
 
-// Write vocabulary `vocab` to file `save_vocab_file`, one word per
-// line, with each line containing a word, a space, the word count, and
-// a newline.
-void SaveVocab() {
-  long long i;
-  FILE *fo = fopen(save_vocab_file, "wb");
-  for (i = 0; i < vocab_size; i++) fprintf(fo, "%s %lld\n", vocab[i].word, vocab[i].cn);
-  fclose(fo);
+// Put sentence `s` into `stream_queue`, waiting while it is full.
+void StreamPush(struct stream_sentence *s) {
+  struct stream_sentence *slot;
+  pthread_mutex_lock(&stream_lock);
+  while (stream_tail - stream_head >= stream_queue_size) pthread_cond_wait(&stream_not_full, &stream_lock);
+  slot = &stream_queue[stream_tail % stream_queue_size];
+  slot->tokens = s->tokens;
+  slot->length = s->length;
+  memcpy(slot->ids, s->ids, s->length * sizeof(int));
+  stream_tail++;
+  pthread_cond_signal(&stream_not_empty);
+  pthread_mutex_unlock(&stream_lock);
 }
 
-// Read vocabulary from file `read_vocab_file` that has one word per
-// line, where each line contains a word, a space, the word count, and a
-// newline.  Store vocabulary in `vocab` and update `vocab_hash`
-// accordingly.  After reading, sort vocabulary by word count,
-// decreasing.
-void ReadVocab() {
-  long long a, i = 0;
-  char c, eof = 0;
-  char word[MAX_STRING];
-  FILE *fin = fopen(read_vocab_file, "rb");
+// Read `train_file` (stdin if it is "-") word by word, updating the
+// vocabulary and `stream_table` and counting tokens in `train_words`, and
+// put the words of each sentence that have reached `min_count` into
+// `stream_queue`; set `stream_closed` at the end of the data.
+void *StreamReaderThread(void *arg) {
+  char word[MAX_STRING], eof = 0;
+  int a, len;
+  long long cn;
+  unsigned long long next_random = 1;
+  struct stream_sentence *s = (struct stream_sentence *)malloc(sizeof(struct stream_sentence));
+  FILE *fin = strcmp(train_file, "-") ? fopen(train_file, "rb") : stdin;
   if (fin == NULL) {
-    printf("Vocabulary file not found\n");
+    printf("ERROR: training data file not found!\n");
     exit(1);
   }
-  for (a = 0; a < vocab_hash_size; a++) vocab_hash[a] = -1;
-  vocab_size = 0;
+  s->tokens = 0;
+  s->length = 0;
   while (1) {
-    // TODO: if file is not newline-terminated, last word may be
-    // swallowed
+    a = -1;
     ReadWord(word, fin, &eof);
+    // (the last word of the data may come with `eof` set)
+    if (word[0] != 0) {
+      len = strlen(word);
+      a = SearchVocab(word, len);
+      if (a == -1) {
+        a = StreamAddWord(word, len, &next_random);
+        cn = vocab[a].cn - 1;
+      } else {
+        cn = vocab[a].cn++;
+        if (a != 0) StreamSiftDown(stream_heap_pos[a]);
+      }
+      if (negative > 0) StreamSample(a, cn, &next_random);
+      train_words++;
+      s->tokens++;
+      if (a != 0 && vocab[a].cn >= min_count) s->ids[s->length++] = a;
+    }
+    if ((eof || a == 0 || s->length >= MAX_SENTENCE_LENGTH) && s->tokens > 0) {
+      StreamPush(s);
+      s->tokens = 0;
+      s->length = 0;
+    }
     if (eof) break;
-    a = AddWordToVocab(word);
-    fscanf(fin, "%lld%c", &vocab[a].cn, &c);
-    i++;
   }
-  SortVocab();
-  if (debug_mode > 0) {
-    printf("Vocab size: %lld\n", vocab_size);
-    printf("Words in train file: %lld\n", train_words);
+  if (fin != stdin) fclose(fin);
+  free(s);
+  pthread_mutex_lock(&stream_lock);
+  stream_closed = 1;
+  pthread_cond_broadcast(&stream_not_empty);
+  pthread_mutex_unlock(&stream_lock);
+  pthread_exit(NULL);
+}
+
+// Take the next sentence from `stream_queue` (waiting while it is empty),
+// add its tokens to `*word_count`, and store its words in `sen`,
+// subsampled as in `TrainModelThread` (with the counts so far).  Return
+// the number of words stored, or -1 if the queue is closed and empty.
+long long ReadStreamSentence(long long *sen, long long *word_count, unsigned long long *next_random) {
+  struct stream_sentence *slot;
+  long long a, n = 0, length;
+  int ids[MAX_SENTENCE_LENGTH];
+  real ran;
+  pthread_mutex_lock(&stream_lock);
+  while (stream_head == stream_tail && !stream_closed) pthread_cond_wait(&stream_not_empty, &stream_lock);
+  if (stream_head == stream_tail) {
+    pthread_mutex_unlock(&stream_lock);
+    return -1;
   }
-  fin = fopen(train_file, "rb");
-  if (fin == NULL) {
-    printf("ERROR: training data file not found!\n");
-    exit(1);
+  slot = &stream_queue[stream_head % stream_queue_size];
+  *word_count += slot->tokens;
+  length = slot->length;
+  memcpy(ids, slot->ids, length * sizeof(int));
+  stream_head++;
+  pthread_cond_signal(&stream_not_full);
+  pthread_mutex_unlock(&stream_lock);
+  for (a = 0; a < length; a++) {
+    if (sample > 0) {
+      ran = (sqrt(vocab[ids[a]].cn / (sample * train_words)) + 1) * (sample * train_words) / vocab[ids[a]].cn;
+      *next_random = *next_random * (unsigned long long)25214903917 + 11;
+      if (ran < (*next_random & 0xFFFF) / (real)65536) continue;
+    }
+    sen[n++] = ids[a];
   }
-  fseek(fin, 0, SEEK_END);
-  file_size = ftell(fin);
-  fclose(fin);
+  return n;
 }
 
-// Allocate memory for and initialize neural network parameters.  Each
-// array has size `vocab_size` x `layer1_size`.
-//
-//   syn0: input word embeddings, initialized uniformly on
-//         [-0.5/`layer1_size`, 0.5/`layer1_size`)
-//   syn1: only used by hierarchical softmax; initialized to 0
-//   syn1neg: output word embeddings; initialized to zero
-void InitNet() {
-  long long a, b;
-  unsigned long long next_random = 1;
-  a = posix_memalign((void **)&syn0, 128, (long long)vocab_size * layer1_size * sizeof(real));
-  if (syn0 == NULL) {printf("Memory allocation failed\n"); exit(1);}
-  if (hs) {
-    a = posix_memalign((void **)&syn1, 128, (long long)vocab_size * layer1_size * sizeof(real));
-    if (syn1 == NULL) {printf("Memory allocation failed\n"); exit(1);}
-    for (a = 0; a < vocab_size; a++) for (b = 0; b < layer1_size; b++)
-     syn1[a * layer1_size + b] = 0;
+// Order positions in `vocab` (pointed to by `a` and `b`) by decreasing
+// word count, then by position.
+int StreamCompare(const void *a, const void *b) {
+  long long x = *(long long *)a, y = *(long long *)b;
+  if (vocab[x].cn != vocab[y].cn) return vocab[x].cn < vocab[y].cn ? 1 : -1;
+  return x < y ? -1 : (x > y);
+}
+
+// After streaming, drop words below `min_count` from the vocabulary,
+// sort it by count (keeping "</s>" first), and move the rows of `syn0`
+// and `syn1neg` accordingly.
+void FinishStream() {
+  long long a, n = 1, *order = (long long *)malloc(vocab_size * sizeof(long long));
+  struct vocab_word *sorted = (struct vocab_word *)calloc(vocab_size, sizeof(struct vocab_word));
+  param *rows = NULL;
+  if (order == NULL || sorted == NULL) {
+    printf("Memory allocation failed\n");
+    exit(1);
   }
-  if (negative>0) {
-    a = posix_memalign((void **)&syn1neg, 128, (long long)vocab_size * layer1_size * sizeof(real));
-    if (syn1neg == NULL) {printf("Memory allocation failed\n"); exit(1);}
-    for (a = 0; a < vocab_size; a++) for (b = 0; b < layer1_size; b++)
-     syn1neg[a * layer1_size + b] = 0;
+  order[0] = 0;
+  for (a = 1; a < vocab_size; a++) if (vocab[a].cn >= min_count) order[n++] = a;
+  qsort(order + 1, n - 1, sizeof(long long), StreamCompare);
+  for (a = 0; a < n; a++) sorted[a] = vocab[order[a]];
+  rows = AllocParams(n, 128, 0);
+  for (a = 0; a < n; a++) memcpy(rows + a * layer1_size, syn0 + order[a] * layer1_size, layer1_size * sizeof(param));
+  FreeParams(syn0, vocab_max_size);
+  syn0 = rows;
+  if (negative > 0) {
+    rows = AllocParams(n, 128, 0);
+    for (a = 0; a < n; a++) memcpy(rows + a * layer1_size, syn1neg + order[a] * layer1_size, layer1_size * sizeof(param));
+    FreeParams(syn1neg, vocab_max_size);
+    syn1neg = rows;
   }
-  for (a = 0; a < vocab_size; a++) for (b = 0; b < layer1_size; b++) {
-    next_random = next_random * (unsigned long long)25214903917 + 11;
-    syn0[a * layer1_size + b] = (((next_random & 0xFFFF) / (real)65536) - 0.5) / layer1_size;
+  free(vocab);
+  vocab = sorted;
+  vocab_size = vocab_max_size = n;
+  // copy words out of `stream_words`
+  RebuildVocab();
+  free(stream_words);
+  free(stream_heap);
+  free(stream_heap_pos);
+  free(stream_table);
+  free(stream_queue);
+  stream_words = NULL;
+  free(order);
+}
+
+// Publish the state of a training thread in its slot `c` of
+// `train_states` (see `thread_checkpoint`).
+static inline void PublishThreadState(struct thread_checkpoint *c, long long pos, long long chunk,
+ unsigned long long next_random) {
+  struct thread_state *st = &c->state[!c->current];
+  st->pos = pos;
+  st->chunk = chunk;
+  st->next_random = next_random;
+  __atomic_store_n(&c->current, !c->current, __ATOMIC_RELEASE);
+}
+
+// Claim the next chunk of training data for the thread with slot `c` of
+// `train_states`: publish the chunk at `work_cursor` as the thread's
+// state, then advance the cursor past it (or, if another thread did so
+// first, try the next one).  Publishing first means that a checkpoint
+// never misses a chunk that has been handed out.  Return the cursor value
+// of the chunk (iteration `chunk` / `num_chunks`, chunk `chunk` %
+// `num_chunks`), or `iter` * `num_chunks` once all have been handed out.
+long long ClaimChunk(struct thread_checkpoint *c, unsigned long long next_random) {
+  long long chunk = __atomic_load_n(&work_cursor, __ATOMIC_RELAXED), last = iter * num_chunks;
+  while (chunk < last) {
+    PublishThreadState(c, chunk_start[chunk % num_chunks], chunk, next_random);
+    if (__atomic_compare_exchange_n(&work_cursor, &chunk, chunk + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      return chunk;
+  }
+  PublishThreadState(c, 0, last, next_random);
+  return last;
+}
+
+// Return the iteration that training thread `a` was in when the
+// checkpoint being resumed from was taken (`iter` if it had finished).
+long long ResumeEpoch(long long a) {
+  long long chunk = resume_states[a].chunk;
+  if (chunk < 0 || chunk >= iter * num_chunks) chunk = work_cursor;
+  return (chunk / num_chunks < iter) ? chunk / num_chunks : iter;
+}
+
+// Return the log-loss of predicting `label` (1 for the output word, 0 for
+// a neg-sample word or, in hierarchical softmax, 1 minus the code bit)
+// with inner product `f`: -log sigmoid(f) or -log sigmoid(-f).  Outside
+// [-MAX_EXP, MAX_EXP] the loss is 0 or |f|, to within e^-MAX_EXP.
+static inline real LogLoss(real f, long long label) {
+  if (!label) f = -f;
+  if (f >= MAX_EXP) return 0;
+  if (f <= -MAX_EXP) return -f;
+  return -logSigTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))];
+}
+
+// Return a pointer to row `w` of the parameters `shared` or, if `w` is
+// less than `hot_words`, of a training thread's private copy `hot` of
+// their first rows.
+static inline param *Row(param *shared, param *hot, long long w) {
+  return (w < hot_words) ? hot + w * layer1_size : shared + w * layer1_size;
+}
+
+// Return the parameters of row `row` as `real`s to train on: the row
+// itself, or with 16-bit parameters, its values converted into `buf`
+// (which `StoreRow` then writes back if they were changed)
+static inline real *LoadRow(param *row, real *buf) {
+#ifdef HALF_PARAMS
+  ParamsToReals(row, buf, layer1_size);
+  return buf;
+#else
+  return row;
+#endif
+}
+
+// With 16-bit parameters, round the values `buf` of row `row` (as
+// returned by `LoadRow` and updated) back into the row, stochastically
+// with `next_random` if `stochastic_round` is set.  Another thread's
+// update of the row in the meantime is lost, as in Hogwild (but more
+// often than with `real` parameters, which are updated in place).
+static inline void StoreRow(param *row, real *buf, unsigned long long *next_random) {
+#ifdef HALF_PARAMS
+  RealsToParams(buf, row, layer1_size, stochastic_round ? next_random : NULL);
+#endif
+}
+
+// Add the changes a training thread made to its private copies `hot` of
+// the first `hot_words` rows of `shared` since the last merge (`base`
+// holds the copies as of then) to `shared`; then refresh `hot` and
+// `base` from `shared` (bringing in the other threads' changes).  As in
+// `MergeReplicas`, the change of a row is divided by the number of
+// threads that changed it: `changers` counts, for each row, the threads
+// training `shared` whose latest merge changed it, and `changed` flags
+// the rows this thread's latest merge changed.  A row only this thread
+// trained moves as far as it did here; the row of a frequent word, which
+// every thread moves most of the way to where its data pulls it, moves
+// that far about once rather than once per thread.  With `last` (the
+// thread's final merge), the thread stops counting among the changers.
+void MergeHotRows(param *shared, param *hot, param *base, int *changers, char *changed, int last) {
+  long long a, b, row;
+  int now, k;
+  for (a = 0; a < hot_words; a++) {
+    row = a * layer1_size;
+    now = memcmp(hot + row, base + row, layer1_size * sizeof(param)) != 0;
+    if (now != changed[a]) {
+      __sync_fetch_and_add(&changers[a], now ? 1 : -1);
+      changed[a] = now;
+    }
+    k = changers[a];       // (at least 1 if `now`, counting this thread)
+    for (b = row; b < row + layer1_size; b++) {
+      if (now) shared[b] = RealToParam(ParamToReal(shared[b]) + (ParamToReal(hot[b]) - ParamToReal(base[b])) / k);
+      hot[b] = base[b] = shared[b];
+    }
+    if (last && changed[a]) {
+      __sync_fetch_and_add(&changers[a], -1);
+      changed[a] = 0;
+    }
   }
-  CreateBinaryTree();
 }
 
 // Given allocated and initialized vocabulary `vocab`, corresponding
 // hash `vocab_hash`, and neural network parameters `syn0`, `syn1`, and
-// `syn1neg`, train word2vec model on 1 / `num_threads` fraction of text
-// in `train_file` (storing learned parameters in `syn0`, `syn1`, and
-// `syn1neg`).  When cast to long long, `id` should be an integer
-// between 0 (inclusive) and `num_threads` (exclusive) representing
-// which training thread this is.
+// `syn1neg`, train word2vec model on chunks of text in `train_file`
+// (storing learned parameters in `syn0`, `syn1`, and `syn1neg`).  When
+// cast to long long, `id` should be an integer between 0 (inclusive) and
+// `num_threads` (exclusive) representing which training thread this is.
+//
+// The training data is cut into many sentence-aligned chunks (see
+// `InitChunks`), which threads claim one at a time, in order, from a
+// shared cursor over all `iter` iterations (see `ClaimChunk`); a fast
+// thread simply trains on more chunks, and all threads stay busy until
+// the last chunk is handed out.
+//
+// With `hot_words`, the rows of the most frequent words (the first rows,
+// as the vocabulary is sorted by count), which every thread would
+// otherwise write constantly, are trained in thread-private copies that
+// are merged into the shared rows every `hot_sync` words (see
+// `MergeHotRows`), so that cache lines holding them do not bounce between
+// cores.
 //
 // Note main loop is broken down into procedures for hierarchical
 // softmax versus negative sampling and those for continuous BOW versus
 // skip-gram; ensure you are looking in the right code block (for your
 // purposes)!  The added comments focus on the SGNS case.
+//
+// With `batch`, skip-gram negative sampling draws `negative` samples
+// once per output word rather than once per (input, output) pair.  The
+// rows of the n input words of the window and the k = 1 + `negative`
+// output/neg-sample words are copied into n x `layer1_size` and
+// k x `layer1_size` matrices; one matrix product gives all n x k inner
+// products, and two more give the gradients of both sides, which are
+// then added to `syn0` and `syn1neg`.  All rows of the minibatch are
+// thus updated from the same (old) parameter values.
+//
+// In streaming mode (`stream`), all threads take sentences from the
+// shared `stream_queue` instead (see `ReadStreamSentence`) and make a
+// single pass.
 void *TrainModelThread(void *id) {
   long long
     a,                     // loop counter among other things
@@ -625,54 +4103,150 @@ void *TrainModelThread(void *id) {
                            //   iteration, as of the most recent
                            //   update of terminal output and learning
                            //   rate
-    l1,                    // input word row offset in syn0
+    last_hot_merge = 0,    // (used by `hot_words`) number of words
+                           //   seen so far as of the most recent merge
+                           //   of hot rows
     l2,                    // output word row offset in syn1, syn1neg
     c,                     // loop counter among other things
     target,                // index of output word or negatively-sampled
                            //   word in vocabulary
     label,                 // switch between output word (1) and
                            //   negatively-sampled word (0)
-    local_iter = iter;     // iterations over this thread's chunk of the
-                           //   data set left
+    ni,                    // (used by `batch`) number of input words
+    no,                    // (used by `batch`) number of output and
+                           //   neg-sample words
+    chunk = -1,            // `work_cursor` value of current chunk
+    chunk_end = 0,         // end of current chunk (position in
+                           //   training data)
+    pos = 0;               // position in `encoded_ids` (if training on
+                           //   encoded data) or byte offset in
+                           //   `train_data`
   long long
     sen[MAX_SENTENCE_LENGTH + 1]; // index of word in vocabulary for
                                   //   each word in current sentence
   unsigned long long
     next_random = (long long)id;  // thread-specific RNG state
   char eof = 0;            // 1 if end of file has been reached
+  long long hot_node =     // (used by `hot_words`) offset of this
+    (numa == 2) ? (long long)id % num_nodes * hot_words : 0; // thread's
+                           //   node in `hot_syn0_changers` and
+                           //   `hot_syn1neg_changers`
+  char
+    *hot_syn0_changed = NULL,    // (used by `hot_words`) flags of the hot
+    *hot_syn1neg_changed = NULL; //   rows this thread's latest merge
+                                 //   changed (see `MergeHotRows`)
   real f, g;               // work space (values of sub-expressions in
                            //   gradient computation)
-  clock_t now;             // current time during training
+  double read_start;       // time we started reading current sentence
+  double loss_sum = 0;     // (if `loss` is set) log-loss and number of
+  long long                //   predictions since last update of `stats`
+    loss_count = 0;
+  struct thread_stats
+    *stats = train_stats + (long long)id; // this thread's statistics
+  struct thread_checkpoint
+    *state = train_states + (long long)id; // this thread's state
+  // parameters this thread trains (its node's replicas if `numa` is 2)
+  param
+    *syn0_local = (numa == 2) ? syn0_replica[(long long)id % num_nodes] : syn0,
+    *syn1neg_local = (numa == 2) ? syn1neg_replica[(long long)id % num_nodes] : syn1neg,
+    *hot_syn0 = NULL,      // (used by `hot_words`) this thread's copies
+    *hot_syn1neg = NULL,   //   of the first `hot_words` rows of `syn0`
+    *hot_syn0_base = NULL, //   and `syn1neg`, and those rows as of the
+    *hot_syn1neg_base = NULL; // most recent merge (see `MergeHotRows`)
+  real
+    *in_row,               // input word row and output/neg-sample word
+    *out_row;              //   row (see `Row` and `LoadRow`)
   // allocate memory for gradients
   real
     *neu1 = (real *)calloc(layer1_size, sizeof(real)),
-    *neu1e = (real *)calloc(layer1_size, sizeof(real));
-  FILE *fi = fopen(train_file, "rb");
+    *neu1e = (real *)calloc(layer1_size, sizeof(real)),
+    *in_buf = (real *)calloc(layer1_size, sizeof(real)),  // (with 16-bit
+    *out_buf = (real *)calloc(layer1_size, sizeof(real)), //   parameters)
+                            //   `in_row` and `out_row`
+    *batch_in = NULL,       // (used by `batch`) input word rows,
+    *batch_in_grad = NULL,  //   their gradients, output/neg-sample
+    *batch_out = NULL,      //   word rows, their gradients, and inner
+    *batch_out_grad = NULL, //   products (turned into gradient
+    *batch_g = NULL;        //   coefficients)
+  long long
+    *batch_words = NULL,   // (used by `batch`) indices of input words
+    *batch_targets = NULL; //   and output/neg-sample words
+  if (batch) {
+    batch_in = (real *)calloc(2 * window * layer1_size, sizeof(real));
+    batch_in_grad = (real *)calloc(2 * window * layer1_size, sizeof(real));
+    batch_out = (real *)calloc((negative + 1) * layer1_size, sizeof(real));
+    batch_out_grad = (real *)calloc((negative + 1) * layer1_size, sizeof(real));
+    batch_g = (real *)calloc(2 * window * (negative + 1), sizeof(real));
+    batch_words = (long long *)calloc(2 * window, sizeof(long long));
+    batch_targets = (long long *)calloc(negative + 1, sizeof(long long));
+  }
 
-  fseek(fi, file_size / (long long)num_threads * (long long)id, SEEK_SET);
+  if (numa) PinThread((long long)id);
+  if (hot_words > 0) {
+    hot_syn0_changed = (char *)calloc(hot_words, sizeof(char));
+    hot_syn1neg_changed = (char *)calloc(hot_words, sizeof(char));
+    hot_syn0 = (param *)malloc(hot_words * layer1_size * sizeof(param));
+    hot_syn0_base = (param *)malloc(hot_words * layer1_size * sizeof(param));
+    memcpy(hot_syn0, syn0_local, hot_words * layer1_size * sizeof(param));
+    memcpy(hot_syn0_base, syn0_local, hot_words * layer1_size * sizeof(param));
+    if (negative > 0) {
+      hot_syn1neg = (param *)malloc(hot_words * layer1_size * sizeof(param));
+      hot_syn1neg_base = (param *)malloc(hot_words * layer1_size * sizeof(param));
+      memcpy(hot_syn1neg, syn1neg_local, hot_words * layer1_size * sizeof(param));
+      memcpy(hot_syn1neg_base, syn1neg_local, hot_words * layer1_size * sizeof(param));
+    }
+  }
+  stats->start_time = GetTime();
+
+  // start with an empty chunk (so that the first one is claimed right
+  // away), or pick up where the checkpoint left off (at the start of the
+  // sentence after the one being trained on when it was taken)
+  if (resume_states != NULL) {
+    chunk = resume_states[(long long)id].chunk;
+    if (chunk >= 0 && chunk < iter * num_chunks) {
+      pos = resume_states[(long long)id].pos;
+      chunk_end = chunk_start[chunk % num_chunks + 1];
+    }
+    next_random = resume_states[(long long)id].next_random;
+    stats->epochs = ResumeEpoch((long long)id);
+  }
+  PublishThreadState(state, pos, chunk, next_random);
 
   // iteratively read a sentence and train (update gradients) over it;
-  // read over all sentences in this thread's chunk of the training
-  // data `iter` times, then break
+  // read over all sentences in each chunk claimed, then claim the next
+  // one, until all chunks of all `iter` iterations have been handed out
   while (1) {
-    // every 10k words, update progress in terminal and update learning
-    // rate
+    // every `hot_sync` words, merge this thread's hot rows into the
+    // shared ones
+    if (hot_words > 0 && word_count - last_hot_merge >= hot_sync) {
+      MergeHotRows(syn0_local, hot_syn0, hot_syn0_base, hot_syn0_changers + hot_node, hot_syn0_changed, 0);
+      if (negative > 0) MergeHotRows(syn1neg_local, hot_syn1neg, hot_syn1neg_base, hot_syn1neg_changers + hot_node, hot_syn1neg_changed, 0);
+      last_hot_merge = word_count;
+    }
+
+    // every 10k words, update progress (reported by `MonitorThread`)
+    // and update learning rate
     if (word_count - last_word_count > 10000) {
-      word_count_actual += word_count - last_word_count;
+      __sync_fetch_and_add(&word_count_actual, word_count - last_word_count);
+      stats->words += word_count - last_word_count;
+      stats->loss += loss_sum;
+      stats->loss_count += loss_count;
+      loss_sum = 0;
+      loss_count = 0;
       last_word_count = word_count;
-      if ((debug_mode > 1)) {
-        now=clock();
-        printf("%cAlpha: %f  Progress: %.2f%%  Words/thread/sec: %.2fk  ", 13, alpha,
-         word_count_actual / (real)(iter * train_words + 1) * 100,
-         word_count_actual / ((real)(now - start + 1) / (real)CLOCKS_PER_SEC * 1000));
-        fflush(stdout);
-      }
+      PublishThreadState(state, pos, chunk, next_random);
       // linear-decay learning rate (decreases from one toward zero
       // linearly in number of words seen, but thresholded below
-      // at one ten-thousandth of initial learning rate)
-      // (each word in the data is to be seen `iter` times)
-      alpha = starting_alpha * (1 - word_count_actual / (real)(iter * train_words + 1));
-      if (alpha < starting_alpha * 0.0001) alpha = starting_alpha * 0.0001;
+      // at `alpha_min`, by default one ten-thousandth of initial
+      // learning rate)
+      // (each word in the data is to be seen `iter` times, counting
+      // the words other workers of distributed training trained on; in
+      // streaming mode the number of words may be unknown, and then the
+      // learning rate stays at `starting_alpha`)
+      if (epoch_words > 0) {
+        alpha = starting_alpha * (1 - (word_count_actual + remote_words) / (real)(iter * epoch_words + 1));
+        if (alpha < alpha_min) alpha = alpha_min;
+      }
     }
 
     // if we have finished training on the most recently-read sentence
@@ -680,9 +4254,22 @@ void *TrainModelThread(void *id) {
     // truncate each sentence at `MAX_SENTENCE_LENGTH` words (sentences
     // longer than that will be broken up into smaller sentences)
     if (sentence_length == 0) {
-      // iteratively read word and add to sentence
-      while (1) {
-        word = ReadWordIndex(fi, &eof);
+      read_start = GetTime();
+      // in streaming mode, take subsampled sentences from the reader
+      // (skipping empty ones) until it has no more
+      if (stream) {
+        do sentence_length = ReadStreamSentence(sen, &word_count, &next_random);
+        while (sentence_length == 0);
+        if (sentence_length < 0) {
+          sentence_length = 0;
+          eof = 1;
+        }
+      }
+      // otherwise iteratively read word and add to sentence, up to the
+      // end of the chunk
+      else while (pos < chunk_end) {
+        if (encoded_ids != NULL) word = ReadEncodedWordIndex(&pos, &eof);
+        else word = ReadWordIndex(&pos, &eof);
         if (eof) break;
         // skip OOV
         if (word == -1) continue;
@@ -708,23 +4295,47 @@ void *TrainModelThread(void *id) {
         if (sentence_length >= MAX_SENTENCE_LENGTH) break;
       }
 
+      // with out-of-core parameters, have the rows of the sentence's
+      // words read in while training on it begins
+      if (weights_dir[0] != 0) {
+        PrefetchRows(syn0, sen, sentence_length);
+        if (negative > 0) PrefetchRows(syn1neg, sen, sentence_length);
+      }
+
       // set output word position to first word in sentence
       sentence_position = 0;
+      stats->read_time += GetTime() - read_start;
     }
 
-    // if we are at the end of this iteration (sweep over the data),
-    // restart and decrement `local_iter`
-    if (eof || (word_count > train_words / num_threads)) {
-      word_count_actual += word_count - last_word_count;
-      local_iter--;
-      if (local_iter == 0) break;
-      word_count = 0;
-      last_word_count = 0;
-      // signal to read new sentence
-      sentence_length = 0;
-      fseek(fi, file_size / (long long)num_threads * (long long)id, SEEK_SET);
+    // if we are at the end of this chunk, claim the next one (in
+    // streaming mode, stop when the reader has no more sentences)
+    if (sentence_length == 0 && (eof || pos >= chunk_end)) {
+      stats->loss += loss_sum;
+      stats->loss_count += loss_count;
+      loss_sum = 0;
+      loss_count = 0;
+      chunk = stream ? iter * num_chunks : ClaimChunk(state, next_random);
+      // the iterations before the new chunk's are over for this thread
+      a = (chunk / num_chunks < iter) ? chunk / num_chunks : iter;
+      while (stats->epochs < a) {
+        if (loss) {
+          epoch_loss[(long long)id * iter + stats->epochs] = stats->loss;
+          epoch_loss_count[(long long)id * iter + stats->epochs] = stats->loss_count;
+        }
+        __atomic_store_n(&stats->epochs, stats->epochs + 1, __ATOMIC_RELEASE);
+      }
+      if (chunk >= iter * num_chunks) {
+        __sync_fetch_and_add(&word_count_actual, word_count - last_word_count);
+        stats->words += word_count - last_word_count;
+        break;
+      }
+      pos = chunk_start[chunk % num_chunks];
+      chunk_end = chunk_start[chunk % num_chunks + 1];
+      eof = 0;
       continue;
     }
+    // skip empty sentences (all words OOV or discarded by subsampling)
+    if (sentence_length == 0) continue;
 
     // get index of output word
     word = sen[sentence_position];
@@ -748,27 +4359,29 @@ void *TrainModelThread(void *id) {
         if (c >= sentence_length) continue;
         last_word = sen[c];
         if (last_word == -1) continue;
-        for (c = 0; c < layer1_size; c++) neu1[c] += syn0[c + last_word * layer1_size];
+        Axpy(1, LoadRow(Row(syn0_local, hot_syn0, last_word), in_buf), neu1, layer1_size);
         cw++;
       }
       if (cw) {
         for (c = 0; c < layer1_size; c++) neu1[c] /= cw;
+        if (loss) loss_count++;
 
         // CBOW HIERARCHICAL SOFTMAX
         if (hs) for (d = 0; d < vocab[word].codelen; d++) {
-          f = 0;
           l2 = vocab[word].point[d] * layer1_size;
+          out_row = LoadRow(syn1 + l2, out_buf);
           // Propagate hidden -> output
-          for (c = 0; c < layer1_size; c++) f += neu1[c] * syn1[c + l2];
+          f = DotProduct(neu1, out_row, layer1_size);
+          if (loss) loss_sum += LogLoss(f, 1 - vocab[word].code[d]);
           if (f <= -MAX_EXP) continue;
           else if (f >= MAX_EXP) continue;
           else f = expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))];
           // 'g' is the gradient multiplied by the learning rate
           g = (1 - vocab[word].code[d] - f) * alpha;
-          // Propagate errors output -> hidden
-          for (c = 0; c < layer1_size; c++) neu1e[c] += g * syn1[c + l2];
-          // Learn weights hidden -> output
-          for (c = 0; c < layer1_size; c++) syn1[c + l2] += g * neu1[c];
+          // Propagate errors output -> hidden and learn weights hidden
+          // -> output
+          DualAxpy(g, out_row, neu1, neu1e, layer1_size);
+          StoreRow(syn1 + l2, out_row, &next_random);
         }
 
         // CBOW NEGATIVE SAMPLING
@@ -777,20 +4390,19 @@ void *TrainModelThread(void *id) {
             target = word;
             label = 1;
           } else {
-            next_random = next_random * (unsigned long long)25214903917 + 11;
-            target = table[(next_random >> 16) % table_size];
-            if (target == 0) target = next_random % (vocab_size - 1) + 1;
+            target = DrawNegative(&next_random);
             if (target == word) continue;
             label = 0;
           }
           l2 = target * layer1_size;
-          f = 0;
-          for (c = 0; c < layer1_size; c++) f += neu1[c] * syn1neg[c + l2];
+          out_row = LoadRow(Row(syn1neg_local, hot_syn1neg, target), out_buf);
+          f = DotProduct(neu1, out_row, layer1_size);
+          if (loss) loss_sum += LogLoss(f, label);
           if (f > MAX_EXP) g = (label - 1) * alpha;
           else if (f < -MAX_EXP) g = (label - 0) * alpha;
           else g = (label - expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))]) * alpha;
-          for (c = 0; c < layer1_size; c++) neu1e[c] += g * syn1neg[c + l2];
-          for (c = 0; c < layer1_size; c++) syn1neg[c + l2] += g * neu1[c];
+          DualAxpy(g, out_row, neu1, neu1e, layer1_size);
+          StoreRow(Row(syn1neg_local, hot_syn1neg, target), out_row, &next_random);
         }
 
         // hidden -> in
@@ -800,12 +4412,15 @@ void *TrainModelThread(void *id) {
           if (c >= sentence_length) continue;
           last_word = sen[c];
           if (last_word == -1) continue;
-          for (c = 0; c < layer1_size; c++) syn0[c + last_word * layer1_size] += neu1e[c];
+          in_row = LoadRow(Row(syn0_local, hot_syn0, last_word), in_buf);
+          Axpy(1, neu1e, in_row, layer1_size);
+          StoreRow(Row(syn0_local, hot_syn0, last_word), in_row, &next_random);
         }
       }
 
     // SKIP-GRAM
     } else {
+      ni = 0;
       // loop over offsets within dynamic window
       // (relative to max window size)
       for (a = b; a < window * 2 + 1 - b; a++) if (a != window) {
@@ -821,26 +4436,37 @@ void *TrainModelThread(void *id) {
         last_word = sen[c];
         // skip OOV (TODO checked already, should never fire)
         if (last_word == -1) continue;
-        // compute input word row offset
-        l1 = last_word * layer1_size;
+        // find input word row
+        in_row = LoadRow(Row(syn0_local, hot_syn0, last_word), in_buf);
         // initialize gradient for input word (work space)
         for (c = 0; c < layer1_size; c++) neu1e[c] = 0;
+        if (loss) loss_count++;
 
         // SKIP-GRAM HIERARCHICAL SOFTMAX
         if (hs) for (d = 0; d < vocab[word].codelen; d++) {
-          f = 0;
           l2 = vocab[word].point[d] * layer1_size;
+          out_row = LoadRow(syn1 + l2, out_buf);
           // Propagate hidden -> output
-          for (c = 0; c < layer1_size; c++) f += syn0[c + l1] * syn1[c + l2];
+          f = DotProduct(in_row, out_row, layer1_size);
+          if (loss) loss_sum += LogLoss(f, 1 - vocab[word].code[d]);
           if (f <= -MAX_EXP) continue;
           else if (f >= MAX_EXP) continue;
           else f = expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))];
           // 'g' is the gradient multiplied by the learning rate
           g = (1 - vocab[word].code[d] - f) * alpha;
-          // Propagate errors output -> hidden
-          for (c = 0; c < layer1_size; c++) neu1e[c] += g * syn1[c + l2];
-          // Learn weights hidden -> output
-          for (c = 0; c < layer1_size; c++) syn1[c + l2] += g * syn0[c + l1];
+          // Propagate errors output -> hidden and learn weights hidden
+          // -> output
+          DualAxpy(g, out_row, in_row, neu1e, layer1_size);
+          StoreRow(syn1 + l2, out_row, &next_random);
+        }
+
+        // with shared negative samples, just collect the input word
+        // (with its gradient so far) for the minibatch below
+        if (batch && negative > 0) {
+          memcpy(batch_in + ni * layer1_size, in_row, layer1_size * sizeof(real));
+          memcpy(batch_in_grad + ni * layer1_size, neu1e, layer1_size * sizeof(real));
+          batch_words[ni++] = last_word;
+          continue;
         }
 
         // SKIP-GRAM NEGATIVE SAMPLING
@@ -851,31 +4477,75 @@ void *TrainModelThread(void *id) {
             label = 1;
           } else {
             // fetch negative-sampled word
-            next_random = next_random * (unsigned long long)25214903917 + 11;
-            target = table[(next_random >> 16) % table_size];
-            if (target == 0) target = next_random % (vocab_size - 1) + 1;
+            target = DrawNegative(&next_random);
             if (target == word) continue;
             label = 0;
           }
           l2 = target * layer1_size; // output/neg-sample word row offset
           // compute f = < v_{w_I}', v_{w_O} >
           // (inner product for neg sample)
-          f = 0;
-          for (c = 0; c < layer1_size; c++) f += syn0[c + l1] * syn1neg[c + l2];
+          out_row = LoadRow(Row(syn1neg_local, hot_syn1neg, target), out_buf);
+          f = DotProduct(in_row, out_row, layer1_size);
+          if (loss) loss_sum += LogLoss(f, label);
           // compute gradient coeff g = alpha * (label - 1 / (e^-f + 1))
           // (alpha is learning rate, label is 1 for output and 0 for neg)
           if (f > MAX_EXP) g = (label - 1) * alpha;
           else if (f < -MAX_EXP) g = (label - 0) * alpha;
           else g = (label - expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))]) * alpha;
-          // contribute to gradient for input word
-          for (c = 0; c < layer1_size; c++) neu1e[c] += g * syn1neg[c + l2];
-          // perform gradient step for output/neg-sample word
-          for (c = 0; c < layer1_size; c++) syn1neg[c + l2] += g * syn0[c + l1];
+          // contribute to gradient for input word and perform gradient
+          // step for output/neg-sample word
+          DualAxpy(g, out_row, in_row, neu1e, layer1_size);
+          StoreRow(Row(syn1neg_local, hot_syn1neg, target), out_row, &next_random);
         }
 
         // now that we've taken gradient step for output and all neg sample
         // words, take gradient step for input word
-        for (c = 0; c < layer1_size; c++) syn0[c + l1] += neu1e[c];
+        Axpy(1, neu1e, in_row, layer1_size);
+        StoreRow(Row(syn0_local, hot_syn0, last_word), in_row, &next_random);
+      }
+
+      // SKIP-GRAM NEGATIVE SAMPLING, SHARED NEGATIVES
+      if (ni) {
+        // fetch output word and neg-sample words (once for the whole
+        // window)
+        no = 0;
+        for (d = 0; d < negative + 1; d++) {
+          if (d == 0) {
+            target = word;
+          } else {
+            target = DrawNegative(&next_random);
+            if (target == word) continue;
+          }
+          memcpy(batch_out + no * layer1_size, LoadRow(Row(syn1neg_local, hot_syn1neg, target), out_buf), layer1_size * sizeof(real));
+          batch_targets[no++] = target;
+        }
+        for (c = 0; c < no * layer1_size; c++) batch_out_grad[c] = 0;
+        // compute all inner products f = < v_{w_I}', v_{w_O} >, then
+        // turn each into its gradient coeff g (output word is column 0)
+        DotBlock(batch_in, ni, batch_out, no, batch_g, layer1_size);
+        for (a = 0; a < ni; a++) for (d = 0; d < no; d++) {
+          f = batch_g[a * no + d];
+          label = (d == 0);
+          if (loss) loss_sum += LogLoss(f, label);
+          if (f > MAX_EXP) g = (label - 1) * alpha;
+          else if (f < -MAX_EXP) g = (label - 0) * alpha;
+          else g = (label - expTable[(int)((f + MAX_EXP) * (EXP_TABLE_SIZE / MAX_EXP / 2))]) * alpha;
+          batch_g[a * no + d] = g;
+        }
+        // gradients for input words (G x output rows) and output/neg-
+        // sample words (G^T x input rows), then gradient steps for all
+        AxpyBlock(batch_g, no, 1, batch_out, no, batch_in_grad, ni, layer1_size);
+        AxpyBlock(batch_g, 1, no, batch_in, ni, batch_out_grad, no, layer1_size);
+        for (a = 0; a < ni; a++) {
+          in_row = LoadRow(Row(syn0_local, hot_syn0, batch_words[a]), in_buf);
+          Axpy(1, batch_in_grad + a * layer1_size, in_row, layer1_size);
+          StoreRow(Row(syn0_local, hot_syn0, batch_words[a]), in_row, &next_random);
+        }
+        for (d = 0; d < no; d++) {
+          out_row = LoadRow(Row(syn1neg_local, hot_syn1neg, batch_targets[d]), out_buf);
+          Axpy(1, batch_out_grad + d * layer1_size, out_row, layer1_size);
+          StoreRow(Row(syn1neg_local, hot_syn1neg, batch_targets[d]), out_row, &next_random);
+        }
       }
     }
 
@@ -888,10 +4558,222 @@ void *TrainModelThread(void *id) {
     }
   }
 
+  if (hot_words > 0) {
+    MergeHotRows(syn0_local, hot_syn0, hot_syn0_base, hot_syn0_changers + hot_node, hot_syn0_changed, 1);
+    if (negative > 0) MergeHotRows(syn1neg_local, hot_syn1neg, hot_syn1neg_base, hot_syn1neg_changers + hot_node, hot_syn1neg_changed, 1);
+  }
+
   // clean up
-  fclose(fi);
   free(neu1);
   free(neu1e);
+  free(in_buf);
+  free(out_buf);
+  free(batch_in);
+  free(batch_in_grad);
+  free(batch_out);
+  free(batch_out_grad);
+  free(batch_g);
+  free(batch_words);
+  free(batch_targets);
+  free(hot_syn0);
+  free(hot_syn1neg);
+  free(hot_syn0_base);
+  free(hot_syn1neg_base);
+  free(hot_syn0_changed);
+  free(hot_syn1neg_changed);
+  stats->end_time = GetTime();
+  pthread_exit(NULL);
+}
+
+// Report training progress while training threads run, until
+// `training_done` is set: every 0.1 seconds (if `debug_mode` is greater
+// than 1) on the terminal, and every `stats_interval` seconds (and once
+// at the end) as a line of JSON in `stats_file`, if set.  Rates are in
+// words per second of wall time; the ETA assumes the overall rate so
+// far.  Each thread's time is split into reading (tokenizing and
+// subsampling sentences) and computing (everything else).  In streaming
+// mode, the number of words to train on is unknown (unless `epoch_words`
+// was given), so words read are reported instead of progress and ETA.
+//
+// If `loss` is set, also report the average log-loss per prediction
+// over each interval of `stats_interval` seconds and, once all threads
+// have finished it, over each iteration.
+//
+// If `checkpoint_file` is set, write a checkpoint every
+// `checkpoint_interval` seconds from a forked child process (see
+// `WriteCheckpoint`); training only pauses for the fork itself.  At
+// most one checkpoint is written at a time, and the last one is waited
+// for before returning.
+//
+// If `numa` is set, also report words per second of each NUMA node, and
+// if it is 2, merge the nodes' parameter replicas every
+// `numa_sync_interval` seconds (see `SyncReplicas`).
+//
+// With out-of-core parameters (`weights_dir`), also report major page
+// faults, which had to wait for rows to be read from disk.
+//
+// If this is a worker of distributed training, sync with the
+// coordinator every `dist_sync_interval` seconds (see `WorkerSync`);
+// progress, words per second, and the ETA then count the words of all
+// workers as of the last sync.
+void *MonitorThread(void *arg) {
+  long long a, b, words, total = iter * epoch_words + 1;
+  long long
+    loss_count,            // predictions in `loss_sum`
+    last_loss_count = 0,   // ... as of last interval
+    epochs_done = 0;       // iterations whose loss has been reported
+  double now, elapsed, rate, eta, thread_elapsed, thread_sum, read_sum, last_stats, last_checkpoint, last_sync, last_dist_sync;
+  double
+    loss_sum,              // log-loss over all threads so far
+    last_loss_sum = 0,     // ... as of last interval
+    interval_loss = 0,     // average log-loss over last interval
+    *epoch_avg = NULL,     // average log-loss over each iteration
+    sum;
+  int done, status;
+  pid_t checkpoint_pid = 0;  // process writing a checkpoint (0 if none)
+  FILE *fs = NULL;
+  if (loss) epoch_avg = (double *)calloc(iter, sizeof(double));
+  // when resuming, iterations all threads had finished were reported
+  // before the checkpoint
+  if (resume_states != NULL) {
+    epochs_done = iter;
+    for (a = 0; a < num_threads; a++)
+      if (ResumeEpoch(a) < epochs_done) epochs_done = ResumeEpoch(a);
+    for (a = 0; a < epochs_done && loss; a++) epoch_avg[a] = NAN;
+  }
+  if (stats_file[0] != 0) {
+    fs = fopen(stats_file, "wb");
+    if (fs == NULL) {
+      printf("ERROR: stats file %s could not be opened\n", stats_file);
+      exit(1);
+    }
+  }
+  last_stats = last_checkpoint = last_sync = last_dist_sync = GetTime();
+  while (1) {
+    done = training_done;
+    now = GetTime();
+    words = word_count_actual + remote_words;
+    elapsed = now - start;
+    rate = (words - start_words) / (elapsed + 1e-9);
+    eta = (words < total) ? (total - words) / (rate + 1e-9) : 0;
+    thread_sum = read_sum = loss_sum = 0;
+    loss_count = 0;
+    for (a = 0; a < num_threads; a++) {
+      if (train_stats[a].start_time == 0) continue;
+      thread_sum += (train_stats[a].end_time != 0 ? train_stats[a].end_time : now) - train_stats[a].start_time;
+      read_sum += train_stats[a].read_time;
+      loss_sum += train_stats[a].loss;
+      loss_count += train_stats[a].loss_count;
+    }
+    // report loss of each iteration finished by all threads
+    while (loss && epochs_done < iter) {
+      for (a = 0; a < num_threads; a++)
+        if (__atomic_load_n(&train_stats[a].epochs, __ATOMIC_ACQUIRE) <= epochs_done) break;
+      if (a < num_threads) break;
+      sum = 0;
+      b = 0;
+      for (a = 0; a < num_threads; a++) {
+        sum += epoch_loss[a * iter + epochs_done];
+        b += epoch_loss_count[a * iter + epochs_done];
+        if (epochs_done > 0) {
+          sum -= epoch_loss[a * iter + epochs_done - 1];
+          b -= epoch_loss_count[a * iter + epochs_done - 1];
+        }
+      }
+      // (NAN if no thread made any prediction in this iteration)
+      epoch_avg[epochs_done] = (b > 0) ? sum / b : NAN;
+      if (debug_mode > 0) {
+        if (b > 0) printf("%cIteration %lld loss: %f%40s\n", 13, epochs_done + 1, epoch_avg[epochs_done], "");
+        else printf("%cIteration %lld loss: n/a (no predictions)%40s\n", 13, epochs_done + 1, "");
+      }
+      epochs_done++;
+    }
+    if (loss && last_loss_count == 0) interval_loss = loss_sum / (loss_count + 1e-9);
+    if (debug_mode > 1) {
+      if (epoch_words > 0) printf("%cAlpha: %f  Progress: %.2f%%  Words/sec: %.2fk  Words/thread/sec: %.2fk  Reading: %.1f%%  ETA: %lld:%02lld:%02lld  ", 13, alpha,
+       words / (real)total * 100, rate / 1000, rate / num_threads / (dist ? dist_workers : 1) / 1000,
+       read_sum / (thread_sum + 1e-9) * 100,
+       (long long)eta / 3600, (long long)eta / 60 % 60, (long long)eta % 60);
+      else printf("%cAlpha: %f  Words: %.2fM  Vocab: %lld  Words/sec: %.2fk  Words/thread/sec: %.2fk  Reading: %.1f%%  ", 13, alpha,
+       words / 1e6, vocab_size, rate / 1000, rate / num_threads / (dist ? dist_workers : 1) / 1000,
+       read_sum / (thread_sum + 1e-9) * 100);
+      if (loss) printf("Loss: %.4f  ", interval_loss);
+      if (weights_dir[0] != 0) printf("Faults/sec: %.1f  ", (MajorFaults() - start_faults) / (elapsed + 1e-9));
+      fflush(stdout);
+    }
+    if (done || now - last_stats >= stats_interval) {
+      if (loss_count > last_loss_count) interval_loss = (loss_sum - last_loss_sum) / (loss_count - last_loss_count);
+      last_loss_sum = loss_sum;
+      last_loss_count = loss_count;
+    }
+    if (fs != NULL && (done || now - last_stats >= stats_interval)) {
+      if (epoch_words > 0) fprintf(fs, "{\"time\": %.3f, \"done\": %s, \"progress\": %.6f, \"alpha\": %f, \"words\": %lld, \"words_per_sec\": %.1f, \"eta\": %.1f, ",
+       elapsed, done ? "true" : "false", words / (double)total, alpha, words, rate, eta);
+      else fprintf(fs, "{\"time\": %.3f, \"done\": %s, \"progress\": null, \"alpha\": %f, \"words\": %lld, \"words_per_sec\": %.1f, \"eta\": null, ",
+       elapsed, done ? "true" : "false", alpha, words, rate);
+      if (loss) {
+        fprintf(fs, "\"loss\": %f, \"epoch_loss\": [", interval_loss);
+        for (a = 0; a < epochs_done; a++) {
+          if (isnan(epoch_avg[a])) fprintf(fs, "%snull", a ? ", " : "");
+          else fprintf(fs, "%s%f", a ? ", " : "", epoch_avg[a]);
+        }
+        fprintf(fs, "], ");
+      }
+      if (weights_dir[0] != 0) fprintf(fs, "\"major_faults\": %lld, ", MajorFaults() - start_faults);
+      fprintf(fs, "\"threads\": [");
+      for (a = 0; a < num_threads; a++) {
+        thread_elapsed = 0;
+        if (train_stats[a].start_time != 0) thread_elapsed = (train_stats[a].end_time != 0 ? train_stats[a].end_time : now) - train_stats[a].start_time;
+        fprintf(fs, "%s{\"words\": %lld, \"words_per_sec\": %.1f, \"read_time\": %.3f, \"compute_time\": %.3f}", a ? ", " : "",
+         train_stats[a].words, train_stats[a].words / (thread_elapsed + 1e-9),
+         train_stats[a].read_time, thread_elapsed - train_stats[a].read_time);
+      }
+      fprintf(fs, "]");
+      if (numa) {
+        fprintf(fs, ", \"nodes\": [");
+        for (b = 0; b < num_nodes; b++) {
+          words = 0;
+          for (a = b; a < num_threads; a += num_nodes) words += train_stats[a].words;
+          fprintf(fs, "%s{\"node\": %d, \"words\": %lld, \"words_per_sec\": %.1f}", b ? ", " : "", node_id[b], words, words / (elapsed + 1e-9));
+        }
+        fprintf(fs, "]");
+      }
+      fprintf(fs, "}\n");
+      fflush(fs);
+    }
+    if (done || now - last_stats >= stats_interval) last_stats = now;
+    if (checkpoint_pid > 0 && waitpid(checkpoint_pid, &status, done ? 0 : WNOHANG) == checkpoint_pid) {
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) printf("\nERROR: checkpoint %s could not be written\n", checkpoint_file);
+      else if (debug_mode > 0) printf("%cCheckpoint written to %s%60s\n", 13, checkpoint_file, "");
+      checkpoint_pid = 0;
+    }
+    if (checkpoint_file[0] != 0 && !done && checkpoint_pid == 0 && now - last_checkpoint >= checkpoint_interval) {
+      fflush(stdout);
+      checkpoint_pid = fork();
+      if (checkpoint_pid == 0) {
+        // (the child has a frozen copy of the replicas to merge)
+        if (numa == 2) SyncReplicas();
+        _exit(WriteCheckpoint(checkpoint_file, checkpoint_tmp_file) ? 1 : 0);
+      }
+      if (checkpoint_pid < 0) {
+        printf("\nERROR: cannot fork to write checkpoint\n");
+        checkpoint_pid = 0;
+      }
+      last_checkpoint = now;
+    }
+    if (numa == 2 && !done && now - last_sync >= numa_sync_interval) {
+      SyncReplicas();
+      last_sync = now;
+    }
+    if (dist == 2 && !done && now - last_dist_sync >= dist_sync_interval) {
+      WorkerSync(0);
+      last_dist_sync = GetTime();
+    }
+    if (done) break;
+    usleep(100000);
+  }
+  if (fs != NULL) fclose(fs);
+  free(epoch_avg);
   pthread_exit(NULL);
 }
 
@@ -903,43 +4785,151 @@ void *TrainModelThread(void *id) {
 // `output_file` or, if `classes` is greater than zero, run k-means
 // clustering and save those clusters to `output_file`.
 //
+// If `encoded_file` is set, train on the pre-tokenized word indices in
+// that file rather than on the text in `train_file`, first encoding
+// `train_file` into it if necessary.
+//
 // If `output_file` is empty (first byte is null), do not train; this
-// can be used to learn the vocabulary only from a training text file.
+// can be used to learn the vocabulary (and encode the training data)
+// only from a training text file.
+//
+// If `stream` is set, read `train_file` once, sequentially, learning the
+// vocabulary while training (see `StreamReaderThread`).
+//
+// If `dist` is 1, do not train, but coordinate the training of worker
+// processes (see `RunCoordinator`), then save their merged model; if it
+// is 2, get the vocabulary from the coordinator and train as one of its
+// workers (saving word embeddings only if `output_file` is set).
 void TrainModel() {
   long a, b, c, d; // loop counters among other things
   FILE *fo;        // output file
   pthread_t *pt = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+  pthread_t monitor, reader;
+  FILE *checkpoint_in = NULL; // checkpoint file (if resuming)
 
-  printf("Starting training using file %s\n", train_file);
+  if (train_file[0] != 0) printf("Starting training using file %s\n", train_file);
+  else printf("Starting training using encoded file %s\n", encoded_file);
 
   // initialize learning rate
   starting_alpha = alpha;
+  // (workers can connect while the coordinator learns the vocabulary)
+  if (dist == 1) dist_listen_fd = OpenDistSocket(dist_addr, 1);
 
-  // read vocab from file or learn from training data
-  if (read_vocab_file[0] != 0) ReadVocab(); else LearnVocabFromTrainFile();
-  // save vocab to file
-  if (save_vocab_file[0] != 0) SaveVocab();
+  // map training data into memory (unless training on an existing
+  // encoded file only, or streaming)
+  if (train_file[0] != 0 && !stream) MapTrainFile();
+  // read vocab from checkpoint or coordinator or file or learn from
+  // training data (in streaming mode, it is learned while training)
+  if (stream) InitStream();
+  else if (resume) checkpoint_in = ReadCheckpointVocab();
+  else if (dist == 2) JoinCoordinator();
+  else if (read_vocab_file[0] != 0) ReadVocab();
+  else LearnVocabFromTrainFile();
+  if (!resume) {
+    // (in streaming mode, `epoch_words` is 0 or the expected number of
+    // words given on the command line)
+    if (!stream) epoch_words = train_words;
+    if (alpha_min < 0) alpha_min = starting_alpha * 0.0001;
+  }
+  // save vocab to file (in streaming mode, after training)
+  if (save_vocab_file[0] != 0 && !stream) SaveVocab();
+  // encode training data (or check and load existing encoded data)
+  if (encoded_file[0] != 0) MapEncodedFile();
   // if no `output_file` is specified, exit (do not train)
-  if (output_file[0] == 0) return;
+  if (output_file[0] == 0 && dist != 2) return;
+  // cut training data into chunks for the training threads
+  if (!stream && dist != 1) InitChunks();
 
-  // initialize network parameters
+  // initialize network parameters (from checkpoint if resuming; in
+  // streaming mode, for every slot of the bounded vocabulary)
+  if (numa) InitNuma();
+  if (stream) vocab_size = vocab_max_size;
   InitNet();
-  // initialize negative sampling distribution
-  if (negative > 0) InitUnigramTable();
+  if (stream) vocab_size = 1;
+  if (resume) ReadCheckpointNet(checkpoint_in);
+  else if (init_model_file[0] != 0) ReadModelNet();
+  if (numa == 2) InitReplicas();
+  if (dist == 2) InitDistBase();
+  if (hot_words > vocab_size) hot_words = vocab_size;
+  if (hot_words > 0) {
+    hot_syn0_changers = (int *)calloc(num_nodes * hot_words, sizeof(int));
+    hot_syn1neg_changers = (int *)calloc(num_nodes * hot_words, sizeof(int));
+  }
+  // initialize negative sampling distribution (in streaming mode,
+  // `stream_table` is filled while training)
+  if (negative > 0 && !stream && dist != 1) {
+    start = GetTime();
+    if (alias) InitAliasTable();
+    else InitUnigramTable();
+    sampler_build_time = GetTime() - start;
+    if (debug_mode > 0) MeasureNegativeSampler();
+  }
 
-  start = clock();
-  for (a = 0; a < num_threads; a++) pthread_create(&pt[a], NULL, TrainModelThread, (void *)a);
-  for (a = 0; a < num_threads; a++) pthread_join(pt[a], NULL);
+  a = posix_memalign((void **)&train_stats, 64, num_threads * sizeof(struct thread_stats));
+  if (train_stats == NULL) {printf("Memory allocation failed\n"); exit(1);}
+  memset(train_stats, 0, num_threads * sizeof(struct thread_stats));
+  a = posix_memalign((void **)&train_states, 64, num_threads * sizeof(struct thread_checkpoint));
+  if (train_states == NULL) {printf("Memory allocation failed\n"); exit(1);}
+  memset(train_states, 0, num_threads * sizeof(struct thread_checkpoint));
+  if (loss) {
+    epoch_loss = (double *)calloc(num_threads * iter, sizeof(double));
+    epoch_loss_count = (long long *)calloc(num_threads * iter, sizeof(long long));
+  }
+  start = GetTime();
+  start_words = word_count_actual;
+  start_faults = MajorFaults();
+  training_done = 0;
+  if (dist == 1) RunCoordinator();
+  else {
+    pthread_create(&monitor, NULL, MonitorThread, NULL);
+    if (stream) pthread_create(&reader, NULL, StreamReaderThread, NULL);
+    for (a = 0; a < num_threads; a++) pthread_create(&pt[a], NULL, TrainModelThread, (void *)a);
+    for (a = 0; a < num_threads; a++) pthread_join(pt[a], NULL);
+    if (stream) pthread_join(reader, NULL);
+    training_done = 1;
+    pthread_join(monitor, NULL);
+  }
+  if (numa == 2) SyncReplicas();
+  if (weights_dir[0] != 0 && debug_mode > 0 && dist != 1)
+    printf("\nOut-of-core weights: %.2f MB in %s, %.2f MB of them in memory; %lld major page faults, %.2fk words/sec\n",
+     mapped_bytes / 1048576.0, weights_dir, pinned_bytes / 1048576.0, MajorFaults() - start_faults,
+     (word_count_actual - start_words) / (GetTime() - start) / 1000);
+  if (dist == 2) {
+    // (a worker that has finished keeps syncing until all have)
+    while (!WorkerSync(1));
+    if (debug_mode > 0) printf("\nSynced %lld times with coordinator %s, %.2f MB sent, %.2f MB received\n",
+     dist_syncs, dist_addr, dist_bytes_out / 1048576, dist_bytes_in / 1048576);
+    fclose(dist_in[0]);
+    fclose(dist_out[0]);
+  }
+  if (numa && debug_mode > 0) {
+    printf("\n");
+    for (b = 0; b < num_nodes; b++) {
+      c = d = 0;
+      for (a = b; a < num_threads; a += num_nodes) {
+        c += train_stats[a].words;
+        d++;
+      }
+      printf("Node %d: %ld threads, %.2fk words/sec\n", node_id[b], d, c / (GetTime() - start) / 1000);
+    }
+  }
+  if (stream) {
+    if (debug_mode > 0) printf("\nStreamed %lld words, %lld words evicted from vocabulary", train_words, stream_evictions);
+    FinishStream();
+    if (debug_mode > 0) printf(", %lld words kept\n", vocab_size);
+    if (save_vocab_file[0] != 0) SaveVocab();
+  }
+  if (save_model_file[0] != 0) SaveModel();
+  if (debug_mode > 0 && negative > 0 && !stream && dist != 1) {
+    if (alias) printf("\nNegative sampler: alias table, %.2f MB", vocab_size * sizeof(struct alias_entry) / 1048576.0);
+    else printf("\nNegative sampler: unigram table, %.2f MB", table_size * sizeof(int) / 1048576.0);
+    printf(", built in %.2f ms, %.1f ns/draw\n", sampler_build_time * 1000, sampler_draw_time);
+  }
+  if (output_file[0] == 0) return;
   fo = fopen(output_file, "wb");
   if (classes == 0) {
     // Save the word vectors
-    fprintf(fo, "%lld %lld\n", vocab_size, layer1_size);
-    for (a = 0; a < vocab_size; a++) {
-      fprintf(fo, "%s ", vocab[a].word);
-      if (binary) for (b = 0; b < layer1_size; b++) fwrite(&syn0[a * layer1_size + b], sizeof(real), 1, fo);
-      else for (b = 0; b < layer1_size; b++) fprintf(fo, "%lf ", syn0[a * layer1_size + b]);
-      fprintf(fo, "\n");
-    }
+    SaveVectors(fo);
   } else {
     // Run K-means on the word vectors
     int clcn = classes, iter = 10, closeid;
@@ -952,7 +4942,7 @@ void TrainModel() {
       for (b = 0; b < clcn * layer1_size; b++) cent[b] = 0;
       for (b = 0; b < clcn; b++) centcn[b] = 1;
       for (c = 0; c < vocab_size; c++) {
-        for (d = 0; d < layer1_size; d++) cent[layer1_size * cl[c] + d] += syn0[c * layer1_size + d];
+        for (d = 0; d < layer1_size; d++) cent[layer1_size * cl[c] + d] += ParamToReal(syn0[c * layer1_size + d]);
         centcn[cl[c]]++;
       }
       for (b = 0; b < clcn; b++) {
@@ -969,7 +4959,7 @@ void TrainModel() {
         closeid = 0;
         for (d = 0; d < clcn; d++) {
           x = 0;
-          for (b = 0; b < layer1_size; b++) x += cent[layer1_size * d + b] * syn0[c * layer1_size + b];
+          for (b = 0; b < layer1_size; b++) x += cent[layer1_size * d + b] * ParamToReal(syn0[c * layer1_size + b]);
           if (x > closev) {
             closev = x;
             closeid = d;
@@ -1033,13 +5023,91 @@ int main(int argc, char **argv) {
     printf("\t-debug <int>\n");
     printf("\t\tSet the debug mode (default = 2 = more info during training)\n");
     printf("\t-binary <int>\n");
-    printf("\t\tSave the resulting vectors in binary moded; default is 0 (off)\n");
+    printf("\t\tSave the resulting vectors in binary moded; default is 0 (off); use 2 for binary in half precision\n");
+    printf("\t\t(bf16 if the weights are bf16, fp16 otherwise), 3 for the mapped vector format that distance,\n");
+    printf("\t\tword-analogy, and compute-accuracy can use in place (see vectors.h)\n");
+    printf("\t-normalize <int>\n");
+    printf("\t\tWith -binary 3, scale the vectors to unit length (as the tools use them); default is 0 (off)\n");
     printf("\t-save-vocab <file>\n");
     printf("\t\tThe vocabulary will be saved to <file>\n");
     printf("\t-read-vocab <file>\n");
     printf("\t\tThe vocabulary will be read from <file>, not constructed from the training data\n");
+    printf("\t-simd <name>\n");
+    printf("\t\tUse <name> vector kernels for training: scalar, sse, avx2, avx512, or auto (default; best supported by the CPU)\n");
+    printf("\t-encoded <file>\n");
+    printf("\t\tTrain on vocabulary indices pre-tokenized from the training data in <file>; <file> is created if it does not\n");
+    printf("\t\texist or was encoded with a different vocabulary (use with -read-vocab to reuse it across runs without -train)\n");
     printf("\t-cbow <int>\n");
     printf("\t\tUse the continuous bag of words model; default is 1 (use 0 for skip-gram model)\n");
+    printf("\t-stats-file <file>\n");
+    printf("\t\tWrite training statistics (progress, words/sec overall and per thread, reading vs computing time)\n");
+    printf("\t\tto <file> as JSON lines\n");
+    printf("\t-stats-interval <float>\n");
+    printf("\t\tWrite a line of statistics every <float> seconds; default is 10\n");
+    printf("\t-checkpoint <file>\n");
+    printf("\t\tPeriodically save the training state (vocabulary, parameters, progress) to <file>\n");
+    printf("\t-checkpoint-interval <float>\n");
+    printf("\t\tSave a checkpoint every <float> seconds; default is 3600\n");
+    printf("\t-resume <int>\n");
+    printf("\t\tResume training from the -checkpoint file (with the same -train or -encoded data, -size, -hs,\n");
+    printf("\t\t-negative, -threads, and -iter); default is 0 (off)\n");
+    printf("\t-save-model <file>\n");
+    printf("\t\tSave the model (vocabulary with counts, all weights) to <file> to continue training it later\n");
+    printf("\t-init-model <file>\n");
+    printf("\t\tContinue training the model saved in <file> on new training data: word counts are merged, new words\n");
+    printf("\t\tget fresh vectors, and each iteration covers only the new data\n");
+    printf("\t-alpha-min <float>\n");
+    printf("\t\tSet the minimum learning rate; default is 0.0001 times the starting learning rate\n");
+    printf("\t-loss <int>\n");
+    printf("\t\tCompute the training loss (average log-loss per prediction), reported every -stats-interval seconds\n");
+    printf("\t\tand after each iteration; default is 0 (off)\n");
+    printf("\t-alias <int>\n");
+    printf("\t\tDraw negative examples from an alias table (one entry per vocabulary word) instead of the 1e8-entry\n");
+    printf("\t\tunigram table; default is 0 (off)\n");
+    printf("\t-batch <int>\n");
+    printf("\t\tWith skip-gram and negative sampling, share the negative examples among all context words of a window\n");
+    printf("\t\tand train on them as a minibatch using matrix products; default is 0 (off)\n");
+    printf("\t-stream <int>\n");
+    printf("\t\tLearn the vocabulary and the word vectors in a single pass, reading the -train data sequentially\n");
+    printf("\t\t(use -train - to read stdin); default is 0 (off).  Not supported with -hs, -alias, -read-vocab,\n");
+    printf("\t\t-encoded, -checkpoint, or -init-model\n");
+    printf("\t-stream-vocab <int>\n");
+    printf("\t\tKeep at most <int> words in the vocabulary while streaming, evicting the least frequent; default is 1000000\n");
+    printf("\t-stream-words <int>\n");
+    printf("\t\tExpected number of words in the streamed data, for the learning rate schedule and progress;\n");
+    printf("\t\tdefault is 0 (unknown: the learning rate stays at -alpha)\n");
+    printf("\t-numa <int>\n");
+    printf("\t\tPin training threads to the CPUs of each NUMA node in turn and interleave the weights across nodes (1),\n");
+    printf("\t\tor also give each node its own replica of the weights, merged periodically (2); default is 0 (off)\n");
+    printf("\t-numa-sync <float>\n");
+    printf("\t\tMerge the replicas of -numa 2 every <float> seconds; default is 1\n");
+    printf("\t-hot-words <int>\n");
+    printf("\t\tTrain the weights of the <int> most frequent words in per-thread copies, merged into the shared\n");
+    printf("\t\tweights periodically, to avoid contention between threads; default is 0 (off)\n");
+    printf("\t-hot-sync <int>\n");
+    printf("\t\tMerge each thread's copies every <int> words; default is 10000\n");
+    printf("\t-stochastic-round <int>\n");
+    printf("\t\tWith 16-bit weights (make PRECISION=bf16 or PRECISION=fp16; these weights are %s), round updated\n", param_names[PARAM_TYPE]);
+    printf("\t\tweights stochastically rather than to nearest, so that small updates are not lost; default is 0 (off)\n");
+    printf("\t-coordinator <addr>\n");
+    printf("\t\tCoordinate distributed training by -workers worker processes instead of training: learn the vocabulary,\n");
+    printf("\t\tsend it to the workers, merge their weights, and save them to -output.  <addr> is host:port or :port\n");
+    printf("\t\t(all interfaces) for TCP, or a path (containing a slash) for a Unix domain socket\n");
+    printf("\t-workers <int>\n");
+    printf("\t\tNumber of worker processes of -coordinator; default is 0\n");
+    printf("\t-worker <addr>\n");
+    printf("\t\tTrain as a worker of the -coordinator at <addr>, on a shard of the -train data (which each worker needs\n");
+    printf("\t\ta copy of), with the vocabulary and the -size, -window, -sample, -hs, -negative, -cbow, -batch, -iter,\n");
+    printf("\t\t-alpha, and -alpha-min of the coordinator.  Not supported with -read-vocab or -numa 2\n");
+    printf("\t-dist-sync <float>\n");
+    printf("\t\tSync the weights of a -worker with the coordinator every <float> seconds; default is 10.  Changed rows\n");
+    printf("\t\tonly are sent; each sync costs a copy of the weights in memory\n");
+    printf("\t-weights-dir <dir>\n");
+    printf("\t\tKeep the weights in scratch files in <dir>, paged in and out by the kernel, to train vocabularies whose\n");
+    printf("\t\tweights do not fit in memory; the rows of the words of each sentence are read ahead.  Not supported with -numa\n");
+    printf("\t\tor -checkpoint\n");
+    printf("\t-pin-words <int>\n");
+    printf("\t\tWith -weights-dir, keep the weights of the <int> most frequent words in (locked) memory; default is 100000\n");
     printf("\nExamples:\n");
     printf("./word2vec -train data.txt -output vec.txt -size 200 -window 5 -sample 1e-4 -negative 5 -hs 0 -binary 0 -cbow 1 -iter 3\n\n");
     return 0;
@@ -1047,12 +5115,22 @@ int main(int argc, char **argv) {
   output_file[0] = 0;
   save_vocab_file[0] = 0;
   read_vocab_file[0] = 0;
+  encoded_file[0] = 0;
+  stats_file[0] = 0;
+  checkpoint_file[0] = 0;
+  save_model_file[0] = 0;
+  init_model_file[0] = 0;
+  weights_dir[0] = 0;
+  strcpy(simd, "auto");
   if ((i = ArgPos((char *)"-size", argc, argv)) > 0) layer1_size = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-train", argc, argv)) > 0) strcpy(train_file, argv[i + 1]);
   if ((i = ArgPos((char *)"-save-vocab", argc, argv)) > 0) strcpy(save_vocab_file, argv[i + 1]);
   if ((i = ArgPos((char *)"-read-vocab", argc, argv)) > 0) strcpy(read_vocab_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-encoded", argc, argv)) > 0) strcpy(encoded_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-simd", argc, argv)) > 0) strcpy(simd, argv[i + 1]);
   if ((i = ArgPos((char *)"-debug", argc, argv)) > 0) debug_mode = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-binary", argc, argv)) > 0) binary = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-normalize", argc, argv)) > 0) normalize = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-cbow", argc, argv)) > 0) cbow = atoi(argv[i + 1]);
   if (cbow) alpha = 0.05;
   if ((i = ArgPos((char *)"-alpha", argc, argv)) > 0) alpha = atof(argv[i + 1]);
@@ -1061,12 +5139,99 @@ int main(int argc, char **argv) {
   if ((i = ArgPos((char *)"-sample", argc, argv)) > 0) sample = atof(argv[i + 1]);
   if ((i = ArgPos((char *)"-hs", argc, argv)) > 0) hs = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-negative", argc, argv)) > 0) negative = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-batch", argc, argv)) > 0) batch = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-alias", argc, argv)) > 0) alias = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-loss", argc, argv)) > 0) loss = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-checkpoint", argc, argv)) > 0) strcpy(checkpoint_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-checkpoint-interval", argc, argv)) > 0) checkpoint_interval = atof(argv[i + 1]);
+  if ((i = ArgPos((char *)"-resume", argc, argv)) > 0) resume = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-save-model", argc, argv)) > 0) strcpy(save_model_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-init-model", argc, argv)) > 0) strcpy(init_model_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-alpha-min", argc, argv)) > 0) alpha_min = atof(argv[i + 1]);
+  if ((i = ArgPos((char *)"-stream", argc, argv)) > 0) stream = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-stream-vocab", argc, argv)) > 0) stream_vocab_size = atoll(argv[i + 1]);
+  if ((i = ArgPos((char *)"-stream-words", argc, argv)) > 0) epoch_words = atoll(argv[i + 1]);
+  if ((i = ArgPos((char *)"-numa", argc, argv)) > 0) numa = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-numa-sync", argc, argv)) > 0) numa_sync_interval = atof(argv[i + 1]);
+  if ((i = ArgPos((char *)"-hot-words", argc, argv)) > 0) hot_words = atoll(argv[i + 1]);
+  if ((i = ArgPos((char *)"-hot-sync", argc, argv)) > 0) hot_sync = atoll(argv[i + 1]);
+  if ((i = ArgPos((char *)"-stochastic-round", argc, argv)) > 0) stochastic_round = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-coordinator", argc, argv)) > 0) {
+    strcpy(dist_addr, argv[i + 1]);
+    dist = 1;
+  }
+  if ((i = ArgPos((char *)"-worker", argc, argv)) > 0) {
+    if (dist == 1) {
+      printf("ERROR: -coordinator and -worker are exclusive\n");
+      return 1;
+    }
+    strcpy(dist_addr, argv[i + 1]);
+    dist = 2;
+  }
+  if ((i = ArgPos((char *)"-workers", argc, argv)) > 0) dist_workers = atoi(argv[i + 1]);
+  if ((i = ArgPos((char *)"-dist-sync", argc, argv)) > 0) dist_sync_interval = atof(argv[i + 1]);
+  if ((i = ArgPos((char *)"-weights-dir", argc, argv)) > 0) strcpy(weights_dir, argv[i + 1]);
+  if ((i = ArgPos((char *)"-pin-words", argc, argv)) > 0) pin_words = atoll(argv[i + 1]);
+  if (weights_dir[0] != 0 && (numa || checkpoint_file[0] != 0)) {
+    // (a checkpoint is written by a forked copy of the process, which
+    // shares the mapped weights with the parent that goes on training
+    // them, so they would not match the saved progress)
+    printf("ERROR: -weights-dir is not supported with -numa or -checkpoint\n");
+    return 1;
+  }
+  if (stochastic_round && PARAM_TYPE == PARAM_REAL) {
+    printf("ERROR: -stochastic-round requires 16-bit weights (make PRECISION=bf16 or PRECISION=fp16)\n");
+    return 1;
+  }
+  if (resume && checkpoint_file[0] == 0) {
+    printf("ERROR: -resume requires -checkpoint\n");
+    return 1;
+  }
+  strcpy(checkpoint_tmp_file, checkpoint_file);
+  strcat(checkpoint_tmp_file, ".tmp");
+  if ((i = ArgPos((char *)"-stats-file", argc, argv)) > 0) strcpy(stats_file, argv[i + 1]);
+  if ((i = ArgPos((char *)"-stats-interval", argc, argv)) > 0) stats_interval = atof(argv[i + 1]);
   if ((i = ArgPos((char *)"-threads", argc, argv)) > 0) num_threads = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-iter", argc, argv)) > 0) iter = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-min-count", argc, argv)) > 0) min_count = atoi(argv[i + 1]);
   if ((i = ArgPos((char *)"-classes", argc, argv)) > 0) classes = atoi(argv[i + 1]);
+  if (stream) {
+    if (hs || alias || read_vocab_file[0] != 0 || encoded_file[0] != 0 || checkpoint_file[0] != 0 || init_model_file[0] != 0) {
+      // (the alias table is built once from the counts of a fixed
+      // vocabulary)
+      printf("ERROR: -stream is not supported with -hs, -alias, -read-vocab, -encoded, -checkpoint, or -init-model\n");
+      return 1;
+    }
+    if (numa == 2 || hot_words > 0) {
+      // (the vocabulary is not sorted, and evicted words are
+      // re-initialized in place)
+      printf("ERROR: -stream is not supported with -numa 2 or -hot-words\n");
+      return 1;
+    }
+    if (train_file[0] == 0 || output_file[0] == 0 || stream_vocab_size < 1) {
+      printf("ERROR: -stream requires -train, -output, and a positive -stream-vocab\n");
+      return 1;
+    }
+    // (a single pass over the data)
+    iter = 1;
+  }
+  if (dist) {
+    if (stream || encoded_file[0] != 0 || checkpoint_file[0] != 0 || init_model_file[0] != 0) {
+      printf("ERROR: -coordinator and -worker are not supported with -stream, -encoded, -checkpoint, or -init-model\n");
+      return 1;
+    }
+    if (dist == 1 && (dist_workers < 1 || output_file[0] == 0)) {
+      printf("ERROR: -coordinator requires -output and a positive -workers\n");
+      return 1;
+    }
+    if (dist == 2 && (train_file[0] == 0 || read_vocab_file[0] != 0 || numa == 2)) {
+      printf("ERROR: -worker requires -train, and is not supported with -read-vocab or -numa 2\n");
+      return 1;
+    }
+    // (the coordinator does not train)
+    if (dist == 1) numa = 0;
+  }
   vocab = (struct vocab_word *)calloc(vocab_max_size, sizeof(struct vocab_word));
-  vocab_hash = (int *)calloc(vocab_hash_size, sizeof(int));
   // precompute e^x / (e^x + 1) for x in [-MAX_EXP, MAX_EXP)
   // TODO extra element (+ 1) seems unused?
   expTable = (real *)malloc((EXP_TABLE_SIZE + 1) * sizeof(real));
@@ -1076,6 +5241,12 @@ int main(int argc, char **argv) {
     // Precompute f(x) = x / (x + 1)
     expTable[i] = expTable[i] / (expTable[i] + 1);
   }
+  if (loss) {
+    logSigTable = (real *)malloc((EXP_TABLE_SIZE + 1) * sizeof(real));
+    for (i = 0; i <= EXP_TABLE_SIZE; i++)
+      logSigTable[i] = -log(1 + exp(-(i / (real)EXP_TABLE_SIZE * 2 - 1) * MAX_EXP));
+  }
+  InitKernels();
   TrainModel();
   return 0;
 }